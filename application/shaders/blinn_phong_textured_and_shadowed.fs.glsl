@@ -1,17 +1,38 @@
 #version 330 core
+#extension GL_ARB_texture_gather : enable
 
 #define MAX_NUM_LIGHT_SOURCES 8
+#define MAX_NUM_SAMPLES 256
+
+// NOTE: distributions
+#define BLOCKER_SEARCH_DISTRIBUTION 0
+#define PCF_DISTRIBUTION 1
+#define BLOCKER_SEARCH_QUAD_DISTRIBUTION 2
+#define PCF_QUAD_DISTRIBUTION 3
 
 #define DIRECTIONAL_LIGHT 1
 #define POINT_LIGHT 2
+#define SPOT_LIGHT 3
 
 #define NEAR 0.1
+#define TWO_PI 6.28318530718
 
 // NOTE: display modes
 #define HARD_SHADOWS 0
 #define SOFT_SHADOWS 1
 #define BLOCKER_SEARCH 2
 #define PENUMBRA_ESTIMATE 3
+#define MOMENT_SOFT_SHADOWS 4
+
+// NOTE: shadow filters (see Shadow())
+#define HARD_FILTER 0
+#define COMPARISON_FILTER 1
+#define PCSS_FILTER 2
+#define MSM_FILTER 3
+
+#define MOMENT_BIAS 3e-5
+// NOTE: below this footprint (in texels) summed-area table reads are dominated by single precision rounding
+#define MIN_SUMMED_AREA_TABLE_WIDTH 4
 
 in vec2 vTexcoords;
 in vec3 vNormal;
@@ -27,7 +48,11 @@ struct LightSource
 	float specularPower;
 	vec3 position;
 	int type;
+	vec3 direction;
 	float size;
+	float cosInnerAngle;
+	float cosOuterAngle;
+	float radius;
 
 };
 
@@ -37,6 +62,13 @@ layout (std140) uniform LightSources
 
 };
 
+// NOTE: Poisson-disc samples in [-1, 1], two per vec4, in this order: blocker search, PCF, blocker search (quads) and PCF (quads) distributions
+layout (std140) uniform Distributions
+{
+	vec4 distributions[MAX_NUM_SAMPLES * 2];
+
+};
+
 uniform sampler2D shadowMap0;
 uniform sampler2D shadowMap1;
 uniform sampler2D shadowMap2;
@@ -45,6 +77,18 @@ uniform sampler2D shadowMap4;
 uniform sampler2D shadowMap5;
 uniform sampler2D shadowMap6;
 uniform sampler2D shadowMap7;
+uniform sampler2DShadow shadowMapComparison0;
+uniform sampler2DShadow shadowMapComparison1;
+uniform sampler2DShadow shadowMapComparison2;
+uniform sampler2DShadow shadowMapComparison3;
+uniform sampler2DShadow shadowMapComparison4;
+uniform sampler2DShadow shadowMapComparison5;
+uniform sampler2DShadow shadowMapComparison6;
+uniform sampler2DShadow shadowMapComparison7;
+// NOTE: one layer per light source
+uniform sampler2DArray momentMaps;
+// NOTE: inclusive summed-area tables of the moment maps, centered on their average moments (i.e., their last mip level)
+uniform sampler2DArray summedAreaTables;
 uniform samplerCube shadowCubeMap0;
 uniform samplerCube shadowCubeMap1;
 uniform samplerCube shadowCubeMap2;
@@ -61,37 +105,242 @@ uniform mat4 shadowMapViewProjection4;
 uniform mat4 shadowMapViewProjection5;
 uniform mat4 shadowMapViewProjection6;
 uniform mat4 shadowMapViewProjection7;
+// NOTE: 2D shadow maps (directional, spot and dual-paraboloid) are tiles of a shared atlas, bound as every shadowMapN,
+// each one with its rectangle in atlas texture coordinates (offset in xy, scale in zw)
+uniform vec4 shadowMapRects[MAX_NUM_LIGHT_SOURCES];
+// NOTE: light positions the point and spot light shadow maps were rendered from (they differ from the current ones while an update is deferred)
+uniform vec3 shadowMapLightPositions[MAX_NUM_LIGHT_SOURCES];
+// NOTE: cube map faces without casters (bit j for face j, in +x, -x, +y, -y, +z, -z order)
+uniform int emptyCubeFaces[MAX_NUM_LIGHT_SOURCES];
+uniform vec2 shadowAtlasSize = vec2(1);
+// NOTE: perspective warps of the directional light shadow maps (bit i set for warped maps), applied to the xy of the
+// shadow map coordinates (the depth is the unwarped one, see shadow_pass.fs.glsl)
+uniform int warpedShadowMaps = 0;
+uniform mat4 shadowMapWarps[MAX_NUM_LIGHT_SOURCES];
+// NOTE: in this mode the atlas tiles of directional lights are pools of physical pages, mapped from their virtual shadow maps
+// by a page table per light (physical page coordinates, (0, 0) being a cleared page for non-resident virtual pages)
+uniform bool useVirtualShadowMaps = false;
+uniform sampler2DArray pageTables;
+uniform int virtualPagesPerSide = 1;
+uniform int physicalPagesPerSide = 1;
 uniform float directionalLightShadowMapBias;
 uniform float pointLightShadowMapBias;
+uniform float momentMapSize = 1024;
+// NOTE: nearest and farthest depths per block of texels of the directional light shadow maps (one layer per light, min/max mipmaps),
+// soft shadows fully lit or fully shadowed over the whole blocker search region are resolved from it (see MinMaxShadow())
+uniform bool useMinMaxShadowMaps = false;
+uniform sampler2DArray minMaxMaps;
+uniform bool useSummedAreaTables = false;
 
-uniform mat4 invView;
-uniform mat4 lightProjection;
+// NOTE: point (and spot) light shadow maps store distances to the light divided by the far plane
+uniform float pointLightNear = 1;
+uniform float pointLightFar = 10;
+// NOTE: point light shadow maps are bound as shadowMapN (instead of shadowCubeMapN) in this mode
+uniform bool useDualParaboloids = false;
 uniform vec3 eyePosition;
 uniform vec3 ambientColor = vec3(0.1,0.1,0.1);
 uniform vec3 specularColor = vec3(1,1,1);
 uniform float specularity = 0;
 uniform float frustumSize = 1;
+uniform bool useClusteredLighting = false;
+// NOTE: (offset, count) per cluster followed by the light indices (see ClusteredLighting::Grid::pack())
+uniform usamplerBuffer clusterData;
+// NOTE: two texels per light, position and radius then color and power (world space)
+uniform samplerBuffer clusteredLights;
+uniform ivec3 clusterGridSize = ivec3(1);
+uniform vec2 screenSize = vec2(1);
+uniform float clusterNear = 0.1;
+uniform float clusterFar = 100;
 uniform sampler2D tex0;
-uniform sampler1D distribution0;
-uniform sampler1D distribution1;
+uniform sampler2D blueNoise;
+uniform bool rotateSamples = true;
+uniform bool useTextureGather = false;
 uniform int numBlockerSearchSamples = 1;
 uniform int numPCFSamples = 1;
+// NOTE: shadow LOD, full PCSS up to the mid distance, sample counts scaled by shadowLODMidSampleScale up to the far distance and
+// a single tap beyond it, the tiers blending over shadowLODTransition (world units) around each distance (see SetupShadowLOD())
+uniform bool useShadowLOD = false;
+uniform float shadowLODMidDistance = 8;
+uniform float shadowLODFarDistance = 20;
+uniform float shadowLODTransition = 2;
+uniform float shadowLODMidSampleScale = 0.25;
+// NOTE: single tap of the far tier, bilinear comparison (directional and spot lights) instead of a hard one
+uniform bool useShadowLODFilteredTap = true;
+// NOTE: receivers seen at grazing angles count as farther, their footprint over the one of a pixel at unit distance
+uniform bool useShadowLODFootprint = false;
+uniform float pixelFootprint = 0.001;
 uniform int displayMode = 0;
 uniform int selectedLightSource = -1;
+// NOTE: lights whose influence is outside the camera frustum (still counted when normalizing)
+uniform int culledLights = 0;
+#ifdef SHADOW_MASKS
+// NOTE: shadow factors of lights 0-3 and 4-7 (one per channel) written by the shadow mask pass, read by this variant instead of the shadow maps
+uniform sampler2D shadowMasks0;
+uniform sampler2D shadowMasks1;
+#endif
 
+#ifdef SHADOW_MASK_PASS
+// NOTE: shadow mask pass variant, writes the shadow factors of all lights instead of shading (see WriteShadowMasks())
+layout(location = 1) out vec4 outShadowMask0;
+layout(location = 2) out vec4 outShadowMask1;
+#else
 out vec3 outColor;
+#endif
+
+// NOTE: per-pixel rotation of the Poisson-disc distributions (see SetupSampleRotation())
+mat2 sampleRotation = mat2(1);
+// NOTE: atlas tile of the light being shaded (see SetupShadowMapRect())
+vec4 shadowMapRect = vec4(0, 0, 1, 1);
+// NOTE: page table of the light being shaded, -1 if its shadow map is not virtual
+int pageTableLayer = -1;
+// NOTE: empty cube map faces of the light being shaded
+int emptyCubeFaceMask = 0;
+// NOTE: min/max map of the light being shaded, -1 if it has none
+int minMaxLayer = -1;
+// NOTE: warp of the light being shaded, if any, and its Jacobian at the receiver (see ShadowCoords())
+bool isShadowMapWarped = false;
+mat4 shadowMapWarp = mat4(1);
+mat2 shadowMapJacobian = mat2(1);
+// NOTE: sample counts of the receiver being shaded and the weight of its far tier (see SetupShadowLOD())
+int blockerSearchSamples = 1;
+int pcfSamples = 1;
+float farShadowWeight = 0;
+
+//////////////////////////////////////////////////////////////////////////
+void SetupSampleRotation()
+{
+	if (!rotateSamples)
+		return;
+	ivec2 texel = ivec2(gl_FragCoord.xy) % textureSize(blueNoise, 0);
+	float angle = texelFetch(blueNoise, texel, 0).r * TWO_PI;
+	float c = cos(angle), s = sin(angle);
+	sampleRotation = mat2(c, s, -s, c);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: sample counts shrink continuously across the mid transition, distributions are ordered so that their prefixes are spread as well
+// (see createPoissonDiscDistribution()). Must be called from uniform control flow (derivatives)
+void SetupShadowLOD()
+{
+	blockerSearchSamples = numBlockerSearchSamples;
+	pcfSamples = numPCFSamples;
+	farShadowWeight = 0;
+	if (!useShadowLOD)
+		return;
+	float viewDistance = length(vWorldPosition - eyePosition);
+	if (useShadowLODFootprint)
+		viewDistance = max(viewDistance, max(length(dFdx(vWorldPosition)), length(dFdy(vWorldPosition))) / pixelFootprint);
+	float halfTransition = shadowLODTransition * 0.5;
+	float midWeight = smoothstep(shadowLODMidDistance - halfTransition, shadowLODMidDistance + halfTransition, viewDistance);
+	farShadowWeight = smoothstep(shadowLODFarDistance - halfTransition, shadowLODFarDistance + halfTransition, viewDistance);
+	float sampleScale = mix(1.0, shadowLODMidSampleScale, midWeight);
+	blockerSearchSamples = max(1, int(numBlockerSearchSamples * sampleScale + 0.5));
+	pcfSamples = max(1, int(numPCFSamples * sampleScale + 0.5));
+}
+
+//////////////////////////////////////////////////////////////////////////
+void SetupShadowMapRect(int i)
+{
+	if (i >= 0 && i < MAX_NUM_LIGHT_SOURCES)
+	{
+		shadowMapRect = shadowMapRects[i];
+		pageTableLayer = (useVirtualShadowMaps && lightSources[i].type == DIRECTIONAL_LIGHT) ? i : -1;
+		emptyCubeFaceMask = emptyCubeFaces[i];
+		minMaxLayer = (useMinMaxShadowMaps && lightSources[i].type == DIRECTIONAL_LIGHT && pageTableLayer < 0) ? i : -1;
+		isShadowMapWarped = (warpedShadowMaps & (1 << i)) != 0;
+		shadowMapWarp = shadowMapWarps[i];
+		shadowMapJacobian = mat2(1);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: empty faces are lit, whatever the depth they hold
+bool IsEmptyCubeFace(vec3 direction)
+{
+	vec3 absDirection = abs(direction);
+	int face;
+	if (absDirection.x >= absDirection.y && absDirection.x >= absDirection.z)
+		face = (direction.x >= 0) ? 0 : 1;
+	else if (absDirection.y >= absDirection.z)
+		face = (direction.y >= 0) ? 2 : 3;
+	else
+		face = (direction.z >= 0) ? 4 : 5;
+	return (emptyCubeFaceMask & (1 << face)) != 0;
+}
 
 //////////////////////////////////////////////////////////////////////////
-vec2 RandomDirection(sampler1D distribution, float u)
+// NOTE: virtual shadow map coordinates to atlas coordinates, clamped half a texel inside the physical page
+vec2 VirtualAtlasCoords(vec2 uv)
 {
-   return texture(distribution, u).xy * 2 - vec2(1);
+	vec2 pageCoords = clamp(uv, 0, 1) * virtualPagesPerSide;
+	ivec2 virtualPage = min(ivec2(pageCoords), ivec2(virtualPagesPerSide - 1));
+	vec2 physicalPage = texelFetch(pageTables, ivec3(virtualPage, pageTableLayer), 0).rg;
+	vec2 halfTexel = 0.5 * physicalPagesPerSide / (shadowMapRect.zw * shadowAtlasSize);
+	vec2 pageUV = clamp(pageCoords - virtualPage, halfTexel, 1 - halfTexel);
+	return shadowMapRect.xy + ((physicalPage + pageUV) / physicalPagesPerSide) * shadowMapRect.zw;
 }
 
-/*vec3 DisturbDirection(vec3 direction, sampler1D distribution, float u)
+//////////////////////////////////////////////////////////////////////////
+// NOTE: shadow map coordinates to atlas coordinates, clamped half a texel inside the tile so that filtering never reads a neighbour
+vec2 AtlasCoords(vec2 uv)
+{
+	if (pageTableLayer >= 0)
+		return VirtualAtlasCoords(uv);
+	vec2 halfTexel = 0.5 / (shadowMapRect.zw * shadowAtlasSize);
+	return shadowMapRect.xy + clamp(uv, halfTexel, 1 - halfTexel) * shadowMapRect.zw;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: kernel offsets are measured in the unwarped shadow map, the Jacobian of the warp maps them around the receiver
+vec2 WarpOffset(vec2 offset)
+{
+	return shadowMapJacobian * offset;
+}
+
+//////////////////////////////////////////////////////////////////////////
+vec2 RandomDirection(int distribution, int i)
 {
-	// TODO:
-	return direction;
-}*/
+	vec4 samples = distributions[distribution * (MAX_NUM_SAMPLES / 2) + (i >> 1)];
+	return sampleRotation * (((i & 1) == 0) ? samples.xy : samples.zw);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// 2x2 texels around uv
+vec4 GatherDepths(sampler2D shadowMap, vec2 uv)
+{
+	uv = AtlasCoords(uv);
+#ifdef GL_ARB_texture_gather
+	return textureGather(shadowMap, uv);
+#else
+	// NOTE: the atlas is bilinearly filtered, so the 2x2 block is fetched (clamped to the edge, in textureGather() order)
+	ivec2 size = textureSize(shadowMap, 0);
+	ivec2 texel0 = clamp(ivec2(floor(uv * size - 0.5)), ivec2(0), size - 1);
+	ivec2 texel1 = min(texel0 + 1, size - 1);
+	return vec4(texelFetch(shadowMap, ivec2(texel0.x, texel1.y), 0).r,
+		texelFetch(shadowMap, texel1, 0).r,
+		texelFetch(shadowMap, ivec2(texel1.x, texel0.y), 0).r,
+		texelFetch(shadowMap, texel0, 0).r);
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: every gathered sample covers 4 texels, so only a quarter of the samples is taken (at least 1)
+int NumQuadSamples(int numSamples)
+{
+	return max(1, numSamples / 4);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: direction is the (normalized) cube map lookup direction, the returned offset is the (rotated) Poisson-disc sample
+// in the plane tangent to it, so that every sample moves the lookup and the kernel covers the disc evenly
+vec3 DisturbDirection(vec3 direction, int distribution, int i)
+{
+	vec3 up = (abs(direction.y) < 0.999) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+	vec3 tangent = normalize(cross(up, direction));
+	vec3 bitangent = cross(direction, tangent);
+	vec2 offset = RandomDirection(distribution, i);
+	return tangent * offset.x + bitangent * offset.y;
+}
 
 //////////////////////////////////////////////////////////////////////////
 vec3 BlinnPhong(vec3 materialDiffuseColor, 
@@ -109,6 +358,14 @@ vec3 BlinnPhong(vec3 materialDiffuseColor,
 						lightSpecularColor * lightSpecularPower / distanceAttenuation;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// NOTE: windowed inverse square falloff, reaches zero at the light radius (so that culling by the radius is exact)
+float InfluenceWindow(float lightDist, float radius)
+{
+	float window = clamp(1 - pow(lightDist / radius, 4), 0, 1);
+	return window * window;
+}
+
 //////////////////////////////////////////////////////////////////////////
 vec3 LightContribution(vec3 diffuseColor, int i)
 {
@@ -128,7 +385,7 @@ vec3 LightContribution(vec3 diffuseColor, int i)
 		vec3 lightDir = lightSources[i].position - vWorldPosition;
 		float lightDist = length(lightDir);
 		lightDir /= lightDist;
-		return BlinnPhong(diffuseColor,
+		return InfluenceWindow(lightDist, lightSources[i].radius) * BlinnPhong(diffuseColor,
 					specularColor,
 					specularity,
 					lightSources[i].diffuseColor,
@@ -137,16 +394,87 @@ vec3 LightContribution(vec3 diffuseColor, int i)
 					lightSources[i].specularPower,
 					max(0, dot(vNormal, normalize(lightDir + vViewDir))),
 					lightDist * lightDist);
+	case SPOT_LIGHT:
+	{
+		vec3 spotLightDir = lightSources[i].position - vWorldPosition;
+		float spotLightDist = length(spotLightDir);
+		spotLightDir /= spotLightDist;
+		float cone = smoothstep(lightSources[i].cosOuterAngle, lightSources[i].cosInnerAngle, dot(-spotLightDir, normalize(lightSources[i].direction)));
+		return cone * InfluenceWindow(spotLightDist, lightSources[i].radius) * BlinnPhong(diffuseColor,
+					specularColor,
+					specularity,
+					lightSources[i].diffuseColor,
+					lightSources[i].diffusePower,
+					lightSources[i].specularColor,
+					lightSources[i].specularPower,
+					max(0, dot(vNormal, normalize(spotLightDir + vViewDir))),
+					spotLightDist * spotLightDist);
+	}
 	default:
 		return vec3(0);
 	}
 }
 
+//////////////////////////////////////////////////////////////////////////
+// NOTE: unshadowed lights of the fragment's cluster
+vec3 ClusteredLightsContribution(vec3 diffuseColor)
+{
+	if (!useClusteredLighting)
+		return vec3(0);
+	float depth = -vCameraPosition.z;
+	if (depth < clusterNear || depth > clusterFar)
+		return vec3(0);
+	ivec2 tile = clamp(ivec2(gl_FragCoord.xy / screenSize * clusterGridSize.xy), ivec2(0), clusterGridSize.xy - 1);
+	int slice = clamp(int(log(depth / clusterNear) / log(clusterFar / clusterNear) * clusterGridSize.z), 0, clusterGridSize.z - 1);
+	int cluster = (slice * clusterGridSize.y + tile.y) * clusterGridSize.x + tile.x;
+	int offset = int(texelFetch(clusterData, cluster * 2).r);
+	int count = int(texelFetch(clusterData, cluster * 2 + 1).r);
+	vec3 contribution = vec3(0);
+	for (int k = 0; k < count; k++)
+	{
+		int l = int(texelFetch(clusterData, offset + k).r);
+		vec4 positionAndRadius = texelFetch(clusteredLights, l * 2);
+		vec4 colorAndPower = texelFetch(clusteredLights, l * 2 + 1);
+		vec3 lightDir = positionAndRadius.xyz - vWorldPosition;
+		float lightDist = length(lightDir);
+		if (lightDist >= positionAndRadius.w)
+			continue;
+		lightDir /= lightDist;
+		contribution += InfluenceWindow(lightDist, positionAndRadius.w) * BlinnPhong(diffuseColor,
+					specularColor,
+					specularity,
+					colorAndPower.rgb,
+					colorAndPower.a,
+					colorAndPower.rgb,
+					colorAndPower.a,
+					max(0, dot(vNormal, normalize(lightDir + vViewDir))),
+					max(lightDist * lightDist, NEAR));
+	}
+	return contribution;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: both hemispheres side by side, front (+z) on the left half and back (-z) on the right half
+vec2 ParaboloidCoords(vec3 direction)
+{
+	direction = normalize(direction);
+	vec2 uv = clamp((direction.xy / (1 + abs(direction.z))) * 0.5 + 0.5, 0, 1);
+	return vec2((uv.x + ((direction.z >= 0) ? 0 : 1)) * 0.5, uv.y);
+}
+
 //////////////////////////////////////////////////////////////////////////
 vec3 ShadowCoords(mat4 shadowMapViewProjection)
 {
 	vec4 projectedCoords = shadowMapViewProjection * vec4(vWorldPosition, 1);
 	vec3 shadowCoords = projectedCoords.xyz / projectedCoords.w;
+	if (isShadowMapWarped)
+	{
+		vec4 warpedCoords = shadowMapWarp * vec4(shadowCoords.xy, 0, 1);
+		vec2 uv = warpedCoords.xy / warpedCoords.w;
+		// NOTE: d(warped)/d(unwarped) of the projective map (the same in NDC and texture coordinates)
+		shadowMapJacobian = mat2(shadowMapWarp[0].xy - uv * shadowMapWarp[0].w, shadowMapWarp[1].xy - uv * shadowMapWarp[1].w) / warpedCoords.w;
+		shadowCoords.xy = uv;
+	}
 	shadowCoords = shadowCoords * 0.5 + 0.5;
 	return shadowCoords;
 }
@@ -157,6 +485,12 @@ bool IsLightEnabled(int i)
 	return lightSources[i].type != 0;
 }
 
+//////////////////////////////////////////////////////////////////////////
+bool IsLightCulled(int i)
+{
+	return (culledLights & (1 << i)) != 0;
+}
+
 //////////////////////////////////////////////////////////////////////////
 // this search area estimation comes from the following article: 
 // http://developer.download.nvidia.com/whitepapers/2008/PCSS_DirectionalLight_Integration.pdf
@@ -166,12 +500,28 @@ float SearchWidth(float uvLightSize, float receiverDistance)
 }
 
 //////////////////////////////////////////////////////////////////////////
-float Depth(vec3 pos)
+// NOTE: blockers of a spherical light of radius lightSize lie in the cone between the receiver and the light,
+// which is widest (in radians, seen from the light) at the light's near plane
+float SearchWidth_PointLight(float lightSize, float receiverDistance)
+{
+	return lightSize * max(0, receiverDistance - pointLightNear) / (receiverDistance * pointLightNear);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: spot light shadow maps are perspective projections of the outer cone,
+// so the light size is measured in units of the near plane width
+float UVLightSize_SpotLight(float lightSize, float cosOuterAngle)
 {
-    vec3 absPos = abs(pos);
-	float z = -max(absPos.x, max(absPos.y, absPos.z));
-	vec4 clip = lightProjection * vec4(0.0, 0.0, z, 1.0);
-	return (clip.z / clip.w) * 0.5 + 0.5;
+	float tanOuterAngle = sqrt(1 - cosOuterAngle * cosOuterAngle) / cosOuterAngle;
+	return lightSize / (2 * pointLightNear * tanOuterAngle);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: PCF kernel radius of the penumbra cast by a blocker at blockerDistance
+float UVRadius_DirectionalLight(float receiverDistance, float blockerDistance, float uvLightSize)
+{
+	float penumbraWidth = (receiverDistance - blockerDistance) / blockerDistance;
+	return penumbraWidth * uvLightSize * NEAR / receiverDistance;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -180,10 +530,45 @@ float FindBlockerDistance_DirectionalLight(vec3 shadowCoords, sampler2D shadowMa
 	int blockers = 0;
 	float avgBlockerDistance = 0;
 	float searchWidth = SearchWidth(uvLightSize, shadowCoords.z);
-	for (int i = 0; i < numBlockerSearchSamples; i++)
+	if (useTextureGather)
 	{
-		float z = texture(shadowMap, shadowCoords.xy + RandomDirection(distribution0, i / float(numBlockerSearchSamples)) * searchWidth).r;
-		if (z < (shadowCoords.z - directionalLightShadowMapBias))
+		int numQuadSamples = NumQuadSamples(blockerSearchSamples);
+		for (int i = 0; i < numQuadSamples; i++)
+		{
+			vec4 z = GatherDepths(shadowMap, shadowCoords.xy + WarpOffset(RandomDirection(BLOCKER_SEARCH_QUAD_DISTRIBUTION, i) * searchWidth));
+			vec4 isBlocker = vec4(lessThan(z, vec4(shadowCoords.z - directionalLightShadowMapBias)));
+			blockers += int(dot(isBlocker, vec4(1)));
+			avgBlockerDistance += dot(isBlocker, z);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < blockerSearchSamples; i++)
+		{
+			float z = texture(shadowMap, AtlasCoords(shadowCoords.xy + WarpOffset(RandomDirection(BLOCKER_SEARCH_DISTRIBUTION, i) * searchWidth))).r;
+			if (z < (shadowCoords.z - directionalLightShadowMapBias))
+			{
+				blockers++;
+				avgBlockerDistance += z;
+			}
+		}
+	}
+	if (blockers > 0)
+		return avgBlockerDistance / blockers;
+	else
+		return -1;
+}
+
+// NOTE: distances are normalized by the far plane, as stored in the cube map
+float FindBlockerDistance_PointLight(vec3 direction, float receiverDistance, samplerCube shadowCubeMap, float lightSize)
+{
+	int blockers = 0;
+	float avgBlockerDistance = 0;
+	float searchWidth = SearchWidth_PointLight(lightSize, receiverDistance * pointLightFar);
+	for (int i = 0; i < blockerSearchSamples; i++)
+	{
+		float z = texture(shadowCubeMap, direction + DisturbDirection(direction, BLOCKER_SEARCH_DISTRIBUTION, i) * searchWidth).r;
+		if (z < (receiverDistance - pointLightShadowMapBias))
 		{
 			blockers++;
 			avgBlockerDistance += z;
@@ -195,14 +580,14 @@ float FindBlockerDistance_DirectionalLight(vec3 shadowCoords, sampler2D shadowMa
 		return -1;
 }
 
-/*float FindBlockerDistance_PointLight(vec3 direction, float receiverDistance, samplerCube shadowCubeMap, float uvLightSize)
+float FindBlockerDistance_PointLight(vec3 direction, float receiverDistance, sampler2D paraboloidMap, float lightSize)
 {
 	int blockers = 0;
 	float avgBlockerDistance = 0;
-	float searchWidth = SearchWidth(uvLightSize, receiverDistance);
-	for (int i = 0; i < numBlockerSearchSamples; i++)
+	float searchWidth = SearchWidth_PointLight(lightSize, receiverDistance * pointLightFar);
+	for (int i = 0; i < blockerSearchSamples; i++)
 	{
-		float z = texture(shadowCubeMap, DisturbDirection(direction, distribution0, i / float(numBlockerSearchSamples)) * searchWidth).r;
+		float z = texture(paraboloidMap, AtlasCoords(ParaboloidCoords(direction + DisturbDirection(direction, BLOCKER_SEARCH_DISTRIBUTION, i) * searchWidth))).r;
 		if (z < (receiverDistance - pointLightShadowMapBias))
 		{
 			blockers++;
@@ -213,316 +598,439 @@ float FindBlockerDistance_DirectionalLight(vec3 shadowCoords, sampler2D shadowMa
 		return avgBlockerDistance / blockers;
 	else
 		return -1;
-}*/
+}
+
+// NOTE: same search as directional lights, but with receiver and blocker distances normalized by the far plane
+float FindBlockerDistance_SpotLight(vec2 uv, float receiverDistance, sampler2D shadowMap, float uvLightSize)
+{
+	int blockers = 0;
+	float avgBlockerDistance = 0;
+	float searchWidth = uvLightSize * max(0, receiverDistance - pointLightNear / pointLightFar) / receiverDistance;
+	for (int i = 0; i < blockerSearchSamples; i++)
+	{
+		float z = texture(shadowMap, AtlasCoords(uv + RandomDirection(BLOCKER_SEARCH_DISTRIBUTION, i) * searchWidth)).r;
+		if (z < (receiverDistance - pointLightShadowMapBias))
+		{
+			blockers++;
+			avgBlockerDistance += z;
+		}
+	}
+	if (blockers > 0)
+		return avgBlockerDistance / blockers;
+	else
+		return -1;
+}
 
 //////////////////////////////////////////////////////////////////////////
+// NOTE: hardware comparison with bilinear filtering, so every sample already filters 2x2 texels
+float PCF_DirectionalLight(vec3 shadowCoords, sampler2DShadow shadowMapComparison, float uvRadius)
+{
+	float sum = 0;
+	int numQuadSamples = NumQuadSamples(pcfSamples);
+	for (int i = 0; i < numQuadSamples; i++)
+		sum += texture(shadowMapComparison, vec3(AtlasCoords(shadowCoords.xy + WarpOffset(RandomDirection(PCF_QUAD_DISTRIBUTION, i) * uvRadius)), shadowCoords.z - directionalLightShadowMapBias));
+	return 1 - sum / numQuadSamples;
+}
+
 float PCF_DirectionalLight(vec3 shadowCoords, sampler2D shadowMap, float uvRadius)
 {
 	float sum = 0;
-	for (int i = 0; i < numPCFSamples; i++)
+	for (int i = 0; i < pcfSamples; i++)
 	{
-		float z = texture(shadowMap, shadowCoords.xy + RandomDirection(distribution1, i / float(numPCFSamples)) * uvRadius).r;
+		float z = texture(shadowMap, AtlasCoords(shadowCoords.xy + WarpOffset(RandomDirection(PCF_DISTRIBUTION, i) * uvRadius))).r;
 		sum += (z < (shadowCoords.z - directionalLightShadowMapBias)) ? 1 : 0;
 	}
-	return sum / numPCFSamples;
+	return sum / pcfSamples;
 }
 
-/*float PCF_PointLight(vec3 direction, float receiverDistance, samplerCube shadowCubeMap, float uvRadius)
+float PCF_PointLight(vec3 direction, float receiverDistance, samplerCube shadowCubeMap, float radius)
 {
 	float sum = 0;
-	for (int i = 0; i < numPCFSamples; i++)
+	for (int i = 0; i < pcfSamples; i++)
 	{
-		float z = texture(shadowCubeMap, DisturbDirection(direction, distribution1, i / float(numPCFSamples)) * uvRadius).r;
+		float z = texture(shadowCubeMap, direction + DisturbDirection(direction, PCF_DISTRIBUTION, i) * radius).r;
 		sum += (z < (receiverDistance - pointLightShadowMapBias)) ? 1 : 0;
 	}
-	return sum / numPCFSamples;
-}*/
+	return sum / pcfSamples;
+}
+
+float PCF_PointLight(vec3 direction, float receiverDistance, sampler2D paraboloidMap, float radius)
+{
+	float sum = 0;
+	for (int i = 0; i < pcfSamples; i++)
+	{
+		float z = texture(paraboloidMap, AtlasCoords(ParaboloidCoords(direction + DisturbDirection(direction, PCF_DISTRIBUTION, i) * radius))).r;
+		sum += (z < (receiverDistance - pointLightShadowMapBias)) ? 1 : 0;
+	}
+	return sum / pcfSamples;
+}
+
+float PCF_SpotLight(vec2 uv, float receiverDistance, sampler2D shadowMap, float uvRadius)
+{
+	float sum = 0;
+	for (int i = 0; i < pcfSamples; i++)
+	{
+		float z = texture(shadowMap, AtlasCoords(uv + RandomDirection(PCF_DISTRIBUTION, i) * uvRadius)).r;
+		sum += (z < (receiverDistance - pointLightShadowMapBias)) ? 1 : 0;
+	}
+	return sum / pcfSamples;
+}
 
 //////////////////////////////////////////////////////////////////////////
 float ShadowMapping_DirectionalLight(vec3 shadowCoords, sampler2D shadowMap, float uvLightSize)
 {
-	float z = texture(shadowMap, shadowCoords.xy).x;
+	float z = texture(shadowMap, AtlasCoords(shadowCoords.xy)).x;
 	return (z < (shadowCoords.z - directionalLightShadowMapBias)) ? 0 : 1;
 }
 
-float ShadowMapping_PointLight(vec3 lightPosition, samplerCube shadowCubeMap, float uvLightSize)
+float ShadowMapping_PointLight(vec3 lightPosition, samplerCube shadowCubeMap, float lightSize)
 {
-	mat4 lightView = mat4(1,0,0,0, 
-		0,1,0,0, 
-		0,0,1,0, 
-		-lightPosition.x,-lightPosition.y,-lightPosition.z, 1);
-	vec3 positionLightSpace = (lightView * invView * vec4(vCameraPosition, 1)).xyz;
-	float receiverDistance = Depth(positionLightSpace);
-	float z = texture(shadowCubeMap, positionLightSpace).r;
+	vec3 direction = vWorldPosition - lightPosition;
+	if (IsEmptyCubeFace(direction))
+		return 1;
+	float receiverDistance = length(direction) / pointLightFar;
+	float z = texture(shadowCubeMap, direction).r;
+	return (z < (receiverDistance - pointLightShadowMapBias)) ? 0 : 1;
+}
+
+float ShadowMapping_PointLight(vec3 lightPosition, sampler2D paraboloidMap, float lightSize)
+{
+	vec3 direction = vWorldPosition - lightPosition;
+	float receiverDistance = length(direction) / pointLightFar;
+	float z = texture(paraboloidMap, AtlasCoords(ParaboloidCoords(direction))).r;
+	return (z < (receiverDistance - pointLightShadowMapBias)) ? 0 : 1;
+}
+
+float ShadowMapping_SpotLight(vec3 lightPosition, mat4 shadowMapViewProjection, sampler2D shadowMap)
+{
+	float receiverDistance = length(vWorldPosition - lightPosition) / pointLightFar;
+	float z = texture(shadowMap, AtlasCoords(ShadowCoords(shadowMapViewProjection).xy)).r;
 	return (z < (receiverDistance - pointLightShadowMapBias)) ? 0 : 1;
 }
 
 //////////////////////////////////////////////////////////////////////////
-float PCSS_DirectionalLight(vec3 shadowCoords, sampler2D shadowMap, float uvLightSize)
+// NOTE: hardware comparison with bilinear filtering, i.e. 2x2 texels
+float FilteredShadow_DirectionalLight(vec3 shadowCoords, sampler2DShadow shadowMapComparison)
+{
+	return texture(shadowMapComparison, vec3(AtlasCoords(shadowCoords.xy), shadowCoords.z - directionalLightShadowMapBias));
+}
+
+float FilteredShadow_SpotLight(vec3 lightPosition, mat4 shadowMapViewProjection, sampler2DShadow shadowMapComparison)
 {
+	float receiverDistance = length(vWorldPosition - lightPosition) / pointLightFar;
+	return texture(shadowMapComparison, vec3(AtlasCoords(ShadowCoords(shadowMapViewProjection).xy), receiverDistance - pointLightShadowMapBias));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: 1 if every texel of the region is in front of the receiver (no blockers), 0 if every one is a blocker and the PCF
+// kernel of the nearest one (i.e., the widest penumbra the blocker search can find) stays inside the region, -1 otherwise.
+// Reads 2x2 texels of the coarsest level where the region spans at most 2 texels, which neighbouring receivers share
+float MinMaxShadow(vec3 shadowCoords, float uvLightSize)
+{
+	float searchWidth = SearchWidth(uvLightSize, shadowCoords.z);
+	int size = textureSize(minMaxMaps, 0).x;
+	vec2 jacobianScale = abs(shadowMapJacobian[0]) + abs(shadowMapJacobian[1]);
+	vec2 extent = jacobianScale * searchWidth;
+	vec2 uvMin = clamp(shadowCoords.xy - extent, 0, 1);
+	vec2 uvMax = clamp(shadowCoords.xy + extent, 0, 1);
+	float texels = max(uvMax.x - uvMin.x, uvMax.y - uvMin.y) * size;
+	int level = clamp(int(ceil(log2(max(texels, 1)))), 0, int(log2(float(size))));
+	int levelSize = max(1, size >> level);
+	ivec2 texelMin = min(ivec2(uvMin * levelSize), ivec2(levelSize - 1));
+	ivec2 texelMax = min(ivec2(uvMax * levelSize), texelMin + 1);
+	texelMax = min(texelMax, ivec2(levelSize - 1));
+	vec2 z0 = texelFetch(minMaxMaps, ivec3(texelMin, minMaxLayer), level).rg;
+	vec2 z1 = texelFetch(minMaxMaps, ivec3(texelMax.x, texelMin.y, minMaxLayer), level).rg;
+	vec2 z2 = texelFetch(minMaxMaps, ivec3(texelMin.x, texelMax.y, minMaxLayer), level).rg;
+	vec2 z3 = texelFetch(minMaxMaps, ivec3(texelMax, minMaxLayer), level).rg;
+	float minZ = min(min(z0.x, z1.x), min(z2.x, z3.x));
+	float maxZ = max(max(z0.y, z1.y), max(z2.y, z3.y));
+	float receiverZ = shadowCoords.z - directionalLightShadowMapBias;
+	if (minZ >= receiverZ)
+		return 1;
+	if (maxZ >= receiverZ || minZ <= 0)
+		return -1;
+	// NOTE: plus a texel, which bilinear comparisons (and gathers) read around each sample
+	vec2 kernelExtent = jacobianScale * UVRadius_DirectionalLight(shadowCoords.z, minZ, uvLightSize) + 1.0 / (shadowMapRect.zw * shadowAtlasSize);
+	if (all(lessThanEqual(kernelExtent, extent)))
+		return 0;
+	return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+float PCSS_DirectionalLight(vec3 shadowCoords, sampler2D shadowMap, sampler2DShadow shadowMapComparison, float uvLightSize)
+{
+	if (minMaxLayer >= 0)
+	{
+		float bounds = MinMaxShadow(shadowCoords, uvLightSize);
+		if (bounds >= 0)
+			return bounds;
+	}
+
 	// blocker search
 	float blockerDistance = FindBlockerDistance_DirectionalLight(shadowCoords, shadowMap, uvLightSize);
 	if (blockerDistance == -1)
 		return 1;		
 
 	// penumbra estimation
-	float penumbraWidth = (shadowCoords.z - blockerDistance) / blockerDistance;
+	float uvRadius = UVRadius_DirectionalLight(shadowCoords.z, blockerDistance, uvLightSize);
 
 	// percentage-close filtering
-	float uvRadius = penumbraWidth * uvLightSize * NEAR / shadowCoords.z;
+	if (useTextureGather)
+		return 1 - PCF_DirectionalLight(shadowCoords, shadowMapComparison, uvRadius);
 	return 1 - PCF_DirectionalLight(shadowCoords, shadowMap, uvRadius);
 }
 
-float PCSS_PointLight(vec3 lightPosition, samplerCube shadowCubeMap, float uvLightSize)
+float PCSS_PointLight(vec3 lightPosition, samplerCube shadowCubeMap, float lightSize)
 {
-	mat4 lightView = mat4(1,0,0,0, 
-		0,1,0,0, 
-		0,0,1,0, 
-		-lightPosition.x,-lightPosition.y,-lightPosition.z, 1);
-	vec3 positionLightSpace = (lightView * invView * vec4(vCameraPosition, 1)).xyz;
-	float receiverDistance = Depth(positionLightSpace);
-	float z = texture(shadowCubeMap, positionLightSpace).r;
-	return (z < (receiverDistance - pointLightShadowMapBias)) ? 0 : 1;
+	vec3 direction = vWorldPosition - lightPosition;
+	if (IsEmptyCubeFace(direction))
+		return 1;
+	float receiverDistance = length(direction) / pointLightFar;
+	direction = normalize(direction);
+
+	// blocker search
+	float blockerDistance = FindBlockerDistance_PointLight(direction, receiverDistance, shadowCubeMap, lightSize);
+	if (blockerDistance == -1)
+		return 1;
+
+	// penumbra estimation
+	float penumbraWidth = (receiverDistance - blockerDistance) / blockerDistance;
+
+	// percentage-close filtering (penumbra width on the receiver, in radians seen from the light)
+	float radius = penumbraWidth * lightSize / (receiverDistance * pointLightFar);
+	return 1 - PCF_PointLight(direction, receiverDistance, shadowCubeMap, radius);
+}
+
+float PCSS_PointLight(vec3 lightPosition, sampler2D paraboloidMap, float lightSize)
+{
+	vec3 direction = vWorldPosition - lightPosition;
+	float receiverDistance = length(direction) / pointLightFar;
+	direction = normalize(direction);
+
+	// blocker search
+	float blockerDistance = FindBlockerDistance_PointLight(direction, receiverDistance, paraboloidMap, lightSize);
+	if (blockerDistance == -1)
+		return 1;
+
+	// penumbra estimation
+	float penumbraWidth = (receiverDistance - blockerDistance) / blockerDistance;
+
+	// percentage-close filtering (penumbra width on the receiver, in radians seen from the light)
+	float radius = penumbraWidth * lightSize / (receiverDistance * pointLightFar);
+	return 1 - PCF_PointLight(direction, receiverDistance, paraboloidMap, radius);
+}
+
+float PCSS_SpotLight(vec3 lightPosition, mat4 shadowMapViewProjection, sampler2D shadowMap, float lightSize, float cosOuterAngle)
+{
+	vec2 uv = ShadowCoords(shadowMapViewProjection).xy;
+	float receiverDistance = length(vWorldPosition - lightPosition) / pointLightFar;
+	float uvLightSize = UVLightSize_SpotLight(lightSize, cosOuterAngle);
+
+	// blocker search
+	float blockerDistance = FindBlockerDistance_SpotLight(uv, receiverDistance, shadowMap, uvLightSize);
+	if (blockerDistance == -1)
+		return 1;
+
+	// penumbra estimation
+	float penumbraWidth = (receiverDistance - blockerDistance) / blockerDistance;
+
+	// percentage-close filtering
+	float uvRadius = penumbraWidth * uvLightSize * (pointLightNear / pointLightFar) / receiverDistance;
+	return 1 - PCF_SpotLight(uv, receiverDistance, shadowMap, uvRadius);
 }
 
 //////////////////////////////////////////////////////////////////////////
-float HardShadow(int i)
+// Hamburger 4MSM, from: C. Peters and R. Klein, "Moment Shadow Mapping", 2015
+// returns the fraction of the filter region closer to the light than fragmentDepth
+float MSMShadowIntensity(vec4 moments, float fragmentDepth)
 {
-	if (i == 0)
-	{
-		if (IsLightEnabled(0))
-		{
-			switch (lightSources[0].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection0), shadowMap0, lightSources[0].size / frustumSize);
-			case POINT_LIGHT:
-				return ShadowMapping_PointLight(lightSources[0].position, shadowCubeMap0, lightSources[0].size / frustumSize);
-			}
-		}
-		return 0;
-	}
-	else if (i == 1)
-	{
-		if (IsLightEnabled(1))
-		{
-			switch (lightSources[1].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection1), shadowMap1, lightSources[1].size / frustumSize);
-			case POINT_LIGHT:
-				return ShadowMapping_PointLight(lightSources[1].position, shadowCubeMap1, lightSources[1].size / frustumSize);
-			}
-		}
-		return 0;
-	}
-	else if (i == 2)
-	{
-		if (IsLightEnabled(2))
-		{
-			switch (lightSources[2].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection2), shadowMap2, lightSources[2].size / frustumSize);
-			case POINT_LIGHT:
-				return ShadowMapping_PointLight(lightSources[2].position, shadowCubeMap2, lightSources[2].size / frustumSize);
-			}
-		}
-		return 0;
-	}
-	else if (i == 3)
-	{
-		if (IsLightEnabled(3))
-		{
-			switch (lightSources[3].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection3), shadowMap3, lightSources[3].size / frustumSize);
-			case POINT_LIGHT:
-				return ShadowMapping_PointLight(lightSources[3].position, shadowCubeMap3, lightSources[3].size / frustumSize);
-			}
-		}
-		return 0;
-	}
-	else if (i == 4)
-	{
-		if (IsLightEnabled(4))
-		{
-			switch (lightSources[4].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection4), shadowMap4, lightSources[4].size / frustumSize);
-			case POINT_LIGHT:
-				return ShadowMapping_PointLight(lightSources[4].position, shadowCubeMap4, lightSources[4].size / frustumSize);
-			}
-		}
-		return 0;
-	}
-	else if (i == 5)
-	{
-		if (IsLightEnabled(5))
-		{
-			switch (lightSources[5].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection5), shadowMap5, lightSources[5].size / frustumSize);
-			case POINT_LIGHT:
-				return ShadowMapping_PointLight(lightSources[5].position, shadowCubeMap5, lightSources[5].size / frustumSize);
-			}
-		}
-		return 0;
-	}
-	else if (i == 6)
-	{
-		if (IsLightEnabled(6))
-		{
-			switch (lightSources[6].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection6), shadowMap6, lightSources[6].size / frustumSize);
-			case POINT_LIGHT:
-				return ShadowMapping_PointLight(lightSources[6].position, shadowCubeMap6, lightSources[6].size / frustumSize);
-			}
-		}
+	vec4 b = mix(moments, vec4(0.5), MOMENT_BIAS);
+	vec3 z;
+	z[0] = fragmentDepth;
+	float L32D22 = -b[0] * b[1] + b[2];
+	float D22 = -b[0] * b[0] + b[1];
+	float squaredDepthVariance = -b[1] * b[1] + b[3];
+	float D33D22 = dot(vec2(squaredDepthVariance, -L32D22), vec2(D22, L32D22));
+	float invD22 = 1.0 / D22;
+	float L32 = L32D22 * invD22;
+	vec3 c = vec3(1.0, z[0], z[0] * z[0]);
+	c[1] -= b.x;
+	c[2] -= b.y + L32 * c[1];
+	c[1] *= invD22;
+	c[2] *= D22 / D33D22;
+	c[1] -= L32 * c[2];
+	c[0] -= dot(c.yz, b.xy);
+	float p = c[1] / c[2];
+	float q = c[0] / c[2];
+	float r = sqrt((p * p * 0.25) - q);
+	z[1] = -p * 0.5 - r;
+	z[2] = -p * 0.5 + r;
+	vec4 switchValues = (z[2] < z[0]) ? vec4(z[1], z[0], 1.0, 1.0) :
+		((z[1] < z[0]) ? vec4(z[0], z[1], 0.0, 1.0) : vec4(0.0));
+	float quotient = (switchValues[0] * z[2] - b[0] * (switchValues[0] + z[2]) + b[1]) / ((z[2] - switchValues[1]) * (z[0] - z[1]));
+	return clamp(switchValues[2] + switchValues[3] * quotient, 0, 1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: table(uv) sums the region [0, uv]^2, the table texel k holding the sum up to the end of texel k
+// (bilinear reads interpolate between texel ends, reads before the first texel return the border, 0)
+vec4 SummedArea(int layer, vec2 uv)
+{
+	return texture(summedAreaTables, vec3(uv - 0.5 / momentMapSize, layer));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: exact box filter over a rectangular region, from 4 reads regardless of its size
+vec4 SummedAreaTableMoments(int layer, vec2 uvMin, vec2 uvMax)
+{
+	uvMin = clamp(uvMin, 0, 1);
+	uvMax = clamp(uvMax, 0, 1);
+	float area = max((uvMax.x - uvMin.x) * (uvMax.y - uvMin.y), 1e-8);
+	vec4 sum = SummedArea(layer, uvMax) - SummedArea(layer, vec2(uvMin.x, uvMax.y)) - SummedArea(layer, vec2(uvMax.x, uvMin.y)) + SummedArea(layer, uvMin);
+	// NOTE: the average is the same for every fragment (i.e., a 1x1 mip level)
+	vec4 average = texelFetch(momentMaps, ivec3(0, 0, layer), int(log2(momentMapSize)));
+	return sum / (area * momentMapSize * momentMapSize) + average;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: box filter over a square region of width uvWidth, approximated by trilinear filtering of the moment map mips
+// or computed exactly from the summed-area tables
+vec4 FilteredMoments(int layer, vec2 uv, float uvWidth)
+{
+	if (useSummedAreaTables && uvWidth * momentMapSize >= MIN_SUMMED_AREA_TABLE_WIDTH)
+		return SummedAreaTableMoments(layer, uv - 0.5 * uvWidth, uv + 0.5 * uvWidth);
+	return textureLod(momentMaps, vec3(uv, layer), max(0, log2(uvWidth * momentMapSize)));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: the filtered first moment mixes blockers and receivers, assuming receivers lie at the receiver depth:
+// z1 = s * avgBlockerDistance + (1 - s) * receiverDistance, where s is the shadow intensity over the search region
+float FindBlockerDistance_MSM(vec3 shadowCoords, int layer, float uvLightSize)
+{
+	float searchWidth = SearchWidth(uvLightSize, shadowCoords.z);
+	float receiverDistance = shadowCoords.z - directionalLightShadowMapBias;
+	vec4 moments = FilteredMoments(layer, shadowCoords.xy, 2 * searchWidth);
+	float s = MSMShadowIntensity(moments, receiverDistance);
+	if (s < 0.01)
+		return -1;
+	return clamp((moments.x - (1 - s) * receiverDistance) / s, 0, receiverDistance);
+}
+
+//////////////////////////////////////////////////////////////////////////
+float MSM_DirectionalLight(vec3 shadowCoords, int layer, float uvLightSize)
+{
+	// blocker search
+	float blockerDistance = FindBlockerDistance_MSM(shadowCoords, layer, uvLightSize);
+	if (blockerDistance <= 0)
+		return 1;
+
+	// penumbra estimation
+	float penumbraWidth = (shadowCoords.z - blockerDistance) / blockerDistance;
+
+	// moment filtering
+	float uvRadius = penumbraWidth * uvLightSize * NEAR / shadowCoords.z;
+	vec4 moments = FilteredMoments(layer, shadowCoords.xy, 2 * uvRadius);
+	return 1 - MSMShadowIntensity(moments, shadowCoords.z - directionalLightShadowMapBias);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: point lights have no comparison sampler, they take a hard tap when filtered (and moment soft shadows fall back to PCSS for point and spot lights)
+float LightTypeShadow(int shadowFilter, int i, mat4 shadowMapViewProjection, sampler2D shadowMap, sampler2DShadow shadowMapComparison, samplerCube shadowCubeMap)
+{
+	if (!IsLightEnabled(i))
 		return 0;
-	}
-	else if (i == 7)
+	switch (lightSources[i].type)
 	{
-		if (IsLightEnabled(7))
-		{
-			switch (lightSources[7].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection7), shadowMap7, lightSources[7].size / frustumSize);
-			case POINT_LIGHT:
-				return ShadowMapping_PointLight(lightSources[7].position, shadowCubeMap7, lightSources[7].size / frustumSize);
-			}
-		}
-		return 0;
+	case DIRECTIONAL_LIGHT:
+		if (shadowFilter == HARD_FILTER)
+			return ShadowMapping_DirectionalLight(ShadowCoords(shadowMapViewProjection), shadowMap, lightSources[i].size / frustumSize);
+		else if (shadowFilter == COMPARISON_FILTER)
+			return FilteredShadow_DirectionalLight(ShadowCoords(shadowMapViewProjection), shadowMapComparison);
+		else if (shadowFilter == MSM_FILTER)
+			return MSM_DirectionalLight(ShadowCoords(shadowMapViewProjection), i, lightSources[i].size / frustumSize);
+		else
+			return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection), shadowMap, shadowMapComparison, lightSources[i].size / frustumSize);
+	case POINT_LIGHT:
+		if (shadowFilter == HARD_FILTER || shadowFilter == COMPARISON_FILTER)
+			return (useDualParaboloids) ? ShadowMapping_PointLight(shadowMapLightPositions[i], shadowMap, lightSources[i].size) : ShadowMapping_PointLight(shadowMapLightPositions[i], shadowCubeMap, lightSources[i].size);
+		else
+			return (useDualParaboloids) ? PCSS_PointLight(shadowMapLightPositions[i], shadowMap, lightSources[i].size) : PCSS_PointLight(shadowMapLightPositions[i], shadowCubeMap, lightSources[i].size);
+	case SPOT_LIGHT:
+		if (shadowFilter == HARD_FILTER)
+			return ShadowMapping_SpotLight(shadowMapLightPositions[i], shadowMapViewProjection, shadowMap);
+		else if (shadowFilter == COMPARISON_FILTER)
+			return FilteredShadow_SpotLight(shadowMapLightPositions[i], shadowMapViewProjection, shadowMapComparison);
+		else
+			return PCSS_SpotLight(shadowMapLightPositions[i], shadowMapViewProjection, shadowMap, lightSources[i].size, lightSources[i].cosOuterAngle);
 	}
-	else
-		return 0;
+	return 0;
 }
 
 //////////////////////////////////////////////////////////////////////////
-float SoftShadow(int i)
+// NOTE: samplers can only be indexed with constants, so this is where each light's shadow maps are selected
+// (shadowFilter is a constant at every call site, the branches of the other filters are compiled out)
+float Shadow(int shadowFilter, int i)
 {
+	SetupShadowMapRect(i);
 	if (i == 0)
-	{
-		if (IsLightEnabled(0))
-		{
-			switch (lightSources[0].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection0), shadowMap0, lightSources[0].size / frustumSize);
-			case POINT_LIGHT:
-				return PCSS_PointLight(lightSources[0].position, shadowCubeMap0, lightSources[0].size / frustumSize);
-			}
-		}
-		return 0;
-	}
+		return LightTypeShadow(shadowFilter, 0, shadowMapViewProjection0, shadowMap0, shadowMapComparison0, shadowCubeMap0);
 	else if (i == 1)
-	{
-		if (IsLightEnabled(1))
-		{
-			switch (lightSources[1].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection1), shadowMap1, lightSources[1].size / frustumSize);
-			case POINT_LIGHT:
-				return PCSS_PointLight(lightSources[1].position, shadowCubeMap1, lightSources[1].size / frustumSize);
-			}
-		}
-		return 0;
-	}
+		return LightTypeShadow(shadowFilter, 1, shadowMapViewProjection1, shadowMap1, shadowMapComparison1, shadowCubeMap1);
 	else if (i == 2)
-	{
-		if (IsLightEnabled(2))
-		{
-			switch (lightSources[2].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection2), shadowMap2, lightSources[2].size / frustumSize);
-			case POINT_LIGHT:
-				return PCSS_PointLight(lightSources[2].position, shadowCubeMap2, lightSources[2].size / frustumSize);
-			}
-		}
-		return 0;
-	}
+		return LightTypeShadow(shadowFilter, 2, shadowMapViewProjection2, shadowMap2, shadowMapComparison2, shadowCubeMap2);
 	else if (i == 3)
-	{
-		if (IsLightEnabled(3))
-		{
-			switch (lightSources[3].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection3), shadowMap3, lightSources[3].size / frustumSize);
-			case POINT_LIGHT:
-				return PCSS_PointLight(lightSources[3].position, shadowCubeMap3, lightSources[3].size / frustumSize);
-			}
-		}
-		return 0;
-	}
+		return LightTypeShadow(shadowFilter, 3, shadowMapViewProjection3, shadowMap3, shadowMapComparison3, shadowCubeMap3);
 	else if (i == 4)
-	{
-		if (IsLightEnabled(4))
-		{
-			switch (lightSources[4].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection4), shadowMap4, lightSources[4].size / frustumSize);
-			case POINT_LIGHT:
-				return PCSS_PointLight(lightSources[4].position, shadowCubeMap4, lightSources[4].size / frustumSize);
-			}
-		}
-		return 0;
-	}
+		return LightTypeShadow(shadowFilter, 4, shadowMapViewProjection4, shadowMap4, shadowMapComparison4, shadowCubeMap4);
 	else if (i == 5)
-	{
-		if (IsLightEnabled(5))
-		{
-			switch (lightSources[5].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection5), shadowMap5, lightSources[5].size / frustumSize);
-			case POINT_LIGHT:
-				return PCSS_PointLight(lightSources[5].position, shadowCubeMap5, lightSources[5].size / frustumSize);
-			}
-		}
-		return 0;
-	}
+		return LightTypeShadow(shadowFilter, 5, shadowMapViewProjection5, shadowMap5, shadowMapComparison5, shadowCubeMap5);
 	else if (i == 6)
-	{
-		if (IsLightEnabled(6))
-		{
-			switch (lightSources[6].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection6), shadowMap6, lightSources[6].size / frustumSize);
-			case POINT_LIGHT:
-				return PCSS_PointLight(lightSources[6].position, shadowCubeMap6, lightSources[6].size / frustumSize);
-			}
-		}
-		return 0;
-	}
+		return LightTypeShadow(shadowFilter, 6, shadowMapViewProjection6, shadowMap6, shadowMapComparison6, shadowCubeMap6);
 	else if (i == 7)
-	{
-		if (IsLightEnabled(7))
-		{
-			switch (lightSources[7].type)
-			{
-			case DIRECTIONAL_LIGHT:
-				return PCSS_DirectionalLight(ShadowCoords(shadowMapViewProjection7), shadowMap7, lightSources[7].size / frustumSize);
-			case POINT_LIGHT:
-				return PCSS_PointLight(lightSources[7].position, shadowCubeMap7, lightSources[7].size / frustumSize);
-			}
-		}
-		return 0;
-	}
+		return LightTypeShadow(shadowFilter, 7, shadowMapViewProjection7, shadowMap7, shadowMapComparison7, shadowCubeMap7);
 	else
 		return 0;
 }
 
+//////////////////////////////////////////////////////////////////////////
+float HardShadow(int i)
+{
+	return Shadow(HARD_FILTER, i);
+}
+
+//////////////////////////////////////////////////////////////////////////
+float FilteredShadow(int i)
+{
+	return Shadow(COMPARISON_FILTER, i);
+}
+
+//////////////////////////////////////////////////////////////////////////
+float SoftShadow(int i)
+{
+	return Shadow(PCSS_FILTER, i);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: PCSS with the receiver's sample counts, blended into a single tap across the far transition (only the tiers with weight are evaluated)
+float LODSoftShadow(int i)
+{
+	float shadow = (farShadowWeight < 1) ? SoftShadow(i) : 0;
+	if (farShadowWeight > 0)
+		shadow = mix(shadow, (useShadowLODFilteredTap) ? FilteredShadow(i) : HardShadow(i), farShadowWeight);
+	return shadow;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: point and spot lights (and virtual shadow maps) fall back to PCSS
+float MomentSoftShadow(int i)
+{
+	if (useVirtualShadowMaps && i >= 0 && i < MAX_NUM_LIGHT_SOURCES && lightSources[i].type == DIRECTIONAL_LIGHT)
+		return SoftShadow(i);
+	return Shadow(MSM_FILTER, i);
+}
+
+#ifndef SHADOW_MASK_PASS
 //////////////////////////////////////////////////////////////////////////
 void DisplayHardShadows()
 {
@@ -534,9 +1042,11 @@ void DisplayHardShadows()
 	if (enabledLights > 0)
 	{
 		for (int i = 0; i < MAX_NUM_LIGHT_SOURCES; i++)
-			outColor += LightContribution(diffuseColor, i) * HardShadow(i);
+			if (!IsLightCulled(i))
+				outColor += LightContribution(diffuseColor, i) * HardShadow(i);
 		outColor /= enabledLights;
 	}
+	outColor += ClusteredLightsContribution(diffuseColor);
 	outColor += ambientColor;
 }
 
@@ -551,15 +1061,37 @@ void DisplaySoftShadows()
 	if (enabledLights > 0)
 	{
 		for (int i = 0; i < MAX_NUM_LIGHT_SOURCES; i++)
-			outColor += LightContribution(diffuseColor, i) * SoftShadow(i);
+			if (!IsLightCulled(i))
+				outColor += LightContribution(diffuseColor, i) * LODSoftShadow(i);
 		outColor /= enabledLights;
 	}
+	outColor += ClusteredLightsContribution(diffuseColor);
+	outColor += ambientColor;
+}
+
+//////////////////////////////////////////////////////////////////////////
+void DisplayMomentSoftShadows()
+{
+	vec3 diffuseColor = texture(tex0, vTexcoords).rgb;
+	int enabledLights = 0;
+	for (int i = 0; i < MAX_NUM_LIGHT_SOURCES; i++)
+		if (IsLightEnabled(i))
+			enabledLights++;
+	if (enabledLights > 0)
+	{
+		for (int i = 0; i < MAX_NUM_LIGHT_SOURCES; i++)
+			if (!IsLightCulled(i))
+				outColor += LightContribution(diffuseColor, i) * MomentSoftShadow(i);
+		outColor /= enabledLights;
+	}
+	outColor += ClusteredLightsContribution(diffuseColor);
 	outColor += ambientColor;
 }
 
 //////////////////////////////////////////////////////////////////////////
 void DisplayBlockerSearch()
 {
+	SetupShadowMapRect(selectedLightSource);
 	float blockerDistance = -1;
 	if (selectedLightSource == 0 && IsLightEnabled(0))
 		blockerDistance = FindBlockerDistance_DirectionalLight(ShadowCoords(shadowMapViewProjection0), shadowMap0, lightSources[0].size / frustumSize);
@@ -597,6 +1129,7 @@ float PenumbraWidth(vec3 shadowCoords, sampler2D shadowMap, float uvLightSize)
 //////////////////////////////////////////////////////////////////////////
 void DisplayPenumbraEstimate()
 {
+	SetupShadowMapRect(selectedLightSource);
 	float penumbraWidth = -1;
 	if (selectedLightSource == 0 && IsLightEnabled(0))
 		penumbraWidth = PenumbraWidth(ShadowCoords(shadowMapViewProjection0), shadowMap0, lightSources[0].size / frustumSize);
@@ -619,10 +1152,78 @@ void DisplayPenumbraEstimate()
 	else
 		outColor = vec3(penumbraWidth);
 }
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+float LightShadow(int i)
+{
+	if (!IsLightEnabled(i) || IsLightCulled(i))
+		return 1;
+	switch (displayMode)
+	{
+	case SOFT_SHADOWS:
+		return LODSoftShadow(i);
+	case MOMENT_SOFT_SHADOWS:
+		return MomentSoftShadow(i);
+	default:
+		return HardShadow(i);
+	}
+}
+
+#ifdef SHADOW_MASK_PASS
+//////////////////////////////////////////////////////////////////////////
+void WriteShadowMasks()
+{
+	outShadowMask0 = vec4(LightShadow(0), LightShadow(1), LightShadow(2), LightShadow(3));
+	outShadowMask1 = vec4(LightShadow(4), LightShadow(5), LightShadow(6), LightShadow(7));
+}
+#endif
+
+#ifdef SHADOW_MASKS
+//////////////////////////////////////////////////////////////////////////
+float MaskedShadow(int i)
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	if (i < 4)
+		return texelFetch(shadowMasks0, pixel, 0)[i];
+	else
+		return texelFetch(shadowMasks1, pixel, 0)[i - 4];
+}
+
+//////////////////////////////////////////////////////////////////////////
+void DisplayMaskedShadows()
+{
+	vec3 diffuseColor = texture(tex0, vTexcoords).rgb;
+	int enabledLights = 0;
+	for (int i = 0; i < MAX_NUM_LIGHT_SOURCES; i++)
+		if (IsLightEnabled(i))
+			enabledLights++;
+	if (enabledLights > 0)
+	{
+		for (int i = 0; i < MAX_NUM_LIGHT_SOURCES; i++)
+			if (!IsLightCulled(i))
+				outColor += LightContribution(diffuseColor, i) * MaskedShadow(i);
+		outColor /= enabledLights;
+	}
+	outColor += ClusteredLightsContribution(diffuseColor);
+	outColor += ambientColor;
+}
+#endif
 
 //////////////////////////////////////////////////////////////////////////
 void main()
 {
+#if defined(SHADOW_MASKS)
+	// NOTE: light pass variant, none of the shadow map code is referenced (i.e., it's left out of this program)
+	DisplayMaskedShadows();
+#elif defined(SHADOW_MASK_PASS)
+	// NOTE: shadow mask pass variant, none of the lighting code is referenced
+	SetupSampleRotation();
+	SetupShadowLOD();
+	WriteShadowMasks();
+#else
+	SetupSampleRotation();
+	SetupShadowLOD();
 	switch (displayMode)
 	{
 	case HARD_SHADOWS:
@@ -637,8 +1238,12 @@ void main()
 	case PENUMBRA_ESTIMATE:
 		DisplayPenumbraEstimate();
 		break;
+	case MOMENT_SOFT_SHADOWS:
+		DisplayMomentSoftShadows();
+		break;
 	default:
 		// FIXME: checking invariant
 		outColor = vec3(1,0,0);
 	}
+#endif
 }
@@ -15,6 +15,9 @@ uniform mat4 view;
 uniform mat4 projection; 
 uniform vec3 eyePosition;
 
+// NOTE: the same depth in every program using this shader (depth pre-pass followed by depth equal tests)
+invariant gl_Position;
+
 void main()
 {
     vTexcoords = texcoords;
@@ -3,10 +3,12 @@
 in vec2 vTexcoord;
 
 uniform sampler2D shadowMap;
+// NOTE: tile of the shadow atlas, offset in xy and scale in zw
+uniform vec4 rect = vec4(0, 0, 1, 1);
 
 out vec3 outColor;
 
 void main()
 {
-	outColor = vec3(texture(shadowMap, vTexcoord).r);
+	outColor = vec3(texture(shadowMap, rect.xy + vTexcoord * rect.zw).r);
 }
\ No newline at end of file
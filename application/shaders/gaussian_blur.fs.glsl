@@ -0,0 +1,22 @@
+#version 330 core
+
+in vec2 vTexcoord;
+
+uniform sampler2DArray source;
+uniform int layer = 0;
+// NOTE: (1 / width, 0) for the horizontal pass, (0, 1 / height) for the vertical pass
+uniform vec2 direction;
+
+out vec4 outColor;
+
+const float weights[4] = float[4](0.3990, 0.2420, 0.0540, 0.0044);
+
+void main()
+{
+	outColor = texture(source, vec3(vTexcoord, layer)) * weights[0];
+	for (int i = 1; i < 4; i++)
+	{
+		outColor += texture(source, vec3(vTexcoord + direction * i, layer)) * weights[i];
+		outColor += texture(source, vec3(vTexcoord - direction * i, layer)) * weights[i];
+	}
+}
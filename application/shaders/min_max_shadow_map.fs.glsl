@@ -0,0 +1,48 @@
+#version 330 core
+
+in vec2 vTexcoord;
+
+uniform sampler2D shadowMap;
+uniform sampler2DArray source;
+// NOTE: level 0 reduces the light's atlas tile, the others reduce the previous level of the same layer (bound as its only level)
+uniform int level = 0;
+uniform int layer = 0;
+// NOTE: first texel of the light's tile in the shadow atlas
+uniform ivec2 origin = ivec2(0);
+// NOTE: shadow map texels per min/max map texel (in each dimension)
+uniform int downsampling = 1;
+// NOTE: min/max map texels per shadow map texel (in each dimension), for tiles smaller than the min/max map
+uniform int upsampling = 1;
+
+out vec2 outMinMax;
+
+// NOTE: nearest and farthest depths of the shadow map texels covered by this texel
+void main()
+{
+	vec2 minMax = vec2(1, 0);
+	if (level == 0)
+	{
+		ivec2 base = origin + (ivec2(gl_FragCoord.xy) * downsampling) / upsampling;
+		for (int y = 0; y < downsampling; y++)
+		{
+			for (int x = 0; x < downsampling; x++)
+			{
+				float z = texelFetch(shadowMap, base + ivec2(x, y), 0).r;
+				minMax = vec2(min(minMax.x, z), max(minMax.y, z));
+			}
+		}
+	}
+	else
+	{
+		ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+		for (int y = 0; y < 2; y++)
+		{
+			for (int x = 0; x < 2; x++)
+			{
+				vec2 z = texelFetch(source, ivec3(base + ivec2(x, y), layer), 0).rg;
+				minMax = vec2(min(minMax.x, z.x), max(minMax.y, z.y));
+			}
+		}
+	}
+	outMinMax = minMax;
+}
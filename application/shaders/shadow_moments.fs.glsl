@@ -0,0 +1,30 @@
+#version 330 core
+
+in vec2 vTexcoord;
+
+uniform sampler2D shadowMap;
+// NOTE: first texel of the light's tile in the shadow atlas
+uniform ivec2 origin = ivec2(0);
+// NOTE: shadow map texels per moment map texel (in each dimension)
+uniform int downsampling = 1;
+// NOTE: moment map texels per shadow map texel (in each dimension), for tiles smaller than the moment map
+uniform int upsampling = 1;
+
+out vec4 outMoments;
+
+// NOTE: 4 moments (z, z^2, z^3, z^4), averaged over the shadow map texels covered by this moment map texel
+void main()
+{
+	ivec2 base = origin + (ivec2(gl_FragCoord.xy) * downsampling) / upsampling;
+	vec4 moments = vec4(0);
+	for (int y = 0; y < downsampling; y++)
+	{
+		for (int x = 0; x < downsampling; x++)
+		{
+			float z = texelFetch(shadowMap, base + ivec2(x, y), 0).r;
+			float z2 = z * z;
+			moments += vec4(z, z2, z2 * z, z2 * z2);
+		}
+	}
+	outMoments = moments / float(downsampling * downsampling);
+}
@@ -1,8 +1,16 @@
 #version 330 core
 
+#ifdef WARPED
+in float vDepth;
+#endif
+
 out float outDepth;
 
 void main()
 {
+#ifdef WARPED
+	// NOTE: warped shadow maps store the same depths as unwarped ones (the warp only moves texels), at the cost of early depth tests
+	gl_FragDepth = vDepth;
+#endif
     outDepth = gl_FragCoord.z;
-}
\ No newline at end of file
+}
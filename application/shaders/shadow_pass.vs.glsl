@@ -3,8 +3,21 @@
 in vec3 position;
 
 uniform mat4 modelViewProjection;
+#ifdef WARPED
+// NOTE: perspective warp of the shadow map plane (see ShadowWarp::Trapezoid()), its z row is zero so that only x and y are clipped
+uniform mat4 warp;
+
+// NOTE: depth of the unwarped (orthographic) projection, linear along and across light rays
+out float vDepth;
+#endif
 
 void main()
 {
+#ifdef WARPED
+	vec4 unwarpedPosition = modelViewProjection * vec4(position, 1);
+	vDepth = unwarpedPosition.z * 0.5 + 0.5;
+	gl_Position = warp * unwarpedPosition;
+#else
 	gl_Position = modelViewProjection * vec4(position, 1);
-}
\ No newline at end of file
+#endif
+}
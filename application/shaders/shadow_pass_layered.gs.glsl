@@ -0,0 +1,40 @@
+#version 330 core
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 gWorldPosition[];
+flat in int gFace[];
+
+// NOTE: in cube map face order (+x, -x, +y, -y, +z, -z)
+uniform mat4 faceViewProjections[6];
+
+out vec3 vWorldPosition;
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: true if all 3 vertices lie outside of the same side plane of the face frustum
+bool IsOutsideFace(vec4 clip0, vec4 clip1, vec4 clip2)
+{
+	vec3 x = vec3(clip0.x, clip1.x, clip2.x);
+	vec3 y = vec3(clip0.y, clip1.y, clip2.y);
+	vec3 w = vec3(clip0.w, clip1.w, clip2.w);
+	return all(lessThan(x, -w)) || all(greaterThan(x, w)) || all(lessThan(y, -w)) || all(greaterThan(y, w));
+}
+
+void main()
+{
+	int face = gFace[0];
+	vec4 clip[3];
+	for (int i = 0; i < 3; i++)
+		clip[i] = faceViewProjections[face] * vec4(gWorldPosition[i], 1);
+	if (IsOutsideFace(clip[0], clip[1], clip[2]))
+		return;
+	for (int i = 0; i < 3; i++)
+	{
+		gl_Layer = face;
+		vWorldPosition = gWorldPosition[i];
+		gl_Position = clip[i];
+		EmitVertex();
+	}
+	EndPrimitive();
+}
\ No newline at end of file
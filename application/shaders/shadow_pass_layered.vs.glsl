@@ -0,0 +1,17 @@
+#version 330 core
+
+in vec3 position;
+
+uniform mat4 model = mat4(1);
+// NOTE: faces to render (the first gl_InstanceID ones are used)
+uniform int faces[6] = int[6](0, 1, 2, 3, 4, 5);
+
+out vec3 gWorldPosition;
+flat out int gFace;
+
+// NOTE: one instance per cube map face being rendered
+void main()
+{
+	gWorldPosition = (model * vec4(position, 1)).xyz;
+	gFace = faces[gl_InstanceID];
+}
\ No newline at end of file
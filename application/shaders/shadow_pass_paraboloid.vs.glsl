@@ -0,0 +1,24 @@
+#version 330 core
+
+in vec3 position;
+
+uniform mat4 model = mat4(1);
+uniform vec3 lightPosition;
+uniform float farPlane;
+// NOTE: 1 for the front (+z) hemisphere, -1 for the back (-z) hemisphere
+uniform float hemisphere = 1;
+
+out vec3 vWorldPosition;
+
+// Dual-paraboloid mapping, from: S. Brabec et al., "Shadow Mapping for Hemispherical and Omnidirectional Light Sources", 2002
+void main()
+{
+	vWorldPosition = (model * vec4(position, 1)).xyz;
+	vec3 direction = vWorldPosition - lightPosition;
+	direction.z *= hemisphere;
+	float distance = length(direction);
+	direction /= distance;
+	// NOTE: clipping what belongs to the other hemisphere
+	gl_ClipDistance[0] = direction.z;
+	gl_Position = vec4(direction.xy / (1 + direction.z), (distance / farPlane) * 2 - 1, 1);
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#version 330 core
+
+in vec3 vWorldPosition;
+
+uniform vec3 lightPosition;
+uniform float farPlane;
+
+out float outDepth;
+
+// NOTE: linear distance to the light (normalized by the far plane) instead of the perspective depth,
+// so that receivers can compare their own distance to the light without reconstructing the cube face depth
+void main()
+{
+	gl_FragDepth = length(vWorldPosition - lightPosition) / farPlane;
+	outDepth = gl_FragDepth;
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#version 330 core
+
+in vec3 position;
+
+uniform mat4 model = mat4(1);
+uniform mat4 viewProjection;
+
+out vec3 vWorldPosition;
+
+// NOTE: regular perspective projection, the fragment shader writes linear distance to the light
+void main()
+{
+	vWorldPosition = (model * vec4(position, 1)).xyz;
+	gl_Position = viewProjection * vec4(vWorldPosition, 1);
+}
\ No newline at end of file
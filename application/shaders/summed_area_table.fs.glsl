@@ -0,0 +1,23 @@
+#version 330 core
+
+uniform sampler2DArray source;
+uniform int layer = 0;
+// NOTE: (1, 0) for the horizontal passes, (0, 1) for the vertical passes
+uniform ivec2 direction;
+// NOTE: 2^pass
+uniform int stride;
+// NOTE: mip level holding the average of the source (1x1), only set in the first pass so that the table is centered
+uniform int averageLevel = -1;
+
+out vec4 outSum;
+
+// Recursive doubling, from: J. Hensley et al., "Fast Summed-Area Table Generation and its Applications", 2005
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	vec4 average = (averageLevel >= 0) ? texelFetch(source, ivec3(0, 0, layer), averageLevel) : vec4(0);
+	outSum = texelFetch(source, ivec3(texel, layer), 0) - average;
+	ivec2 previous = texel - direction * stride;
+	if (previous.x >= 0 && previous.y >= 0)
+		outSum += texelFetch(source, ivec3(previous, layer), 0) - average;
+}
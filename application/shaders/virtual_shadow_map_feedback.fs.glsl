@@ -0,0 +1,11 @@
+#version 330 core
+
+in vec3 vWorldPosition;
+
+out vec4 outColor;
+
+// NOTE: world positions of the visible receivers (w = 0 where nothing is drawn), read back to request virtual shadow map pages
+void main()
+{
+	outColor = vec4(vWorldPosition, 1);
+}
\ No newline at end of file
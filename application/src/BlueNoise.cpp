@@ -0,0 +1,238 @@
+/*
+	Offline blue-noise rotation texture generator and sampling pattern report
+
+	To compile:
+		g++ BlueNoise.cpp -std=c++11 -O2 -o BlueNoise
+
+	Usage:
+		BlueNoise [<output bmp>] [<texture size>] [<seed>]
+
+	Writes a tileable void-and-cluster blue-noise texture (media/blue_noise.bmp by default)
+	and reports noise and banding of a PCF estimate of a straight shadow edge, both with the
+	same Poisson-disc distribution for every pixel and with the distribution rotated per pixel
+	by the blue-noise texture.
+	The same seed always generates the same texture (media/blue_noise.bmp was generated with the default one).
+*/
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <stdint.h>
+
+#include "PoissonGenerator.h"
+#include "BlueNoiseGenerator.h"
+
+#define DEFAULT_OUTPUT_FILENAME "media/blue_noise.bmp"
+#define DEFAULT_TEXTURE_SIZE 64
+#define DEFAULT_SEED 1
+#define REPORT_IMAGE_SIZE 256
+#define REPORT_KERNEL_RADIUS 8.0f
+#define REPORT_LOWPASS_RADIUS 4
+#define PI 3.14159265358979f
+
+// NOTE: same interface as PoissonGenerator::DefaultPRNG, which is seeded from the clock
+class SeededPRNG
+{
+public:
+	explicit SeededPRNG(uint32_t seed) : generator(seed), distribution(0.0f, 1.0f)
+	{
+	}
+
+	float RandomFloat()
+	{
+		return distribution(generator);
+	}
+
+	int RandomInt(int max)
+	{
+		std::uniform_int_distribution<> distributionInt(0, max);
+		return distributionInt(generator);
+	}
+
+private:
+	std::mt19937 generator;
+	std::uniform_real_distribution<float> distribution;
+
+};
+
+#pragma pack(push, 1)
+struct BMPHeader
+{
+	uint16_t type;
+	uint32_t fileSize;
+	uint16_t reserved1;
+	uint16_t reserved2;
+	uint32_t dataOffset;
+	uint32_t headerSize;
+	int32_t width;
+	int32_t height;
+	uint16_t planes;
+	uint16_t bitCount;
+	uint32_t compression;
+	uint32_t imageSize;
+	int32_t xPixelsPerMeter;
+	int32_t yPixelsPerMeter;
+	uint32_t colorsUsed;
+	uint32_t colorsImportant;
+
+};
+#pragma pack(pop)
+
+//////////////////////////////////////////////////////////////////////////
+bool saveGrayscaleBMP(const std::string& filename, const std::vector<float>& values, int size)
+{
+	// rows are padded to 4 bytes
+	int rowSize = (size * 3 + 3) & ~3;
+	BMPHeader header = { 0x4D42, (uint32_t)(sizeof(BMPHeader) + rowSize * size), 0, 0, sizeof(BMPHeader), 40, size, size, 1, 24, 0, (uint32_t)(rowSize * size), 2835, 2835, 0, 0 };
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (!file.is_open())
+		return false;
+	file.write((const char*)&header, sizeof(header));
+	std::vector<unsigned char> row(rowSize, 0);
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			auto value = (unsigned char)std::min(255.0f, values[y * size + x] * 256.0f);
+			row[x * 3] = row[x * 3 + 1] = row[x * 3 + 2] = value;
+		}
+		file.write((const char*)&row[0], rowSize);
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<PoissonGenerator::sPoint> createPoissonDiscDistribution(size_t numSamples, SeededPRNG& generator)
+{
+	auto points = PoissonGenerator::GeneratePoissonPoints(numSamples * 2, generator);
+	size_t attempts = 0;
+	while (points.size() < numSamples && ++attempts < 100)
+		points = PoissonGenerator::GeneratePoissonPoints(numSamples * 2, generator);
+	points.resize(std::min(numSamples, points.size()));
+	// NOTE: same [0, 1] -> [-1, 1] mapping as RandomDirection()
+	for (auto& point : points)
+	{
+		point.x = point.x * 2 - 1;
+		point.y = point.y * 2 - 1;
+	}
+	return points;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// fraction of a disc of radius 1 on the far side of a line at signed distance t from its center
+float discCoverage(float t)
+{
+	if (t <= -1)
+		return 1;
+	if (t >= 1)
+		return 0;
+	return (std::acos(t) - t * std::sqrt(1 - t * t)) / PI;
+}
+
+struct ErrorReport
+{
+	float rmse;
+	float banding;
+	float noise;
+
+};
+
+//////////////////////////////////////////////////////////////////////////
+ErrorReport measurePCFError(const std::vector<PoissonGenerator::sPoint>& samples, const std::vector<float>& blueNoise, int noiseSize, bool rotate)
+{
+	const int size = REPORT_IMAGE_SIZE;
+	const float radius = REPORT_KERNEL_RADIUS;
+	// straight occluder edge through the center of the image
+	const float edgeAngle = 0.35f;
+	const float nx = std::cos(edgeAngle), ny = std::sin(edgeAngle);
+	const float c = (nx + ny) * size * 0.5f;
+
+	std::vector<float> error(size * size, 0);
+	std::vector<bool> penumbra(size * size, false);
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			float px = x + 0.5f, py = y + 0.5f;
+			float distance = nx * px + ny * py - c;
+			float angle = (rotate) ? blueNoise[(y % noiseSize) * noiseSize + (x % noiseSize)] * 2 * PI : 0;
+			float ca = std::cos(angle), sa = std::sin(angle);
+			float occluded = 0;
+			for (auto& sample : samples)
+			{
+				float sx = ca * sample.x - sa * sample.y,
+					sy = sa * sample.x + ca * sample.y;
+				occluded += (nx * (px + sx * radius) + ny * (py + sy * radius) > c) ? 1.0f : 0.0f;
+			}
+			occluded /= samples.size();
+			error[y * size + x] = occluded - discCoverage(-distance / radius);
+			penumbra[y * size + x] = std::abs(distance) < radius + 1;
+		}
+	}
+
+	// banding is the structured (low-frequency) part of the error, noise is what is left
+	double sumSqr = 0, lowSumSqr = 0, highSumSqr = 0;
+	size_t count = 0;
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			if (!penumbra[y * size + x])
+				continue;
+			float lowPass = 0;
+			int taps = 0;
+			for (int j = std::max(0, y - REPORT_LOWPASS_RADIUS); j <= std::min(size - 1, y + REPORT_LOWPASS_RADIUS); j++)
+				for (int i = std::max(0, x - REPORT_LOWPASS_RADIUS); i <= std::min(size - 1, x + REPORT_LOWPASS_RADIUS); i++, taps++)
+					lowPass += error[j * size + i];
+			lowPass /= taps;
+			float e = error[y * size + x];
+			sumSqr += e * e;
+			lowSumSqr += lowPass * lowPass;
+			highSumSqr += (e - lowPass) * (e - lowPass);
+			count++;
+		}
+	}
+	return ErrorReport{ (float)std::sqrt(sumSqr / count), (float)std::sqrt(lowSumSqr / count), (float)std::sqrt(highSumSqr / count) };
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	std::string outputFilename = (argc >= 2) ? argv[1] : DEFAULT_OUTPUT_FILENAME;
+	int textureSize = (argc >= 3) ? std::atoi(argv[2]) : DEFAULT_TEXTURE_SIZE;
+	uint32_t seed = (argc >= 4) ? (uint32_t)std::strtoul(argv[3], nullptr, 10) : DEFAULT_SEED;
+	if (textureSize <= 0)
+	{
+		std::cout << "invalid texture size (" << textureSize << ")" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "generating " << textureSize << "x" << textureSize << " blue-noise texture (seed: " << seed << ")" << std::endl;
+	SeededPRNG generator(seed);
+	auto blueNoise = BlueNoiseGenerator::GenerateBlueNoise(textureSize, generator);
+	if (!saveGrayscaleBMP(outputFilename, blueNoise, textureSize))
+	{
+		std::cout << "cannot write " << outputFilename << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "saved " << outputFilename << std::endl << std::endl;
+
+	std::cout << "PCF error over the penumbra of a straight edge (kernel radius: " << REPORT_KERNEL_RADIUS << " texels)" << std::endl;
+	std::cout << std::setw(8) << "samples" << std::setw(12) << "pattern" << std::setw(10) << "rmse" << std::setw(10) << "banding" << std::setw(10) << "noise" << std::endl;
+	std::cout << std::fixed << std::setprecision(4);
+	for (size_t numSamples = 4; numSamples <= 64; numSamples *= 2)
+	{
+		auto samples = createPoissonDiscDistribution(numSamples, generator);
+		auto fixed = measurePCFError(samples, blueNoise, textureSize, false);
+		auto rotated = measurePCFError(samples, blueNoise, textureSize, true);
+		std::cout << std::setw(8) << samples.size() << std::setw(12) << "fixed" << std::setw(10) << fixed.rmse << std::setw(10) << fixed.banding << std::setw(10) << fixed.noise << std::endl;
+		std::cout << std::setw(8) << samples.size() << std::setw(12) << "blue-noise" << std::setw(10) << rotated.rmse << std::setw(10) << rotated.banding << std::setw(10) << rotated.noise << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+// Void-and-cluster blue-noise generator
+// R. Ulichney, "The void-and-cluster method for dither array generation", 1993
+
+namespace BlueNoiseGenerator
+{
+
+struct EnergyField
+{
+	EnergyField(size_t size, float sigma) : size(size), kernel(size * size), energy(size * size, 0)
+	{
+		// toroidal gaussian, so that the resulting texture tiles seamlessly
+		auto halfSize = (int)size / 2;
+		auto twoSigmaSqr = 2 * sigma * sigma;
+		for (auto y = 0; y < (int)size; y++)
+		{
+			auto dy = (y > halfSize) ? y - (int)size : y;
+			for (auto x = 0; x < (int)size; x++)
+			{
+				auto dx = (x > halfSize) ? x - (int)size : x;
+				kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / twoSigmaSqr);
+			}
+		}
+	}
+
+	void splat(size_t i, float sign)
+	{
+		auto px = i % size, py = i / size;
+		for (size_t y = 0; y < size; y++)
+		{
+			auto ky = ((y + size - py) % size) * size;
+			for (size_t x = 0; x < size; x++)
+				energy[y * size + x] += sign * kernel[ky + (x + size - px) % size];
+		}
+	}
+
+	// tightest cluster: the set pixel with the highest energy
+	size_t tightestCluster(const std::vector<bool>& pattern, bool value) const
+	{
+		size_t best = 0;
+		float bestEnergy = -FLT_MAX;
+		for (size_t i = 0; i < pattern.size(); i++)
+		{
+			if (pattern[i] != value)
+				continue;
+			if (energy[i] > bestEnergy)
+			{
+				bestEnergy = energy[i];
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	// largest void: the unset pixel with the lowest energy
+	size_t largestVoid(const std::vector<bool>& pattern, bool value) const
+	{
+		size_t best = 0;
+		float bestEnergy = FLT_MAX;
+		for (size_t i = 0; i < pattern.size(); i++)
+		{
+			if (pattern[i] == value)
+				continue;
+			if (energy[i] < bestEnergy)
+			{
+				bestEnergy = energy[i];
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	void reset(const std::vector<bool>& pattern, bool value)
+	{
+		std::fill(energy.begin(), energy.end(), 0.0f);
+		for (size_t i = 0; i < pattern.size(); i++)
+			if (pattern[i] == value)
+				splat(i, 1);
+	}
+
+private:
+	size_t size;
+	std::vector<float> kernel;
+	std::vector<float> energy;
+
+};
+
+// returns size * size ranks normalized to [0, 1), laid out row by row
+template <typename PRNG>
+std::vector<float> GenerateBlueNoise(size_t size, PRNG& generator, float sigma = 1.5f, float initialDensity = 0.1f)
+{
+	auto numPixels = size * size;
+	auto numInitialPoints = std::max<size_t>(1, (size_t)(numPixels * initialDensity));
+
+	std::vector<bool> pattern(numPixels, false);
+	for (size_t n = 0; n < numInitialPoints;)
+	{
+		auto i = (size_t)generator.RandomInt((int)numPixels - 1);
+		if (pattern[i])
+			continue;
+		pattern[i] = true;
+		n++;
+	}
+
+	EnergyField field(size, sigma);
+	field.reset(pattern, true);
+
+	// move points from the tightest clusters to the largest voids until the pattern settles
+	while (true)
+	{
+		auto cluster = field.tightestCluster(pattern, true);
+		pattern[cluster] = false;
+		field.splat(cluster, -1);
+		auto emptiest = field.largestVoid(pattern, true);
+		pattern[emptiest] = true;
+		field.splat(emptiest, 1);
+		if (cluster == emptiest)
+			break;
+	}
+
+	std::vector<size_t> ranks(numPixels, 0);
+
+	// phase 1: rank the initial points by removing the tightest clusters
+	auto prototype = pattern;
+	for (auto rank = numInitialPoints; rank > 0; rank--)
+	{
+		auto cluster = field.tightestCluster(pattern, true);
+		pattern[cluster] = false;
+		field.splat(cluster, -1);
+		ranks[cluster] = rank - 1;
+	}
+
+	// phase 2: fill the largest voids up to half of the pixels
+	pattern = prototype;
+	field.reset(pattern, true);
+	auto rank = numInitialPoints;
+	for (; rank < numPixels / 2; rank++)
+	{
+		auto emptiest = field.largestVoid(pattern, true);
+		pattern[emptiest] = true;
+		field.splat(emptiest, 1);
+		ranks[emptiest] = rank;
+	}
+
+	// phase 3: with roles reversed, fill the tightest clusters of empty pixels
+	field.reset(pattern, false);
+	for (; rank < numPixels; rank++)
+	{
+		auto cluster = field.tightestCluster(pattern, false);
+		pattern[cluster] = true;
+		field.splat(cluster, -1);
+		ranks[cluster] = rank;
+	}
+
+	std::vector<float> values(numPixels);
+	for (size_t i = 0; i < numPixels; i++)
+		values[i] = ranks[i] / (float)numPixels;
+	return values;
+}
+
+} // namespace BlueNoiseGenerator
@@ -9,18 +9,26 @@ struct Camera
 	float fovY;
 	float zn;
 	float zf;
+	// NOTE: near maps to 1 and far to 0 (requires a [0, 1] clip space depth and a greater depth test)
+	bool reversedDepth;
 
 	Camera(float fovY, float zn, float zf)
 	{
 		this->fovY = fovY;
 		this->zn = zn;
 		this->zf = zf;
+		this->reversedDepth = false;
 	}
 
 	glm::mat4 getProjection(float aspectRatio)
 	{
 		float yScale = std::tan(1.0f / (glm::radians(fovY) * 0.5f));
 		float xScale = yScale / aspectRatio;
+		if (reversedDepth)
+			return glm::mat4(xScale, 0, 0, 0,
+				0, yScale, 0, 0,
+				0, 0, zn / (zf - zn), -1,
+				0, 0, zn * zf / (zf - zn), 0);
 		return glm::mat4(xScale, 0, 0, 0,
 			0, yScale, 0, 0,
 			0, 0, zf / (zn - zf), -1,
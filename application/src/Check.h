@@ -0,0 +1,29 @@
+#pragma once
+
+#include <iostream>
+#include <cstdlib>
+
+// Pass/fail reporting of the standalone tests (each one a single translation unit with its own main())
+
+int g_numFailures = 0;
+
+//////////////////////////////////////////////////////////////////////////
+void check(bool condition, const char* description)
+{
+	std::cout << ((condition) ? "passed: " : "FAILED: ") << description << std::endl;
+	if (!condition)
+		g_numFailures++;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: prints the summary, returns main()'s exit code (a failure code if any check failed)
+int checkResults()
+{
+	if (g_numFailures > 0)
+	{
+		std::cout << std::endl << "FAILED (" << g_numFailures << " checks)" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << std::endl << "PASSED" << std::endl;
+	return EXIT_SUCCESS;
+}
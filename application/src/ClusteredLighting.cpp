@@ -0,0 +1,160 @@
+/*
+	Clustered light culling test (CPU side of the clustered lighting mode)
+
+	To compile:
+		g++ ClusteredLighting.cpp -std=c++11 -O2 -o ClusteredLighting
+
+	Usage:
+		ClusteredLighting [<number of lights>]
+
+	Culls randomly placed lights with the SSE and the scalar paths and checks that both produce the same clusters,
+	that every cluster contains the lights whose sphere overlaps a point sampled inside it and that the packed buffer
+	is consistent, then reports the time spent by each path. Also culls the application's clustered lights (as many and
+	placed like createClusteredLights() does, seen from within them) and checks that crowded clusters keep every light.
+*/
+
+#include <vector>
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include "ClusteredLighting.h"
+#include "Check.h"
+
+#define GRID_WIDTH 16
+#define GRID_HEIGHT 9
+#define GRID_DEPTH 24
+#define DEFAULT_NUM_LIGHTS 1024
+// NOTE: the application's MAX_NUM_CLUSTERED_LIGHTS, CLUSTERED_LIGHT_MIN_RADIUS and CLUSTERED_LIGHT_MAX_RADIUS, lights are spread
+// over a 20 x 1 x 20 area
+#define APP_NUM_LIGHTS 1024
+#define APP_MIN_RADIUS 0.5f
+#define APP_MAX_RADIUS 2.0f
+// NOTE: clusters used to hold at most this many lights
+#define OLD_MAX_LIGHTS_PER_CLUSTER 16
+#define NUM_REPETITIONS 16
+#define FOVY 60.0f
+#define ASPECT_RATIO (16.0f / 9.0f)
+#define ZNEAR 0.1f
+#define ZFAR 100.0f
+#define PI 3.14159265358979323846f
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: a light overlapping a point of a cluster must be in that cluster (the converse doesn't hold, the test is conservative)
+bool isConservative(const ClusteredLighting::Grid& grid, const std::vector<ClusteredLighting::Sphere>& spheres, float xScale, float yScale, std::mt19937& generator)
+{
+	std::uniform_real_distribution<float> unit(0, 1);
+	bool conservative = true;
+	for (int sample = 0; sample < 4096; sample++)
+	{
+		auto x = (size_t)(unit(generator) * GRID_WIDTH) % GRID_WIDTH, y = (size_t)(unit(generator) * GRID_HEIGHT) % GRID_HEIGHT, z = (size_t)(unit(generator) * GRID_DEPTH) % GRID_DEPTH;
+		auto d = grid.getSliceDistance(z) + unit(generator) * (grid.getSliceDistance(z + 1) - grid.getSliceDistance(z));
+		auto px = (-1 + 2 * (x + unit(generator)) / GRID_WIDTH) * d / xScale, py = (-1 + 2 * (y + unit(generator)) / GRID_HEIGHT) * d / yScale, pz = -d;
+		auto& lights = grid.getClusterLights(x, y, z);
+		for (uint32_t l = 0; l < (uint32_t)spheres.size(); l++)
+		{
+			auto dx = px - spheres[l].x, dy = py - spheres[l].y, dz = pz - spheres[l].z;
+			if (dx * dx + dy * dy + dz * dz <= spheres[l].radius * spheres[l].radius * 0.999f)
+				conservative &= (std::find(lights.begin(), lights.end(), l) != lights.end());
+		}
+	}
+	return conservative;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: every cluster's indices are inside the buffer and are its first lights, numIndices is the total count
+bool isConsistent(const ClusteredLighting::Grid& grid, const std::vector<uint32_t>& data, size_t& numIndices)
+{
+	bool consistent = true;
+	numIndices = 0;
+	for (size_t z = 0; z < GRID_DEPTH; z++)
+		for (size_t y = 0; y < GRID_HEIGHT; y++)
+			for (size_t x = 0; x < GRID_WIDTH; x++)
+			{
+				auto i = (z * GRID_HEIGHT + y) * GRID_WIDTH + x;
+				auto offset = data[i * 2], count = data[i * 2 + 1];
+				auto& lights = grid.getClusterLights(x, y, z);
+				consistent &= offset + count <= data.size() && count <= lights.size() && std::equal(data.begin() + offset, data.begin() + offset + count, lights.begin());
+				numIndices += count;
+			}
+	return consistent && data.size() == grid.getNumClusters() * 2 + numIndices;
+}
+
+//////////////////////////////////////////////////////////////////////////
+template <typename Function>
+double measure(Function function)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < NUM_REPETITIONS; i++)
+		function();
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / NUM_REPETITIONS;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	size_t numLights = (argc >= 2) ? (size_t)std::atoi(argv[1]) : DEFAULT_NUM_LIGHTS;
+	if (numLights == 0)
+	{
+		std::cout << "invalid number of lights" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	auto yScale = 1.0f / std::tan(FOVY * PI / 360.0f), xScale = yScale / ASPECT_RATIO;
+	std::mt19937 generator(42);
+	std::uniform_real_distribution<float> distance(ZNEAR, ZFAR * 0.5f), ndc(-1.1f, 1.1f), radius(0.25f, 4.0f);
+	std::vector<ClusteredLighting::Sphere> spheres;
+	for (size_t i = 0; i < numLights; i++)
+	{
+		auto d = distance(generator);
+		spheres.emplace_back(ClusteredLighting::Sphere{ ndc(generator) * d / xScale, ndc(generator) * d / yScale, -d, radius(generator) });
+	}
+
+	ClusteredLighting::Grid grid(GRID_WIDTH, GRID_HEIGHT, GRID_DEPTH), scalarGrid(GRID_WIDTH, GRID_HEIGHT, GRID_DEPTH);
+	grid.setup(xScale, yScale, ZNEAR, ZFAR);
+	scalarGrid.setup(xScale, yScale, ZNEAR, ZFAR);
+	auto simdTime = measure([&]() { grid.cull(spheres, true); });
+	auto scalarTime = measure([&]() { scalarGrid.cull(spheres, false); });
+
+	bool sameClusters = true;
+	for (size_t z = 0; z < GRID_DEPTH; z++)
+		for (size_t y = 0; y < GRID_HEIGHT; y++)
+			for (size_t x = 0; x < GRID_WIDTH; x++)
+				sameClusters &= (grid.getClusterLights(x, y, z) == scalarGrid.getClusterLights(x, y, z));
+	check(sameClusters, "SSE and scalar paths produce the same clusters");
+	check(isConservative(grid, spheres, xScale, yScale, generator), "clusters contain every light overlapping them");
+
+	std::vector<uint32_t> data;
+	size_t numReferences;
+	check(grid.pack(data) == 0 && isConsistent(grid, data, numReferences), "packed buffer is consistent");
+
+	std::cout << std::endl << numLights << " lights, " << grid.getNumClusters() << " clusters: " << numReferences / (double)grid.getNumClusters()
+		<< " lights per cluster on average, " << grid.getMaxLightsPerCluster() << " at most" << std::endl;
+	std::cout << "SSE: " << simdTime << " ms, scalar: " << scalarTime << " ms" << std::endl;
+
+	// application's lights, seen from 0.5 above them at the edge of their area (view space)
+	std::uniform_real_distribution<float> horizontal(-10, 10), vertical(-0.5f, 0.5f), depth(-20.1f, -0.1f), appRadius(APP_MIN_RADIUS, APP_MAX_RADIUS);
+	std::vector<ClusteredLighting::Sphere> appSpheres;
+	for (size_t i = 0; i < APP_NUM_LIGHTS; i++)
+	{
+		auto x = horizontal(generator), y = vertical(generator), z = depth(generator);
+		appSpheres.emplace_back(ClusteredLighting::Sphere{ x, y, z, appRadius(generator) });
+	}
+	ClusteredLighting::Grid appGrid(GRID_WIDTH, GRID_HEIGHT, GRID_DEPTH);
+	appGrid.setup(xScale, yScale, ZNEAR, ZFAR);
+	appGrid.cull(appSpheres);
+	check(appGrid.getMaxLightsPerCluster() > OLD_MAX_LIGHTS_PER_CLUSTER, "the application's lights crowd some clusters beyond the old per-cluster cap");
+	check(isConservative(appGrid, appSpheres, xScale, yScale, generator), "crowded clusters contain every light overlapping them");
+	size_t numAppReferences;
+	check(appGrid.pack(data) == 0 && isConsistent(appGrid, data, numAppReferences), "crowded clusters are packed whole");
+	std::cout << std::endl << APP_NUM_LIGHTS << " application lights: " << appGrid.getMaxLightsPerCluster() << " lights in the fullest cluster, " << data.size() << " texels packed" << std::endl;
+
+	// NOTE: a buffer too small for every index (e.g., the max. texture buffer size) cuts the last clusters' lists
+	auto maxSize = appGrid.getNumClusters() * 2 + numAppReferences / 2;
+	size_t numCutReferences;
+	auto numCut = appGrid.pack(data, maxSize);
+	check(data.size() == maxSize && numCut == numAppReferences - numAppReferences / 2 && isConsistent(appGrid, data, numCutReferences), "packing into a smaller buffer cuts lists and reports the cut indices");
+
+	return checkResults();
+}
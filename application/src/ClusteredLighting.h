@@ -0,0 +1,220 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <xmmintrin.h>
+
+// Clustered light culling (no GL calls, uploads are left to the caller)
+// The view frustum is split into width x height screen tiles and depth exponential slices (froxels), the bounding sphere of each light
+// is tested against the view space bounds of the froxels in its depth range, 4 froxels at a time (SSE)
+
+namespace ClusteredLighting
+{
+
+// NOTE: view space (looking down -z)
+struct Sphere
+{
+	float x;
+	float y;
+	float z;
+	float radius;
+
+};
+
+struct Grid
+{
+	// NOTE: width * height must be a multiple of 4 (SSE lanes)
+	Grid(size_t width, size_t height, size_t depth) :
+		width(width),
+		height(height),
+		depth(depth),
+		xScale(0),
+		yScale(0),
+		zn(0),
+		zf(0),
+		tileMinX(width * height * depth),
+		tileMaxX(width * height * depth),
+		tileMinY(width * height * depth),
+		tileMaxY(width * height * depth),
+		sliceMinZ(depth),
+		sliceMaxZ(depth),
+		clusterLights(width * height * depth)
+	{
+	}
+
+	// NOTE: xScale and yScale are the projection matrix diagonal (i.e., [0][0] and [1][1]), froxel bounds are only recomputed when they change
+	void setup(float xScale, float yScale, float zn, float zf)
+	{
+		if (xScale == this->xScale && yScale == this->yScale && zn == this->zn && zf == this->zf)
+			return;
+		this->xScale = xScale;
+		this->yScale = yScale;
+		this->zn = zn;
+		this->zf = zf;
+		for (size_t z = 0; z < depth; z++)
+		{
+			auto sliceNear = getSliceDistance(z), sliceFar = getSliceDistance(z + 1);
+			sliceMinZ[z] = -sliceFar;
+			sliceMaxZ[z] = -sliceNear;
+			for (size_t y = 0; y < height; y++)
+			{
+				for (size_t x = 0; x < width; x++)
+				{
+					auto i = (z * height + y) * width + x;
+					// NOTE: NDC to view space at a distance d is ndc * d / scale
+					computeBounds(-1 + 2.0f * x / width, -1 + 2.0f * (x + 1) / width, xScale, sliceNear, sliceFar, tileMinX[i], tileMaxX[i]);
+					computeBounds(-1 + 2.0f * y / height, -1 + 2.0f * (y + 1) / height, yScale, sliceNear, sliceFar, tileMinY[i], tileMaxY[i]);
+				}
+			}
+		}
+	}
+
+	// NOTE: exponential slicing, slice z covers [zn * (zf / zn)^(z / depth), zn * (zf / zn)^((z + 1) / depth)]
+	float getSliceDistance(size_t z) const
+	{
+		return zn * std::pow(zf / zn, z / (float)depth);
+	}
+
+	// assigns the spheres to the clusters they overlap (in order, clusters hold any number of lights)
+	void cull(const std::vector<Sphere>& spheres, bool useSIMD = true)
+	{
+		for (auto& lights : clusterLights)
+			lights.clear();
+		auto tilesPerSlice = width * height;
+		for (uint32_t l = 0; l < (uint32_t)spheres.size(); l++)
+		{
+			auto& sphere = spheres[l];
+			size_t firstSlice, lastSlice;
+			if (!getSliceRange(sphere, firstSlice, lastSlice))
+				continue;
+			for (auto z = firstSlice; z <= lastSlice; z++)
+			{
+				auto first = z * tilesPerSlice;
+				if (useSIMD)
+					cullSlice_SSE(sphere, l, z, first, first + tilesPerSlice);
+				else
+					cullSlice(sphere, l, z, first, first + tilesPerSlice);
+			}
+		}
+	}
+
+	// (offset, count) per cluster into the index list that follows them (i.e., a single buffer), at most maxSize elements
+	// (e.g., the max. texture buffer size, the last clusters' counts are cut to fit), returns the number of indices cut
+	size_t pack(std::vector<uint32_t>& data, size_t maxSize = (size_t)-1) const
+	{
+		auto numClusters = clusterLights.size();
+		data.resize(numClusters * 2);
+		size_t offset = numClusters * 2, numCut = 0;
+		for (size_t i = 0; i < numClusters; i++)
+		{
+			auto count = std::min(clusterLights[i].size(), (maxSize > offset) ? maxSize - offset : 0);
+			data[i * 2] = (uint32_t)offset;
+			data[i * 2 + 1] = (uint32_t)count;
+			offset += count;
+			numCut += clusterLights[i].size() - count;
+		}
+		for (size_t i = 0; i < numClusters; i++)
+			data.insert(data.end(), clusterLights[i].begin(), clusterLights[i].begin() + data[i * 2 + 1]);
+		return numCut;
+	}
+
+	const std::vector<uint32_t>& getClusterLights(size_t x, size_t y, size_t z) const
+	{
+		return clusterLights[(z * height + y) * width + x];
+	}
+
+	size_t getMaxLightsPerCluster() const
+	{
+		size_t maxLights = 0;
+		for (auto& lights : clusterLights)
+			maxLights = std::max(maxLights, lights.size());
+		return maxLights;
+	}
+
+	size_t getNumClusters() const
+	{
+		return clusterLights.size();
+	}
+
+private:
+	size_t width;
+	size_t height;
+	size_t depth;
+	float xScale;
+	float yScale;
+	float zn;
+	float zf;
+	// NOTE: view space froxel bounds, structure of arrays for SSE
+	std::vector<float> tileMinX;
+	std::vector<float> tileMaxX;
+	std::vector<float> tileMinY;
+	std::vector<float> tileMaxY;
+	std::vector<float> sliceMinZ;
+	std::vector<float> sliceMaxZ;
+	std::vector<std::vector<uint32_t>> clusterLights;
+
+	static void computeBounds(float ndc0, float ndc1, float scale, float sliceNear, float sliceFar, float& minValue, float& maxValue)
+	{
+		float values[4] = { ndc0 * sliceNear / scale, ndc0 * sliceFar / scale, ndc1 * sliceNear / scale, ndc1 * sliceFar / scale };
+		minValue = *std::min_element(values, values + 4);
+		maxValue = *std::max_element(values, values + 4);
+	}
+
+	bool getSliceRange(const Sphere& sphere, size_t& firstSlice, size_t& lastSlice) const
+	{
+		auto nearest = -sphere.z - sphere.radius, farthest = -sphere.z + sphere.radius;
+		if (farthest < zn || nearest > zf)
+			return false;
+		auto toSlice = [this](float distance)
+		{
+			distance = std::min(std::max(distance, zn), zf);
+			return std::min(depth - 1, (size_t)(std::log(distance / zn) / std::log(zf / zn) * depth));
+		};
+		firstSlice = toSlice(nearest);
+		lastSlice = toSlice(farthest);
+		return true;
+	}
+
+	void cullSlice(const Sphere& sphere, uint32_t light, size_t z, size_t first, size_t last)
+	{
+		auto dz = std::max(0.0f, std::max(sliceMinZ[z] - sphere.z, sphere.z - sliceMaxZ[z]));
+		auto radius2 = sphere.radius * sphere.radius - dz * dz;
+		if (radius2 < 0)
+			return;
+		for (auto i = first; i < last; i++)
+		{
+			auto dx = std::max(0.0f, std::max(tileMinX[i] - sphere.x, sphere.x - tileMaxX[i]));
+			auto dy = std::max(0.0f, std::max(tileMinY[i] - sphere.y, sphere.y - tileMaxY[i]));
+			if (dx * dx + dy * dy <= radius2)
+				clusterLights[i].push_back(light);
+		}
+	}
+
+	// NOTE: same test as cullSlice(), the distance from the sphere center to each froxel box is computed for 4 froxels at once
+	void cullSlice_SSE(const Sphere& sphere, uint32_t light, size_t z, size_t first, size_t last)
+	{
+		auto dz = std::max(0.0f, std::max(sliceMinZ[z] - sphere.z, sphere.z - sliceMaxZ[z]));
+		auto radius2 = sphere.radius * sphere.radius - dz * dz;
+		if (radius2 < 0)
+			return;
+		auto zero = _mm_setzero_ps();
+		auto centerX = _mm_set1_ps(sphere.x), centerY = _mm_set1_ps(sphere.y);
+		auto radius2x4 = _mm_set1_ps(radius2);
+		for (auto i = first; i < last; i += 4)
+		{
+			auto dx = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&tileMinX[i]), centerX), _mm_sub_ps(centerX, _mm_loadu_ps(&tileMaxX[i]))));
+			auto dy = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&tileMinY[i]), centerY), _mm_sub_ps(centerY, _mm_loadu_ps(&tileMaxY[i]))));
+			auto distance2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			auto mask = _mm_movemask_ps(_mm_cmple_ps(distance2, radius2x4));
+			for (int j = 0; j < 4; j++)
+				if (mask & (1 << j))
+					clusterLights[i + j].push_back(light);
+		}
+	}
+
+};
+
+} // namespace ClusteredLighting
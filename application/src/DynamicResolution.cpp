@@ -0,0 +1,124 @@
+/*
+	Dynamic resolution controller test (CPU side of the quality scaling)
+
+	To compile:
+		g++ DynamicResolution.cpp -std=c++11 -O2 -o DynamicResolution
+
+	Usage:
+		DynamicResolution [<number of simulated frames>]
+
+	Checks that the quality ladder lowers one knob per step, that the controller steps down when over the target (for either
+	the frame or the GPU time), holds in the dead band, steps up only on GPU headroom (i.e., not on vsync locked frame times) and
+	keeps its steps apart, then simulates a scene too heavy for full quality and reports the level it settles at, which must fit
+	the target without oscillating.
+*/
+
+#include <vector>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+#include "DynamicResolution.h"
+#include "Check.h"
+
+#define DEFAULT_NUM_FRAMES 2000
+#define TARGET_TIME 16.7f
+// NOTE: GPU time of the simulated scene at full quality, over the target
+#define SCENE_LOAD 1.6f
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: frames until the level changes (or maxFrames if it doesn't)
+size_t framesUntilChange(DynamicResolution::Controller& controller, float frameTime, float gpuTime, size_t maxFrames)
+{
+	for (size_t n = 1; n <= maxFrames; n++)
+		if (controller.update(frameTime, gpuTime, TARGET_TIME))
+			return n;
+	return maxFrames;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: the camera passes scale with the render resolution, the shadow passes with the shadow map resolution and filtering with the sample counts
+float sceneTime(const DynamicResolution::Level& level)
+{
+	return SCENE_LOAD * TARGET_TIME * (0.4f * level.renderScale * level.renderScale + 0.3f * level.shadowMapScale * level.shadowMapScale + 0.3f * level.sampleScale);
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	size_t numFrames = (argc >= 2) ? (size_t)std::atoi(argv[1]) : DEFAULT_NUM_FRAMES;
+	if (numFrames == 0)
+	{
+		std::cout << "invalid number of frames" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// ladder
+	auto& full = DynamicResolution::LEVELS[0];
+	check(full.renderScale == 1 && full.shadowMapScale == 1 && full.sampleScale == 1, "the ladder starts at full quality");
+	auto oneKnobPerStep = true;
+	for (size_t i = 1; i < DynamicResolution::NUM_LEVELS; i++)
+	{
+		auto& a = DynamicResolution::LEVELS[i - 1];
+		auto& b = DynamicResolution::LEVELS[i];
+		auto numLowered = (int)(b.renderScale < a.renderScale) + (int)(b.shadowMapScale < a.shadowMapScale) + (int)(b.sampleScale < a.sampleScale);
+		auto numRaised = (int)(b.renderScale > a.renderScale) + (int)(b.shadowMapScale > a.shadowMapScale) + (int)(b.sampleScale > a.sampleScale);
+		oneKnobPerStep &= numLowered == 1 && numRaised == 0;
+	}
+	check(oneKnobPerStep, "every step lowers exactly one knob");
+
+	// stepping down
+	DynamicResolution::Controller controller(0.1f, 10, 60, 30);
+	auto n = framesUntilChange(controller, TARGET_TIME * 1.5f, TARGET_TIME * 1.5f, 1000);
+	check(controller.getLevelIndex() == 1 && n == 30, "over the target, the level steps down after the cooldown");
+	n = framesUntilChange(controller, TARGET_TIME * 1.5f, TARGET_TIME * 1.5f, 1000);
+	check(controller.getLevelIndex() == 2 && n == 30, "steps are at least cooldown frames apart");
+	controller.setLevel(0);
+	framesUntilChange(controller, TARGET_TIME * 1.5f, TARGET_TIME * 0.5f, 1000);
+	check(controller.getLevelIndex() == 1, "slow frames step down even when the GPU isn't the bottleneck");
+	controller.setLevel(0);
+	framesUntilChange(controller, TARGET_TIME, TARGET_TIME * 1.5f, 1000);
+	check(controller.getLevelIndex() == 1, "slow GPU passes step down even when frame times are locked to the refresh rate");
+
+	// dead band and stepping up
+	controller.setLevel(3);
+	framesUntilChange(controller, TARGET_TIME, TARGET_TIME * 0.95f, 1000);
+	check(controller.getLevelIndex() == 3, "the level holds close to the target");
+	n = framesUntilChange(controller, TARGET_TIME, TARGET_TIME * 0.5f, 1000);
+	check(controller.getLevelIndex() == 2 && n >= 60, "GPU headroom steps up, even with frame times locked to the refresh rate");
+	controller.setLevel(3);
+	framesUntilChange(controller, TARGET_TIME * 0.5f, TARGET_TIME * 0.85f, 1000);
+	check(controller.getLevelIndex() == 3, "fast frames alone don't step up");
+	controller.setLevel(0);
+	framesUntilChange(controller, TARGET_TIME * 0.5f, TARGET_TIME * 0.5f, 1000);
+	check(controller.getLevelIndex() == 0, "full quality is the top of the ladder");
+	controller.setLevel(DynamicResolution::NUM_LEVELS + 10);
+	framesUntilChange(controller, TARGET_TIME * 2, TARGET_TIME * 2, 1000);
+	check(controller.getLevelIndex() == DynamicResolution::NUM_LEVELS - 1, "levels are clamped to the bottom of the ladder");
+
+	// simulated scene
+	std::mt19937 generator(1);
+	std::uniform_real_distribution<float> noiseDistribution(0.95f, 1.05f);
+	DynamicResolution::Controller simulated;
+	size_t numLateChanges = 0;
+	auto lateWithinTarget = true;
+	for (size_t i = 0; i < numFrames; i++)
+	{
+		auto gpuTime = sceneTime(simulated.getLevel()) * noiseDistribution(generator);
+		// NOTE: vsync locks the frame time to the target when the GPU is faster than it
+		auto frameTime = std::max(gpuTime, TARGET_TIME);
+		auto changed = simulated.update(frameTime, gpuTime, TARGET_TIME);
+		if (i >= numFrames / 2)
+		{
+			numLateChanges += (changed) ? 1 : 0;
+			lateWithinTarget &= sceneTime(simulated.getLevel()) <= TARGET_TIME * 1.1f;
+		}
+	}
+	check(simulated.getLevelIndex() > 0, "a scene too heavy for full quality steps down");
+	check(lateWithinTarget, "the settled level fits the target");
+	check(numLateChanges == 0, "the settled level doesn't oscillate");
+	auto& settled = simulated.getLevel();
+	std::cout << std::endl << numFrames << " simulated frames: settled at level " << simulated.getLevelIndex() << " (render scale " << settled.renderScale << ", shadow map scale " << settled.shadowMapScale << ", sample scale " << settled.sampleScale << "), " << sceneTime(settled) << " ms for a " << TARGET_TIME << " ms target" << std::endl;
+
+	return checkResults();
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+// Frame time driven quality scaling (no GL calls, applying the scales is left to the caller)
+// A ladder of quality levels trades, from the least to the most visible, shadow samples, shadow map resolution and the internal render
+// resolution; the controller steps down the ladder when the smoothed frame time exceeds the target and back up when it stays well below it
+
+namespace DynamicResolution
+{
+
+struct Level
+{
+	// NOTE: internal render resolution over the window's (per axis)
+	float renderScale;
+	// NOTE: shadow map resolutions over their maximum (per axis, assigned resolutions are still powers of 2)
+	float shadowMapScale;
+	// NOTE: blocker search and PCF sample counts over their settings
+	float sampleScale;
+
+};
+
+// NOTE: from full quality down, one knob per step
+const Level LEVELS[] =
+{
+	{ 1.0f, 1.0f, 1.0f },
+	{ 1.0f, 1.0f, 0.75f },
+	{ 1.0f, 0.75f, 0.75f },
+	{ 1.0f, 0.75f, 0.5f },
+	{ 0.85f, 0.75f, 0.5f },
+	{ 0.85f, 0.5f, 0.5f },
+	{ 0.75f, 0.5f, 0.5f },
+	{ 0.75f, 0.5f, 0.25f },
+	{ 0.65f, 0.5f, 0.25f },
+	{ 0.5f, 0.5f, 0.25f }
+};
+
+const size_t NUM_LEVELS = sizeof(LEVELS) / sizeof(Level);
+
+struct Controller
+{
+	// NOTE: the frame time must exceed the target by the margin to step down and stay under it by twice the margin to step up
+	// (i.e., a dead band where the level holds), and steps are at least cooldown frames apart
+	Controller(float margin = 0.1f, size_t downFrames = 10, size_t upFrames = 60, size_t cooldown = 30) :
+		margin(margin),
+		downFrames(downFrames),
+		upFrames(upFrames),
+		cooldown(cooldown),
+		level(0),
+		smoothedTime(0),
+		smoothedGPUTime(0),
+		overFrames(0),
+		underFrames(0),
+		framesSinceChange(0)
+	{
+	}
+
+	// frameTime is the measured frame time and gpuTime the sum of the GPU pass times (both in ms), returns true if the level changed;
+	// the slower of the two steps down (nothing else would bring the frame time back), but only the GPU time steps up,
+	// since frame times are locked to the refresh rate under vsync and don't show any headroom
+	bool update(float frameTime, float gpuTime, float targetTime)
+	{
+		const float SMOOTHING = 0.9f;
+		auto load = std::max(frameTime, gpuTime);
+		smoothedTime = (smoothedTime == 0) ? load : smoothedTime * SMOOTHING + load * (1 - SMOOTHING);
+		smoothedGPUTime = (smoothedGPUTime == 0) ? gpuTime : smoothedGPUTime * SMOOTHING + gpuTime * (1 - SMOOTHING);
+		framesSinceChange++;
+		overFrames = (smoothedTime > targetTime * (1 + margin)) ? overFrames + 1 : 0;
+		underFrames = (smoothedGPUTime < targetTime * (1 - 2 * margin) && smoothedTime <= targetTime * (1 + margin)) ? underFrames + 1 : 0;
+		if (framesSinceChange < cooldown)
+			return false;
+		if (overFrames >= downFrames && level + 1 < NUM_LEVELS)
+			return setLevel(level + 1);
+		if (underFrames >= upFrames && level > 0)
+			return setLevel(level - 1);
+		return false;
+	}
+
+	// NOTE: also used to go back to full quality when the controller is disabled
+	bool setLevel(size_t newLevel)
+	{
+		newLevel = std::min(newLevel, NUM_LEVELS - 1);
+		if (newLevel == level)
+			return false;
+		level = newLevel;
+		overFrames = underFrames = framesSinceChange = 0;
+		// NOTE: the times measured at the previous level no longer apply
+		smoothedTime = smoothedGPUTime = 0;
+		return true;
+	}
+
+	const Level& getLevel() const
+	{
+		return LEVELS[level];
+	}
+
+	size_t getLevelIndex() const
+	{
+		return level;
+	}
+
+private:
+	float margin;
+	size_t downFrames;
+	size_t upFrames;
+	size_t cooldown;
+	size_t level;
+	float smoothedTime;
+	float smoothedGPUTime;
+	size_t overFrames;
+	size_t underFrames;
+	size_t framesSinceChange;
+
+};
+
+} // namespace DynamicResolution
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include "GLUtils.h"
+
+// NOTE: number of frames a query result can lag behind before its query object is reused
+#define GPU_TIMER_LATENCY 3
+#define GPU_TIMER_SMOOTHING 0.9f
+
+struct GPUTimer
+{
+	GPUTimer() : current(0), elapsedTime(0), lastTime(0), lastTag(0)
+	{
+		glGenQueries(GPU_TIMER_LATENCY, queries);
+		for (auto i = 0; i < GPU_TIMER_LATENCY; i++)
+		{
+			issued[i] = false;
+			tags[i] = 0;
+		}
+		checkOpenGLError();
+	}
+
+	virtual ~GPUTimer()
+	{
+		glDeleteQueries(GPU_TIMER_LATENCY, queries);
+	}
+
+	// NOTE: GL_TIME_ELAPSED queries cannot be nested
+	void begin()
+	{
+		glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+	}
+
+	// NOTE: the tag is handed back with the result of this query (e.g., the amount of work that was measured),
+	// returns true if the result of an older query was read
+	bool end(size_t tag = 0)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		issued[current] = true;
+		tags[current] = tag;
+		current = (current + 1) % GPU_TIMER_LATENCY;
+		// oldest query, about to be reused
+		if (!issued[current])
+			return false;
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(queries[current], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+			return false;
+		GLuint64 nanoseconds;
+		glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &nanoseconds);
+		issued[current] = false;
+		lastTime = nanoseconds / 1000000.0f;
+		lastTag = tags[current];
+		elapsedTime = GPU_TIMER_SMOOTHING * elapsedTime + (1 - GPU_TIMER_SMOOTHING) * lastTime;
+		return true;
+	}
+
+	// milliseconds, smoothed over the last frames
+	inline float getElapsedTime() const
+	{
+		return elapsedTime;
+	}
+
+	// milliseconds, unsmoothed result of the last query that was read
+	inline float getLastTime() const
+	{
+		return lastTime;
+	}
+
+	// tag of the last query that was read
+	inline size_t getLastTag() const
+	{
+		return lastTag;
+	}
+
+private:
+	GLuint queries[GPU_TIMER_LATENCY];
+	bool issued[GPU_TIMER_LATENCY];
+	size_t tags[GPU_TIMER_LATENCY];
+	size_t current;
+	float elapsedTime;
+	float lastTime;
+	size_t lastTag;
+
+};
@@ -9,10 +9,17 @@
 
 #include "IMovable.h"
 
+// NOTE: also used by spot lights
+#define POINT_LIGHT_NEAR 1.0f
+#define POINT_LIGHT_FAR 10.0f
+#define DEFAULT_SPOT_LIGHT_INNER_ANGLE 20.0f
+#define DEFAULT_SPOT_LIGHT_OUTER_ANGLE 30.0f
+
 enum LightType
 {
 	DIRECTIONAL = 1,
-	POINT
+	POINT,
+	SPOT
 
 };
 
@@ -25,7 +32,13 @@ struct __declspec(align(16)) LightSource
 	float specularPower;
 	glm::vec3 position;
 	LightType type;
+	// NOTE: spot lights only (directional lights keep their direction in position)
+	glm::vec3 direction;
 	float size;
+	float cosInnerAngle;
+	float cosOuterAngle;
+	// NOTE: point and spot lights only, distance at which the light falls below the cutoff (see LightSourceAdapter::updateInfluenceRadius())
+	float radius;
 
 	LightSource() :
 		diffuseColor(0, 0, 0),
@@ -34,7 +47,11 @@ struct __declspec(align(16)) LightSource
 		specularPower(0),
 		position(0, 0, 0),
 		type((LightType)0),
-		size(0)
+		direction(0, 0, 0),
+		size(0),
+		cosInnerAngle(0),
+		cosOuterAngle(0),
+		radius(0)
 	{
 	}
 
@@ -44,7 +61,11 @@ struct __declspec(align(16)) LightSource
 		specularPower(1),
 		position(position),
 		type(type),
-		size(1)
+		direction(0, -1, 0),
+		size(1),
+		cosInnerAngle(glm::cos(glm::radians(DEFAULT_SPOT_LIGHT_INNER_ANGLE))),
+		cosOuterAngle(glm::cos(glm::radians(DEFAULT_SPOT_LIGHT_OUTER_ANGLE))),
+		radius(0)
 	{
 	}
 
@@ -57,7 +78,7 @@ struct LightSourceAdapter : public IMovable
 		enabled(true),
 		index(index),
 		bar(bar),
-		source(type, (type == DIRECTIONAL) ? glm::vec3(0, -1, 0) : glm::vec3(0, 3, 0), (type == DIRECTIONAL) ? 1 : 10)
+		source(type, (type == DIRECTIONAL) ? glm::vec3(0, -1, 0) : ((type == SPOT) ? glm::vec3(0, 5, 0) : glm::vec3(0, 3, 0)), (type == DIRECTIONAL) ? 1 : 10)
 	{
 	}
 
@@ -97,6 +118,19 @@ struct LightSourceAdapter : public IMovable
 
 	void initializeTwBar();
 
+	// NOTE: inverse square falloff of the brightest channel (diffuse or specular) down to the cutoff
+	inline void updateInfluenceRadius(float cutoff)
+	{
+		auto diffuse = source.diffusePower * glm::max(source.diffuseColor.r, glm::max(source.diffuseColor.g, source.diffuseColor.b));
+		auto specular = source.specularPower * glm::max(source.specularColor.r, glm::max(source.specularColor.g, source.specularColor.b));
+		source.radius = glm::sqrt(glm::max(diffuse, specular) / glm::max(cutoff, 1e-6f));
+	}
+
+	float getInfluenceRadius() const
+	{
+		return source.radius;
+	}
+
 	inline void updateData() const
 	{
 		static LightSource empty;
@@ -117,7 +151,7 @@ struct LightSourceAdapter : public IMovable
 			view = glm::lookAt(glm::normalize(-source.position), glm::vec3(0, 0, 0), glm::vec3(-1, 0, 0));
 			break;
 		case POINT:
-			projection = glm::perspective(glm::radians(90.0f), 1.0f, 1.0f, 10.0f);
+			projection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_LIGHT_NEAR, POINT_LIGHT_FAR);
 			switch (textureTarget)
 			{
 			case GL_TEXTURE_CUBE_MAP_POSITIVE_X:
@@ -144,6 +178,15 @@ struct LightSourceAdapter : public IMovable
 			}
 			view = glm::translate(view, -source.position);
 			break;
+		case SPOT:
+		{
+			// NOTE: the shadow map covers the outer cone
+			projection = glm::perspective(2 * glm::acos(glm::clamp(source.cosOuterAngle, 0.0f, 1.0f)), 1.0f, POINT_LIGHT_NEAR, POINT_LIGHT_FAR);
+			auto direction = glm::normalize(source.direction);
+			auto up = (glm::abs(direction.y) > 0.99f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+			view = glm::lookAt(source.position, source.position + direction, up);
+		}
+			break;
 		default:
 			// FIXME: checking invariants
 			throw std::runtime_error("unknown light type");
@@ -183,6 +226,21 @@ struct LightSourceAdapter : public IMovable
 		return source.type;
 	}
 
+	float getSize() const
+	{
+		return source.size;
+	}
+
+	glm::vec3 getDirection() const
+	{
+		return source.direction;
+	}
+
+	float getCosOuterAngle() const
+	{
+		return source.cosOuterAngle;
+	}
+
 protected:
 	bool enabled;
 	size_t index;
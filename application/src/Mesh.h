@@ -110,5 +110,16 @@ struct Mesh
 		checkOpenGLError();
 	}
 
+	void drawInstanced(GLsizei numInstances) const
+	{
+		glBindVertexArray(vao);
+		if (hasIndexBuffer)
+			glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)numIndices, GL_UNSIGNED_INT, 0, numInstances);
+		else
+			glDrawArraysInstanced(GL_TRIANGLES, 0, (GLsizei)numVertices, numInstances);
+
+		checkOpenGLError();
+	}
+
 };
 
@@ -87,6 +87,23 @@ public:
 		this->position = position;
 	}
 
+	float getPhi() const
+	{
+		return phi;
+	}
+
+	float getTheta() const
+	{
+		return theta;
+	}
+
+	void setOrientation(float phi, float theta)
+	{
+		this->phi = phi;
+		this->theta = theta;
+		updateAxis();
+	}
+
 	void buttonDown(int button)
 	{
 		if (button == GLFW_MOUSE_BUTTON_1)
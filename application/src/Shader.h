@@ -3,6 +3,7 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
@@ -12,6 +13,8 @@
 struct Shader
 {
 	GLuint vertexShader;
+	bool hasGeometryShader;
+	GLuint geometryShader;
 	GLuint fragmentShader;
 	GLuint program;
 	GLint uModel;
@@ -22,52 +25,43 @@ struct Shader
 	GLint uLightIntensity;
 	GLint uLightColor;
 
-	Shader(const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename)
+	// NOTE: defines are inserted right after the #version line of both stages (i.e., variants of the same source)
+	Shader(const std::string& vertexShaderFilename, const std::string& fragmentShaderFilename, const std::vector<std::string>& defines = std::vector<std::string>()) : hasGeometryShader(false), geometryShader(0)
 	{
-		std::fstream fileStream(vertexShaderFilename);
-		if (!fileStream.is_open())
-		{
-			std::cout << "cannot open vertex shader file (" << vertexShaderFilename << ")" << std::endl;
-			exit(EXIT_FAILURE);
-		}
-		std::string fileContent((std::istreambuf_iterator<char>(fileStream)), std::istreambuf_iterator<char>());
-		const char* pVertexSource = fileContent.c_str();
-		fileStream.close();
+		vertexShader = loadShader(GL_VERTEX_SHADER, vertexShaderFilename, "vertex", defines);
+		fragmentShader = loadShader(GL_FRAGMENT_SHADER, fragmentShaderFilename, "fragment", defines);
 
-		vertexShader = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertexShader, 1, &pVertexSource, NULL);
-		glCompileShader(vertexShader);
-
-		checkCompileError(vertexShader, vertexShaderFilename);
-
-		fileStream.open(fragmentShaderFilename);
-		if (!fileStream.is_open())
-		{
-			std::cout << "cannot open fragment shader file (" << fragmentShaderFilename << ")" << std::endl;
-			exit(EXIT_FAILURE);
-		}
-		fileContent = std::string((std::istreambuf_iterator<char>(fileStream)), std::istreambuf_iterator<char>());
-		const char* pFragmentSource = fileContent.c_str();
+		program = glCreateProgram();
+		glAttachShader(program, vertexShader);
+		glAttachShader(program, fragmentShader);
+		glBindFragDataLocation(program, 0, "outColor");
+		glLinkProgram(program);
 
-		fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragmentShader, 1, &pFragmentSource, NULL);
-		glCompileShader(fragmentShader);
+		checkLinkError(vertexShaderFilename, fragmentShaderFilename);
+	}
 
-		checkCompileError(fragmentShader, fragmentShaderFilename);
+	Shader(const std::string& vertexShaderFilename, const std::string& geometryShaderFilename, const std::string& fragmentShaderFilename) : hasGeometryShader(true)
+	{
+		vertexShader = loadShader(GL_VERTEX_SHADER, vertexShaderFilename, "vertex");
+		geometryShader = loadShader(GL_GEOMETRY_SHADER, geometryShaderFilename, "geometry");
+		fragmentShader = loadShader(GL_FRAGMENT_SHADER, fragmentShaderFilename, "fragment");
 
 		program = glCreateProgram();
 		glAttachShader(program, vertexShader);
+		glAttachShader(program, geometryShader);
 		glAttachShader(program, fragmentShader);
 		glBindFragDataLocation(program, 0, "outColor");
 		glLinkProgram(program);
 
-		checkLinkError(vertexShaderFilename, fragmentShaderFilename);
+		checkLinkError(vertexShaderFilename + ", " + geometryShaderFilename, fragmentShaderFilename);
 	}
 
 	virtual ~Shader()
 	{
 		glDeleteProgram(program);
 		glDeleteShader(fragmentShader);
+		if (hasGeometryShader)
+			glDeleteShader(geometryShader);
 		glDeleteShader(vertexShader);
 	}
 
@@ -77,6 +71,34 @@ struct Shader
 	}
 
 private:
+	GLuint loadShader(GLenum type, const std::string& fileName, const std::string& stage, const std::vector<std::string>& defines = std::vector<std::string>())
+	{
+		std::fstream fileStream(fileName);
+		if (!fileStream.is_open())
+		{
+			std::cout << "cannot open " << stage << " shader file (" << fileName << ")" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		std::string fileContent((std::istreambuf_iterator<char>(fileStream)), std::istreambuf_iterator<char>());
+		if (!defines.empty())
+		{
+			std::string defineLines;
+			for (auto& define : defines)
+				defineLines += "#define " + define + "\n";
+			auto versionEnd = fileContent.find('\n');
+			fileContent.insert((versionEnd == std::string::npos) ? fileContent.size() : versionEnd + 1, defineLines);
+		}
+		const char* pSource = fileContent.c_str();
+
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &pSource, NULL);
+		glCompileShader(shader);
+
+		checkCompileError(shader, fileName);
+
+		return shader;
+	}
+
 	void checkLinkError(const std::string& fileName1, const std::string& fileName2)
 	{
 		GLint isLinked = 0;
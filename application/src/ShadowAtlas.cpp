@@ -0,0 +1,149 @@
+/*
+	Shadow map budget and atlas packing test (CPU side of the shadow map budget manager)
+
+	To compile:
+		g++ ShadowAtlas.cpp -std=c++11 -O2 -o ShadowAtlas
+
+	Usage:
+		ShadowAtlas [<number of random light sets>]
+
+	Checks that resolutions are powers of 2 within the budget (when the min. resolutions allow it), that higher priorities
+	keep their resolution longer, and that packed tiles don't overlap, stay inside the atlas width and keep the input order,
+	then packs random light sets and reports how much of the atlas the tiles cover.
+*/
+
+#include <vector>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+#include "ShadowAtlas.h"
+#include "Check.h"
+
+#define ATLAS_WIDTH 8192
+#define MAX_RESOLUTION 4096
+#define MIN_RESOLUTION 256
+#define DEFAULT_NUM_LIGHT_SETS 256
+#define MAX_LIGHTS_PER_SET 8
+
+//////////////////////////////////////////////////////////////////////////
+bool isPowerOfTwo(size_t value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+size_t totalTexels(const std::vector<ShadowAtlas::Demand>& demands, const std::vector<size_t>& resolutions)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < demands.size(); i++)
+		total += ShadowAtlas::Texels(demands[i], resolutions[i]);
+	return total;
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool overlap(const ShadowAtlas::Rect& a, const ShadowAtlas::Rect& b)
+{
+	return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: false if any two non-empty tiles overlap, a tile leaves the atlas or its size differs from the requested one
+bool isValidPacking(const std::vector<ShadowAtlas::Rect>& sizes, const std::vector<ShadowAtlas::Rect>& rects, size_t atlasWidth, size_t atlasHeight)
+{
+	if (rects.size() != sizes.size())
+		return false;
+	for (size_t i = 0; i < rects.size(); i++)
+	{
+		if (rects[i].width != sizes[i].width || rects[i].height != sizes[i].height)
+			return false;
+		if (rects[i].width == 0 || rects[i].height == 0)
+			continue;
+		if (rects[i].x + rects[i].width > atlasWidth || rects[i].y + rects[i].height > atlasHeight)
+			return false;
+		for (size_t j = 0; j < i; j++)
+			if (rects[j].width != 0 && rects[j].height != 0 && overlap(rects[i], rects[j]))
+				return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	size_t numLightSets = (argc >= 2) ? (size_t)std::atoi(argv[1]) : DEFAULT_NUM_LIGHT_SETS;
+	if (numLightSets == 0)
+	{
+		std::cout << "invalid number of light sets" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// powers of 2
+	check(ShadowAtlas::FloorPowerOfTwo(1) == 1 && ShadowAtlas::FloorPowerOfTwo(1000) == 512 && ShadowAtlas::FloorPowerOfTwo(1024) == 1024, "floor power of 2");
+
+	// within budget
+	std::vector<ShadowAtlas::Demand> demands =
+	{
+		{ MAX_RESOLUTION, MIN_RESOLUTION, 1, 1.0f },
+		{ 1500, MIN_RESOLUTION, 6, 0.5f },
+		{ 2048, MIN_RESOLUTION, 2, 0.25f },
+		{ 2048, MIN_RESOLUTION, 1, 0.1f }
+	};
+	auto unlimited = ShadowAtlas::AssignResolutions(demands, (size_t)-1);
+	check(unlimited[0] == MAX_RESOLUTION && unlimited[1] == 1024 && unlimited[2] == 2048 && unlimited[3] == 2048, "resolutions are the demands rounded down to powers of 2 when memory is free");
+	const size_t budgetTexels = 16 * 1024 * 1024;
+	auto resolutions = ShadowAtlas::AssignResolutions(demands, budgetTexels);
+	auto allPowersOfTwo = true, aboveMin = true;
+	for (size_t i = 0; i < demands.size(); i++)
+	{
+		allPowersOfTwo &= isPowerOfTwo(resolutions[i]);
+		aboveMin &= resolutions[i] >= demands[i].minResolution;
+	}
+	check(allPowersOfTwo, "assigned resolutions are powers of 2");
+	check(aboveMin, "assigned resolutions are never below the min. resolutions");
+	check(totalTexels(demands, resolutions) <= budgetTexels, "assigned resolutions fit the budget");
+	check(resolutions[0] >= resolutions[3], "higher priorities keep their resolution longer");
+	auto tiny = ShadowAtlas::AssignResolutions(demands, 1);
+	auto allAtMin = true;
+	for (size_t i = 0; i < demands.size(); i++)
+		allAtMin &= tiny[i] == demands[i].minResolution;
+	check(allAtMin, "budgets below the min. resolutions stop at the min. resolutions");
+	check(!ShadowAtlas::Reduce(demands, tiny), "nothing is reduced below the min. resolutions");
+	auto masked = unlimited;
+	ShadowAtlas::Reduce(demands, masked, std::vector<bool>{ false, true, false, false });
+	check(masked[0] == unlimited[0] && masked[1] == unlimited[1] / 2 && masked[2] == unlimited[2] && masked[3] == unlimited[3], "only masked lights are reduced");
+
+	// packing
+	std::vector<ShadowAtlas::Rect> sizes = { { 0, 0, 1024, 1024 }, { 0, 0, 4096, 2048 }, { 0, 0, 0, 0 }, { 0, 0, 2048, 2048 }, { 0, 0, 512, 512 } };
+	std::vector<ShadowAtlas::Rect> rects;
+	auto atlasHeight = ShadowAtlas::Pack(sizes, ATLAS_WIDTH, rects);
+	check(isValidPacking(sizes, rects, ATLAS_WIDTH, atlasHeight), "packed tiles keep their order and sizes, don't overlap and stay inside the atlas");
+	check(atlasHeight == 2048, "tiles that fit in one row take the height of the tallest one");
+
+	// random light sets
+	std::mt19937 generator(1);
+	std::uniform_int_distribution<int> numLightsDistribution(1, MAX_LIGHTS_PER_SET), typeDistribution(0, 2), levelDistribution(0, 4);
+	auto allValid = true;
+	double coverage = 0;
+	for (size_t n = 0; n < numLightSets; n++)
+	{
+		std::vector<ShadowAtlas::Rect> randomSizes;
+		size_t texels = 0;
+		for (int i = numLightsDistribution(generator); i > 0; i--)
+		{
+			// NOTE: 2D maps and dual-paraboloid maps (2 faces side by side)
+			size_t numFaces = (typeDistribution(generator) == 0) ? 2 : 1;
+			size_t resolution = MAX_RESOLUTION >> levelDistribution(generator);
+			randomSizes.emplace_back(ShadowAtlas::Rect{ 0, 0, resolution * numFaces, resolution });
+			texels += resolution * resolution * numFaces;
+		}
+		std::vector<ShadowAtlas::Rect> randomRects;
+		auto height = ShadowAtlas::Pack(randomSizes, ATLAS_WIDTH, randomRects);
+		allValid &= isValidPacking(randomSizes, randomRects, ATLAS_WIDTH, height);
+		coverage += texels / (double)(ATLAS_WIDTH * height);
+	}
+	check(allValid, "random light sets pack without overlaps");
+	std::cout << std::endl << numLightSets << " random light sets: tiles cover " << 100 * coverage / numLightSets << "% of the atlas on average" << std::endl;
+
+	return checkResults();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstddef>
+
+// Shadow map budget and atlas packing (no GL calls, texture (re)allocation is left to the caller)
+
+namespace ShadowAtlas
+{
+
+// NOTE: in texels
+struct Rect
+{
+	size_t x;
+	size_t y;
+	size_t width;
+	size_t height;
+
+};
+
+struct Demand
+{
+	// NOTE: resolution wanted if memory were free (i.e., max. resolution scaled by coverage and light size), a power of 2
+	size_t resolution;
+	size_t minResolution;
+	// NOTE: square faces of resolution^2 texels (1 for a 2D map, 2 for a dual-paraboloid map and 6 for a cube map)
+	size_t numFaces;
+	// NOTE: higher priorities keep their resolution longer when over budget
+	float priority;
+
+};
+
+inline size_t FloorPowerOfTwo(size_t value)
+{
+	size_t powerOfTwo = 1;
+	while (powerOfTwo * 2 <= value)
+		powerOfTwo *= 2;
+	return powerOfTwo;
+}
+
+inline size_t Texels(const Demand& demand, size_t resolution)
+{
+	return demand.numFaces * resolution * resolution;
+}
+
+// halves the resolution of the light that frees the most texels per unit of priority, returns false if all lights are at their min. resolution
+inline bool Reduce(const std::vector<Demand>& demands, std::vector<size_t>& resolutions, const std::vector<bool>& mask = std::vector<bool>())
+{
+	size_t selected = demands.size();
+	float maxCost = -1;
+	for (size_t i = 0; i < demands.size(); i++)
+	{
+		if (resolutions[i] <= demands[i].minResolution || (!mask.empty() && !mask[i]))
+			continue;
+		auto cost = Texels(demands[i], resolutions[i]) / std::max(demands[i].priority, 1e-6f);
+		if (cost > maxCost)
+		{
+			maxCost = cost;
+			selected = i;
+		}
+	}
+	if (selected == demands.size())
+		return false;
+	resolutions[selected] /= 2;
+	return true;
+}
+
+// assigns power of 2 resolutions so that the total number of texels stays within the budget (when possible)
+inline std::vector<size_t> AssignResolutions(const std::vector<Demand>& demands, size_t budgetTexels)
+{
+	std::vector<size_t> resolutions(demands.size());
+	size_t total = 0;
+	for (size_t i = 0; i < demands.size(); i++)
+	{
+		resolutions[i] = std::max(demands[i].minResolution, FloorPowerOfTwo(demands[i].resolution));
+		total += Texels(demands[i], resolutions[i]);
+	}
+	while (total > budgetTexels && Reduce(demands, resolutions))
+	{
+		total = 0;
+		for (size_t i = 0; i < demands.size(); i++)
+			total += Texels(demands[i], resolutions[i]);
+	}
+	return resolutions;
+}
+
+// shelf packing: rectangles are sorted by decreasing height and placed left to right, opening a new shelf when a row is full;
+// with power of 2 sizes (and a power of 2 atlas width) shelves only leave gaps in the last row of each height
+// returns the atlas height used (rects keep the input order)
+inline size_t Pack(const std::vector<Rect>& sizes, size_t atlasWidth, std::vector<Rect>& rects)
+{
+	std::vector<size_t> order(sizes.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) { return sizes[a].height > sizes[b].height; });
+	rects.resize(sizes.size());
+	size_t x = 0, y = 0, shelfHeight = 0;
+	for (auto i : order)
+	{
+		if (x + sizes[i].width > atlasWidth)
+		{
+			x = 0;
+			y += shelfHeight;
+			shelfHeight = 0;
+		}
+		rects[i] = Rect{ x, y, sizes[i].width, sizes[i].height };
+		x += sizes[i].width;
+		shelfHeight = std::max(shelfHeight, sizes[i].height);
+	}
+	return y + shelfHeight;
+}
+
+} // namespace ShadowAtlas
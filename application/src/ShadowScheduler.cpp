@@ -0,0 +1,121 @@
+/*
+	Amortized shadow map update scheduling test (CPU side of the shadow map scheduler)
+
+	To compile:
+		g++ ShadowScheduler.cpp -std=c++11 -O2 -o ShadowScheduler
+
+	Usage:
+		ShadowScheduler [<number of simulated frames>]
+
+	Checks that mandatory candidates and the highest priority one are always selected, that the other selected candidates
+	fit the budget (cheaper ones filling the gaps left by expensive ones), then simulates a scene where every shadow map is
+	dirty every frame and reports the max. age reached, which must stay bounded (i.e., no shadow map starves).
+*/
+
+#include <vector>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+#include "ShadowScheduler.h"
+#include "Check.h"
+
+#define DEFAULT_NUM_FRAMES 1000
+#define NUM_LIGHTS 16
+#define BUDGET 1.0f
+// NOTE: an update that hasn't happened after this many frames (about 4 s at 60 Hz) is considered starved
+#define MAX_AGE 256
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: cost of the selected candidates, excluding mandatory ones and the highest priority one
+float optionalCost(const std::vector<ShadowScheduler::Candidate>& candidates, const std::vector<bool>& selected, size_t highest)
+{
+	float total = 0;
+	for (size_t i = 0; i < candidates.size(); i++)
+		if (selected[i] && !candidates[i].mandatory && i != highest)
+			total += candidates[i].cost;
+	return total;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	size_t numFrames = (argc >= 2) ? (size_t)std::atoi(argv[1]) : DEFAULT_NUM_FRAMES;
+	if (numFrames == 0)
+	{
+		std::cout << "invalid number of frames" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// priority
+	ShadowScheduler::Candidate reference{ 0.1f, 0.5f, 0, 0, false };
+	auto moreImportant = reference, moving = reference, older = reference, invisible = reference;
+	moreImportant.importance = 1;
+	moving.motion = 1;
+	older.age = 1;
+	invisible.importance = 0;
+	check(ShadowScheduler::Priority(moreImportant) > ShadowScheduler::Priority(reference) && ShadowScheduler::Priority(moving) > ShadowScheduler::Priority(reference) && ShadowScheduler::Priority(older) > ShadowScheduler::Priority(reference), "priority grows with importance, motion and age");
+	invisible.age = 1;
+	check(ShadowScheduler::Priority(invisible) > ShadowScheduler::Priority(ShadowScheduler::Candidate{ 0.1f, 0, 0, 0, false }), "lights off screen still age");
+
+	// selection
+	std::vector<ShadowScheduler::Candidate> candidates =
+	{
+		{ 0.6f, 0.2f, 0, 0, false },
+		{ 0.3f, 1.0f, 0, 0, false },
+		{ 0.5f, 0.5f, 0, 0, false },
+		{ 0.2f, 0.1f, 0, 0, false }
+	};
+	auto selected = ShadowScheduler::Schedule(candidates, BUDGET);
+	check(selected[1] && selected[2] && !selected[0] && selected[3], "candidates that don't fit are skipped in favour of cheaper ones");
+	check(optionalCost(candidates, selected, 1) + candidates[1].cost <= BUDGET, "selected candidates fit the budget");
+	selected = ShadowScheduler::Schedule(candidates, 0);
+	check(selected[1] && !selected[0] && !selected[2] && !selected[3], "the highest priority candidate is selected even over budget");
+	auto withMandatory = candidates;
+	withMandatory.push_back(ShadowScheduler::Candidate{ 2.0f, 0.0f, 0, 0, true });
+	selected = ShadowScheduler::Schedule(withMandatory, BUDGET);
+	check(selected[4], "mandatory candidates are selected even over budget");
+	check(selected[1], "the highest priority candidate is selected even when mandatory ones exhaust the budget");
+	check(!selected[0] && !selected[2] && !selected[3], "mandatory candidates count against the budget");
+	check(ShadowScheduler::Schedule(std::vector<ShadowScheduler::Candidate>(), BUDGET).empty(), "no candidates, no selection");
+
+	// starvation
+	std::mt19937 generator(1);
+	std::uniform_real_distribution<float> costDistribution(0.05f, 0.5f), importanceDistribution(0, 1), motionDistribution(0, 2);
+	std::vector<ShadowScheduler::Candidate> lights(NUM_LIGHTS);
+	for (auto& light : lights)
+		light = ShadowScheduler::Candidate{ costDistribution(generator), importanceDistribution(generator), 0, 0, false };
+	// NOTE: a barely visible, static light that takes the whole budget competing with moving ones
+	// (lights off screen age too, but their shadows aren't visible until they get closer to the camera)
+	lights[0].importance = 0.05f;
+	lights[0].cost = BUDGET;
+	size_t maxAge = 0, numUpdates = 0;
+	auto withinBudget = true;
+	for (size_t n = 0; n < numFrames; n++)
+	{
+		for (auto& light : lights)
+			light.motion = (&light == &lights[0]) ? 0 : motionDistribution(generator);
+		auto scheduled = ShadowScheduler::Schedule(lights, BUDGET);
+		float total = 0;
+		size_t numScheduled = 0;
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			if (scheduled[i])
+			{
+				total += lights[i].cost;
+				lights[i].age = 0;
+				numScheduled++;
+			}
+			else
+				maxAge = std::max(maxAge, ++lights[i].age);
+		}
+		// NOTE: the highest priority candidate alone can exceed the budget
+		withinBudget &= numScheduled == 1 || total <= BUDGET;
+		numUpdates += numScheduled;
+	}
+	check(withinBudget, "simulated frames stay within budget");
+	check(maxAge <= MAX_AGE, "no shadow map starves");
+	std::cout << std::endl << numFrames << " simulated frames: " << (float)numUpdates / numFrames << " updates per frame, max. age " << maxAge << " frames" << std::endl;
+
+	return checkResults();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstddef>
+
+// Amortized shadow map updates (no GL calls, rendering is left to the caller)
+// Dirty shadow maps compete for a GPU time budget, the ones left out keep their previous content and grow older,
+// so that every map is eventually updated (i.e., round-robin weighted by motion, screen importance and age)
+
+namespace ShadowScheduler
+{
+
+struct Candidate
+{
+	// NOTE: estimated GPU time in ms
+	float cost;
+	// NOTE: screen coverage of the light (0-1)
+	float importance;
+	// NOTE: how far the light moved since its shadow map was rendered (world units)
+	float motion;
+	// NOTE: frames the shadow map has been dirty without being updated
+	size_t age;
+	// NOTE: maps without valid content (e.g., new lights or reassigned storage) are updated regardless of the budget
+	bool mandatory;
+
+};
+
+inline float Priority(const Candidate& candidate)
+{
+	return std::max(candidate.importance, 1e-3f) * (1 + candidate.motion) * (1 + candidate.age);
+}
+
+// selects candidates by decreasing priority while their estimated cost fits the budget, skipping the ones that don't fit
+// in favour of cheaper ones; mandatory candidates and the highest priority one are always selected (even over budget),
+// so that at least one deferred map is updated every frame
+inline std::vector<bool> Schedule(const std::vector<Candidate>& candidates, float budget)
+{
+	std::vector<size_t> order(candidates.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&candidates](size_t a, size_t b)
+	{
+		if (candidates[a].mandatory != candidates[b].mandatory)
+			return candidates[a].mandatory;
+		return Priority(candidates[a]) > Priority(candidates[b]);
+	});
+	std::vector<bool> selected(candidates.size(), false);
+	float total = 0;
+	// NOTE: mandatory candidates come first, so the first optional one is the highest priority one
+	bool isFirstOptional = true;
+	for (auto i : order)
+	{
+		if (!candidates[i].mandatory)
+		{
+			if (!isFirstOptional && total + candidates[i].cost > budget)
+				continue;
+			isFirstOptional = false;
+		}
+		selected[i] = true;
+		total += candidates[i].cost;
+	}
+	return selected;
+}
+
+} // namespace ShadowScheduler
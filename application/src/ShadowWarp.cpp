@@ -0,0 +1,144 @@
+/*
+	Perspective shadow map warp test (CPU side of the shadow map warp)
+
+	To compile:
+		g++ ShadowWarp.cpp -std=c++11 -O2 -o ShadowWarp
+
+	Usage:
+		ShadowWarp [<number of random footprints>]
+
+	Checks the convex hull and the clipping of camera frustum footprints to the orthographic shadow map, that the trapezoid
+	warp maps a footprint into [-1, 1]^2 with a positive w (i.e., no point behind the projection center), its near side
+	to v = -1 and without mirroring it, then warps random footprints and reports how much of the warped map they cover.
+*/
+
+#include <vector>
+#include <iostream>
+#include <random>
+#include <cstdlib>
+
+#include "ShadowWarp.h"
+#include "Check.h"
+
+#define DEFAULT_NUM_FOOTPRINTS 1000
+#define EPSILON 1e-3f
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: signed (positive when counter-clockwise)
+float area(const std::vector<ShadowWarp::Point>& polygon)
+{
+	float total = 0;
+	for (size_t i = 0; i < polygon.size(); i++)
+	{
+		auto& a = polygon[i];
+		auto& b = polygon[(i + 1) % polygon.size()];
+		total += a.x * b.y - b.x * a.y;
+	}
+	return total * 0.5f;
+}
+
+//////////////////////////////////////////////////////////////////////////
+bool isInsideUnitSquare(const ShadowWarp::Point& point)
+{
+	return point.x >= -1 - EPSILON && point.x <= 1 + EPSILON && point.y >= -1 - EPSILON && point.y <= 1 + EPSILON;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: false if any point lands outside [-1, 1]^2 or behind the projection center, minV and maxV are the v range of the warped points
+bool isValidWarp(const std::vector<ShadowWarp::Point>& points, const ShadowWarp::Homography& warp, float& minV, float& maxV)
+{
+	minV = FLT_MAX;
+	maxV = -FLT_MAX;
+	for (auto& point : points)
+	{
+		if (warp.m[6] * point.x + warp.m[7] * point.y + warp.m[8] <= 0)
+			return false;
+		auto warped = warp.apply(point);
+		if (!isInsideUnitSquare(warped))
+			return false;
+		minV = std::min(minV, warped.y);
+		maxV = std::max(maxV, warped.y);
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	size_t numFootprints = (argc >= 2) ? (size_t)std::atoi(argv[1]) : DEFAULT_NUM_FOOTPRINTS;
+	if (numFootprints == 0)
+	{
+		std::cout << "invalid number of footprints" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// convex hull
+	std::vector<ShadowWarp::Point> points = { { 0, 0 }, { 1, 0 }, { 0.5f, 0.5f }, { 1, 1 }, { 0.5f, 0 }, { 0, 1 }, { 0.25f, 0.75f } };
+	auto hull = ShadowWarp::ConvexHull(points);
+	check(hull.size() == 4, "interior and collinear points are dropped from the hull");
+	check(std::abs(area(hull) - 1) < EPSILON, "the hull is counter-clockwise and encloses every point");
+
+	// clipping
+	std::vector<ShadowWarp::Point> inside = { { -0.5f, -0.5f }, { 0.5f, -0.5f }, { 0, 0.5f } };
+	auto clipped = ShadowWarp::ClipToUnitSquare(inside);
+	check(clipped.size() == inside.size() && std::abs(area(clipped) - area(inside)) < EPSILON, "footprints inside the map are kept as is");
+	std::vector<ShadowWarp::Point> straddling = { { 0, 0 }, { 2, 0 }, { 2, 2 }, { 0, 2 } };
+	clipped = ShadowWarp::ClipToUnitSquare(straddling);
+	auto allInside = !clipped.empty();
+	for (auto& point : clipped)
+		allInside &= isInsideUnitSquare(point);
+	check(allInside && std::abs(area(clipped) - 1) < EPSILON, "footprints leaving the map are clipped to it");
+	check(ShadowWarp::ClipToUnitSquare(std::vector<ShadowWarp::Point>{ { 2, 2 }, { 3, 2 }, { 3, 3 } }).empty(), "footprints outside the map are clipped away");
+
+	// trapezoid
+	std::vector<ShadowWarp::Point> frustum = { { -0.1f, -0.8f }, { 0.1f, -0.8f }, { 0.6f, 0.9f }, { -0.6f, 0.9f } };
+	ShadowWarp::Homography warp;
+	auto warped = ShadowWarp::Trapezoid(frustum, ShadowWarp::Point{ 0, -0.8f }, ShadowWarp::Point{ 0, 0.9f }, 0.5f, warp);
+	float minV, maxV;
+	check(warped && isValidWarp(frustum, warp, minV, maxV), "the footprint is warped into [-1, 1]^2 with a positive w");
+	check(std::abs(minV + 1) < EPSILON && std::abs(maxV - 1) < EPSILON, "the footprint spans v from the near side (-1) to the far side (1)");
+	auto nearWidth = warp.apply(frustum[1]).x - warp.apply(frustum[0]).x, farWidth = warp.apply(frustum[2]).x - warp.apply(frustum[3]).x;
+	check(nearWidth > (frustum[1].x - frustum[0].x), "the near side gets more texels than in the orthographic map");
+	check(farWidth > 0 && nearWidth > 0, "the warp keeps the footprint's orientation");
+	check(!ShadowWarp::Trapezoid(frustum, ShadowWarp::Point{ 0, 0 }, ShadowWarp::Point{ 0, 0 }, 0.5f, warp), "no axis, no warp");
+	check(!ShadowWarp::Trapezoid(frustum, ShadowWarp::Point{ 0, -0.8f }, ShadowWarp::Point{ 0, 0.9f }, 0, warp), "no projection center, no warp");
+	check(ShadowWarp::LiSPSMApexRatio(0.1f, 100, 1) > 0 && ShadowWarp::LiSPSMApexRatio(0.1f, 100, 0) == 0, "looking along the light doesn't warp");
+
+	// random footprints
+	std::mt19937 generator(1);
+	std::uniform_real_distribution<float> positionDistribution(-1.5f, 1.5f), widthDistribution(0.01f, 1), apexDistribution(0.05f, 4);
+	auto allValid = true, allOriented = true;
+	size_t numWarped = 0;
+	double coverage = 0;
+	for (size_t n = 0; n < numFootprints; n++)
+	{
+		// NOTE: a frustum-like footprint (narrow near side, wide far side) clipped to the orthographic map
+		ShadowWarp::Point nearCenter{ positionDistribution(generator), positionDistribution(generator) };
+		ShadowWarp::Point farCenter{ positionDistribution(generator), positionDistribution(generator) };
+		auto ax = farCenter.x - nearCenter.x, ay = farCenter.y - nearCenter.y;
+		auto nearWidth = widthDistribution(generator) * 0.25f, farWidth = widthDistribution(generator);
+		std::vector<ShadowWarp::Point> corners =
+		{
+			{ nearCenter.x + ay * nearWidth, nearCenter.y - ax * nearWidth },
+			{ nearCenter.x - ay * nearWidth, nearCenter.y + ax * nearWidth },
+			{ farCenter.x - ay * farWidth, farCenter.y + ax * farWidth },
+			{ farCenter.x + ay * farWidth, farCenter.y - ax * farWidth }
+		};
+		auto footprint = ShadowWarp::ClipToUnitSquare(ShadowWarp::ConvexHull(corners));
+		if (!ShadowWarp::Trapezoid(footprint, nearCenter, farCenter, apexDistribution(generator), warp))
+			continue;
+		allValid &= isValidWarp(footprint, warp, minV, maxV);
+		std::vector<ShadowWarp::Point> warpedFootprint;
+		for (auto& point : footprint)
+			warpedFootprint.emplace_back(warp.apply(point));
+		// NOTE: the hull is counter-clockwise, so is the warped footprint unless the warp mirrors the map
+		allOriented &= area(warpedFootprint) > 0;
+		coverage += area(warpedFootprint) / 4;
+		numWarped++;
+	}
+	check(numWarped > 0 && allValid, "random footprints are warped into [-1, 1]^2 with a positive w");
+	check(allOriented, "random footprints keep their orientation (the winding of the triangles rendered into the map)");
+	std::cout << std::endl << numWarped << " warped footprints (out of " << numFootprints << "): they cover " << ((numWarped > 0) ? 100 * coverage / numWarped : 0) << "% of the map on average" << std::endl;
+
+	return checkResults();
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+// Perspective warp of directional light shadow maps (no GL calls, matrices are built by the caller)
+// The light's orthographic shadow map plane is warped by a 2D projective transform (homography) that maps a trapezoid enclosing
+// the camera frustum's footprint to the whole map, with its short side near the camera (i.e., trapezoidal shadow maps with the
+// light-space perspective (LiSPSM) choice of projection center)
+
+namespace ShadowWarp
+{
+
+// NOTE: light NDC (orthographic shadow map plane, [-1, 1]^2)
+struct Point
+{
+	float x;
+	float y;
+
+};
+
+// NOTE: row-major, maps (x, y, 1) to (u * w, v * w, w)
+struct Homography
+{
+	float m[9];
+
+	static Homography Identity()
+	{
+		return Homography{ { 1, 0, 0, 0, 1, 0, 0, 0, 1 } };
+	}
+
+	Point apply(const Point& point) const
+	{
+		auto w = m[6] * point.x + m[7] * point.y + m[8];
+		return Point{ (m[0] * point.x + m[1] * point.y + m[2]) / w, (m[3] * point.x + m[4] * point.y + m[5]) / w };
+	}
+
+};
+
+// NOTE: Andrew's monotone chain, counter-clockwise
+inline std::vector<Point> ConvexHull(std::vector<Point> points)
+{
+	if (points.size() < 3)
+		return points;
+	std::sort(points.begin(), points.end(), [](const Point& a, const Point& b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+	auto cross = [](const Point& o, const Point& a, const Point& b) { return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x); };
+	std::vector<Point> hull(points.size() * 2);
+	size_t k = 0;
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0)
+			k--;
+		hull[k++] = points[i];
+	}
+	for (size_t i = points.size() - 1, lower = k + 1; i > 0; i--)
+	{
+		while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i - 1]) <= 0)
+			k--;
+		hull[k++] = points[i - 1];
+	}
+	hull.resize(k - 1);
+	return hull;
+}
+
+// NOTE: Sutherland-Hodgman against the four sides of [-1, 1]^2 (the part of the footprint the orthographic map covers)
+inline std::vector<Point> ClipToUnitSquare(std::vector<Point> polygon)
+{
+	for (int side = 0; side < 4 && !polygon.empty(); side++)
+	{
+		auto axis = side / 2;
+		auto sign = (side % 2 == 0) ? 1.0f : -1.0f;
+		auto distance = [axis, sign](const Point& p) { return 1 - sign * ((axis == 0) ? p.x : p.y); };
+		std::vector<Point> clipped;
+		for (size_t i = 0; i < polygon.size(); i++)
+		{
+			auto& a = polygon[i];
+			auto& b = polygon[(i + 1) % polygon.size()];
+			auto da = distance(a), db = distance(b);
+			if (da >= 0)
+				clipped.push_back(a);
+			if ((da >= 0) != (db >= 0))
+			{
+				auto t = da / (da - db);
+				clipped.push_back(Point{ a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t });
+			}
+		}
+		polygon.swap(clipped);
+	}
+	return polygon;
+}
+
+// warp mapping the trapezoid that encloses the points to [-1, 1]^2, its short side (v = -1) across the near end of the axis
+// (from nearCenter towards farCenter), its projection center apexRatio * (trapezoid length) behind that side
+// (small ratios give more texels to the near side, large ones tend to the orthographic map); false if there is no axis
+inline bool Trapezoid(const std::vector<Point>& points, const Point& nearCenter, const Point& farCenter, float apexRatio, Homography& warp)
+{
+	auto ax = farCenter.x - nearCenter.x, ay = farCenter.y - nearCenter.y;
+	auto axisLength = std::sqrt(ax * ax + ay * ay);
+	if (points.size() < 3 || axisLength < 1e-4f || apexRatio <= 0)
+		return false;
+	ax /= axisLength;
+	ay /= axisLength;
+	// NOTE: s along the axis, t across it (both from the near center, (t, s) keeps the orientation of (x, y) so the warp doesn't flip
+	// the winding of the triangles rendered into the map)
+	auto px = ay, py = -ax;
+	auto sOrigin = ax * nearCenter.x + ay * nearCenter.y, tOrigin = px * nearCenter.x + py * nearCenter.y;
+	auto sMin = FLT_MAX, sMax = -FLT_MAX;
+	for (auto& point : points)
+	{
+		auto s = ax * point.x + ay * point.y - sOrigin;
+		sMin = std::min(sMin, s);
+		sMax = std::max(sMax, s);
+	}
+	auto length = sMax - sMin;
+	if (length < 1e-4f)
+		return false;
+	// NOTE: sigma is the distance from the projection center along the axis, the sides are the lines through the center enclosing every point
+	auto sigma0 = apexRatio * length, sigma1 = sigma0 + length;
+	auto apex = sMin - sigma0;
+	auto slopeMin = FLT_MAX, slopeMax = -FLT_MAX;
+	for (auto& point : points)
+	{
+		auto sigma = ax * point.x + ay * point.y - sOrigin - apex;
+		auto t = px * point.x + py * point.y - tOrigin;
+		slopeMin = std::min(slopeMin, t / sigma);
+		slopeMax = std::max(slopeMax, t / sigma);
+	}
+	auto slopeCenter = (slopeMax + slopeMin) * 0.5f, slopeHalf = (slopeMax - slopeMin) * 0.5f;
+	if (slopeHalf < 1e-6f)
+		return false;
+	// w = sigma, u * w = (t - slopeCenter * sigma) / slopeHalf and v * w = sigma * (sigma1 + sigma0) / (sigma1 - sigma0) - 2 * sigma1 * sigma0 / (sigma1 - sigma0),
+	// so that u spans [-1, 1] between the sides and v goes from -1 at sigma0 to 1 at sigma1
+	float w[3] = { ax, ay, -(sOrigin + apex) };
+	float t[3] = { px, py, -tOrigin };
+	auto a = (sigma1 + sigma0) / (sigma1 - sigma0), b = -2 * sigma1 * sigma0 / (sigma1 - sigma0);
+	for (int j = 0; j < 3; j++)
+	{
+		warp.m[j] = (t[j] - slopeCenter * w[j]) / slopeHalf;
+		warp.m[3 + j] = a * w[j];
+		warp.m[6 + j] = w[j];
+	}
+	warp.m[5] += b;
+	return true;
+}
+
+// NOTE: LiSPSM's optimal distance from the projection center to the near side, n = (zn + sqrt(zn * zf)) / sin(gamma),
+// gamma being the angle between the view and light directions, as a fraction of the view depth range (0, i.e. no warp, when looking along the light)
+inline float LiSPSMApexRatio(float zn, float zf, float sinGamma)
+{
+	if (sinGamma < 1e-3f || zf <= zn)
+		return 0;
+	return (zn + std::sqrt(zn * zf)) / sinGamma / (zf - zn);
+}
+
+} // namespace ShadowWarp
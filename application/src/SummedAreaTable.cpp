@@ -0,0 +1,157 @@
+/*
+	Summed-area table builder test and benchmark (CPU fallback path of the moment shadow map SATs)
+
+	To compile:
+		g++ SummedAreaTable.cpp -std=c++11 -O2 -o SummedAreaTable
+
+	Usage:
+		SummedAreaTable [<number of random rectangles>]
+
+	Builds single precision tables over a synthetic 4 moment (z, z^2, z^3, z^4) shadow map, with and without
+	centering, compares box averages read from them against brute-force double precision averages and
+	reports build times for the moment map sizes the application can use.
+	Exits with a failure code if the centered tables exceed the error tolerance.
+*/
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#include "PoissonGenerator.h"
+#include "SummedAreaTable.h"
+
+#define DEFAULT_NUM_RECTANGLES 2000
+#define TEST_IMAGE_SIZE 512
+#define NUM_CHANNELS 4
+#define NUM_OCCLUDERS 64
+#define NUM_BENCHMARK_RUNS 5
+// NOTE: worst case is a 1 texel box far from the origin, where the error is the rounding of the table values;
+// uncentered tables of a 512x512 moment map do not meet it
+#define ERROR_TOLERANCE 1e-3
+
+//////////////////////////////////////////////////////////////////////////
+// synthetic shadow map (far plane with random rectangular occluders), stored as 4 moments per texel
+std::vector<float> createMomentMap(size_t size, PoissonGenerator::DefaultPRNG& generator)
+{
+	std::vector<float> depths(size * size, 1.0f);
+	for (auto n = 0; n < NUM_OCCLUDERS; n++)
+	{
+		auto x0 = (size_t)generator.RandomInt((int)size - 1), y0 = (size_t)generator.RandomInt((int)size - 1);
+		auto x1 = std::min(size - 1, x0 + (size_t)generator.RandomInt((int)size / 4)), y1 = std::min(size - 1, y0 + (size_t)generator.RandomInt((int)size / 4));
+		auto depth = 0.1f + 0.8f * generator.RandomFloat();
+		for (auto y = y0; y <= y1; y++)
+			for (auto x = x0; x <= x1; x++)
+				depths[y * size + x] = std::min(depths[y * size + x], depth);
+	}
+	std::vector<float> moments(size * size * NUM_CHANNELS);
+	for (size_t i = 0; i < depths.size(); i++)
+	{
+		float z = depths[i], z2 = z * z;
+		moments[i * NUM_CHANNELS] = z;
+		moments[i * NUM_CHANNELS + 1] = z2;
+		moments[i * NUM_CHANNELS + 2] = z2 * z;
+		moments[i * NUM_CHANNELS + 3] = z2 * z2;
+	}
+	return moments;
+}
+
+//////////////////////////////////////////////////////////////////////////
+std::vector<float> average(const std::vector<float>& image, size_t size)
+{
+	std::vector<double> sums(NUM_CHANNELS, 0);
+	for (size_t i = 0; i < size * size; i++)
+		for (size_t c = 0; c < NUM_CHANNELS; c++)
+			sums[c] += image[i * NUM_CHANNELS + c];
+	std::vector<float> mean(NUM_CHANNELS);
+	for (size_t c = 0; c < NUM_CHANNELS; c++)
+		mean[c] = (float)(sums[c] / (size * size));
+	return mean;
+}
+
+struct ErrorReport
+{
+	double maxError;
+	double meanError;
+
+};
+
+//////////////////////////////////////////////////////////////////////////
+ErrorReport measureBoxError(const std::vector<float>& image, const std::vector<float>& table, const std::vector<float>& offset, size_t size, size_t numRectangles, PoissonGenerator::DefaultPRNG& generator)
+{
+	ErrorReport report = { 0, 0 };
+	for (size_t n = 0; n < numRectangles; n++)
+	{
+		auto x0 = (size_t)generator.RandomInt((int)size - 1), y0 = (size_t)generator.RandomInt((int)size - 1);
+		auto x1 = x0 + (size_t)generator.RandomInt((int)(size - 1 - x0)), y1 = y0 + (size_t)generator.RandomInt((int)(size - 1 - y0));
+		double area = (double)(x1 - x0 + 1) * (y1 - y0 + 1);
+		for (size_t c = 0; c < NUM_CHANNELS; c++)
+		{
+			double expected = 0;
+			for (auto y = y0; y <= y1; y++)
+				for (auto x = x0; x <= x1; x++)
+					expected += image[(y * size + x) * NUM_CHANNELS + c];
+			expected /= area;
+			double actual = SummedAreaTable::BoxSum(&table[0], size, NUM_CHANNELS, c, x0, y0, x1, y1) / area + offset[c];
+			auto error = std::abs(actual - expected);
+			report.maxError = std::max(report.maxError, error);
+			report.meanError += error;
+		}
+	}
+	report.meanError /= numRectangles * NUM_CHANNELS;
+	return report;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	size_t numRectangles = (argc >= 2) ? (size_t)std::atoi(argv[1]) : DEFAULT_NUM_RECTANGLES;
+	if (numRectangles == 0)
+	{
+		std::cout << "invalid number of rectangles" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	PoissonGenerator::DefaultPRNG generator;
+	auto image = createMomentMap(TEST_IMAGE_SIZE, generator);
+	std::vector<float> zero(NUM_CHANNELS, 0);
+	auto mean = average(image, TEST_IMAGE_SIZE);
+
+	std::cout << "box average error over " << numRectangles << " random rectangles (" << TEST_IMAGE_SIZE << "x" << TEST_IMAGE_SIZE << ", " << NUM_CHANNELS << " moments)" << std::endl;
+	std::cout << std::setw(12) << "table" << std::setw(14) << "max" << std::setw(14) << "mean" << std::endl;
+	std::cout << std::scientific << std::setprecision(3);
+	auto uncentered = measureBoxError(image, SummedAreaTable::Build(image, TEST_IMAGE_SIZE, TEST_IMAGE_SIZE, NUM_CHANNELS, zero), zero, TEST_IMAGE_SIZE, numRectangles, generator);
+	std::cout << std::setw(12) << "uncentered" << std::setw(14) << uncentered.maxError << std::setw(14) << uncentered.meanError << std::endl;
+	auto centered = measureBoxError(image, SummedAreaTable::Build(image, TEST_IMAGE_SIZE, TEST_IMAGE_SIZE, NUM_CHANNELS, mean), mean, TEST_IMAGE_SIZE, numRectangles, generator);
+	std::cout << std::setw(12) << "centered" << std::setw(14) << centered.maxError << std::setw(14) << centered.meanError << std::endl << std::endl;
+
+	std::cout << "build time (" << NUM_CHANNELS << " channels, best of " << NUM_BENCHMARK_RUNS << " runs)" << std::endl;
+	std::cout << std::setw(12) << "size" << std::setw(14) << "ms" << std::setw(14) << "Mtexels/s" << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	for (size_t size = 256; size <= 2048; size *= 2)
+	{
+		auto source = createMomentMap(size, generator);
+		auto offset = average(source, size);
+		std::vector<float> table(source.size());
+		double best = 1e30;
+		for (auto run = 0; run < NUM_BENCHMARK_RUNS; run++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			SummedAreaTable::Build(&source[0], size, size, NUM_CHANNELS, &offset[0], &table[0]);
+			auto end = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		std::cout << std::setw(12) << size << std::setw(14) << best << std::setw(14) << (size * size) / (best * 1000.0) << std::endl;
+	}
+
+	if (centered.maxError > ERROR_TOLERANCE)
+	{
+		std::cout << std::endl << "FAILED: centered table error above tolerance (" << std::scientific << ERROR_TOLERANCE << ")" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << std::endl << "PASSED" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// Summed-area tables
+// F. Crow, "Summed-area tables for texture mapping", 1984
+
+namespace SummedAreaTable
+{
+
+// builds an inclusive summed-area table of a width x height image with numChannels interleaved channels, laid out row by row:
+// table(x, y) = sum of (source(i, j) - offset) for i <= x, j <= y
+// NOTE: subtracting an offset close to the image average (e.g., the average itself) keeps the sums centered around 0,
+// which is what makes single precision tables usable at all
+template <typename T>
+void Build(const T* source, size_t width, size_t height, size_t numChannels, const T* offset, T* table)
+{
+	// NOTE: running sums are kept in double precision, only the stored values are rounded
+	std::vector<double> columnSums(width * numChannels, 0);
+	std::vector<double> rowSums(numChannels);
+	for (size_t y = 0; y < height; y++)
+	{
+		for (size_t c = 0; c < numChannels; c++)
+			rowSums[c] = 0;
+		for (size_t x = 0; x < width; x++)
+		{
+			auto i = (y * width + x) * numChannels;
+			for (size_t c = 0; c < numChannels; c++)
+			{
+				rowSums[c] += (double)source[i + c] - (double)offset[c];
+				columnSums[x * numChannels + c] += rowSums[c];
+				table[i + c] = (T)columnSums[x * numChannels + c];
+			}
+		}
+	}
+}
+
+template <typename T>
+std::vector<T> Build(const std::vector<T>& source, size_t width, size_t height, size_t numChannels, const std::vector<T>& offset)
+{
+	std::vector<T> table(source.size());
+	Build(&source[0], width, height, numChannels, &offset[0], &table[0]);
+	return table;
+}
+
+// sum of (source - offset) over the inclusive texel rectangle [x0, x1] x [y0, y1], from 4 reads
+template <typename T>
+double BoxSum(const T* table, size_t width, size_t numChannels, size_t channel, size_t x0, size_t y0, size_t x1, size_t y1)
+{
+	auto at = [&](size_t x, size_t y) { return (double)table[(y * width + x) * numChannels + channel]; };
+	double sum = at(x1, y1);
+	if (x0 > 0)
+		sum -= at(x0 - 1, y1);
+	if (y0 > 0)
+		sum -= at(x1, y0 - 1);
+	if (x0 > 0 && y0 > 0)
+		sum += at(x0 - 1, y0 - 1);
+	return sum;
+}
+
+} // namespace SummedAreaTable
@@ -0,0 +1,144 @@
+/*
+	PCSS parameter tuner test (CPU side of the automatic tuning)
+
+	To compile:
+		g++ Tuner.cpp -std=c++11 -O2 -o Tuner
+
+	Usage:
+		Tuner [<number of path keys>]
+
+	Checks the candidate grid, the image error and subsampling, that the Pareto front keeps only the settings no other one
+	beats in both time and error and that budgets select from it, that the config file reads back the settings written for
+	each budget, then runs a tuning session over a synthetic renderer (time and noise set by the sample counts) and checks
+	that the measured results match it.
+*/
+
+#include <vector>
+#include <iostream>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Tuner.h"
+#include "Check.h"
+
+#define DEFAULT_NUM_KEYS 32
+#define IMAGE_WIDTH 64
+#define IMAGE_HEIGHT 48
+#define WARM_UP_FRAMES 4
+#define CONFIG_FILENAME "tuner_test.cfg"
+#define EPSILON 1e-4f
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: a key's image, with noise that shrinks with the PCF sample count (none at the reference's)
+std::vector<unsigned char> render(const Tuner::Settings& settings, size_t key, std::mt19937& generator)
+{
+	std::uniform_int_distribution<int> noiseDistribution(-64, 64);
+	std::vector<unsigned char> image(IMAGE_WIDTH * IMAGE_HEIGHT * 3);
+	for (size_t i = 0; i < image.size(); i++)
+	{
+		auto noise = noiseDistribution(generator) * 4 / (int)settings.numPCFSamples;
+		image[i] = (unsigned char)std::min(255, std::max(0, (int)((i + key * 7) % 128) + 64 + noise));
+	}
+	return image;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NOTE: in ms
+float renderTime(const Tuner::Settings& settings)
+{
+	return 1 + 0.05f * settings.numBlockerSearchSamples + 0.1f * settings.numPCFSamples;
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	size_t numKeys = (argc >= 2) ? (size_t)std::atoi(argv[1]) : DEFAULT_NUM_KEYS;
+	if (numKeys == 0)
+	{
+		std::cout << "invalid number of path keys" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// grid
+	auto grid = Tuner::Grid({ 4, 8 }, { 4, 8, 16 }, { 64, 128 }, { 0.001f, 0.002f });
+	check(grid.size() == 24, "the grid has every combination");
+	check(grid[0].numBlockerSearchSamples == 4 && grid[0].numPCFSamples == 4 && grid[0].shadowMapBudget == 64 && grid[0].directionalLightShadowMapBias == 0.001f && grid[1].directionalLightShadowMapBias == 0.002f && grid[23].numBlockerSearchSamples == 8 && grid[23].numPCFSamples == 16, "the grid is in order, the last parameter varying the fastest");
+
+	// image error
+	std::vector<unsigned char> black(12, 0), white(12, 255), gray(12, 51);
+	check(Tuner::ImageError(gray, gray) == 0, "identical images have no error");
+	check(std::abs(Tuner::ImageError(black, white) - 1) < EPSILON && std::abs(Tuner::ImageError(black, gray) - 0.2f) < EPSILON, "the error is the RMS of the channel differences");
+	check(Tuner::ImageError(black, std::vector<unsigned char>(6, 0)) == 1 && Tuner::ImageError(std::vector<unsigned char>(), std::vector<unsigned char>()) == 1, "images of different sizes (or missing ones) have the max. error");
+
+	// subsampling
+	std::vector<unsigned char> image(5 * 3 * 3);
+	for (size_t i = 0; i < image.size(); i++)
+		image[i] = (unsigned char)i;
+	auto subsampled = Tuner::Subsample(image, 5, 3, 2);
+	check(subsampled.size() == 3 * 2 * 3, "subsampled images keep every n-th pixel in each direction (partial blocks included)");
+	check(subsampled[0] == image[0] && subsampled[3] == image[2 * 3] && subsampled[9] == image[(2 * 5) * 3] && subsampled[17] == image[(2 * 5 + 4) * 3 + 2], "subsampled pixels are copied, not filtered (so that noise still counts as error)");
+	check(Tuner::Subsample(image, 5, 3, 1) == image && Tuner::Subsample(image, 4, 3, 2) == image, "images are kept as is with no subsampling or a mismatched size");
+
+	// Pareto front
+	std::vector<Tuner::Result> results =
+	{
+		{ grid[0], 3, 0.2f },
+		{ grid[1], 1, 0.5f },
+		{ grid[2], 2, 0.6f },
+		{ grid[3], 5, 0.1f },
+		{ grid[4], 4, 0.1f },
+		{ grid[5], 2, 0.3f }
+	};
+	auto front = Tuner::ParetoFront(results);
+	check(front.size() == 4 && front[0].time == 1 && front[1].time == 2 && front[1].error == 0.3f && front[2].time == 3 && front[3].time == 4, "the front keeps the non-dominated results by increasing time");
+	check(Tuner::Select(front, 3.5f).time == 3 && Tuner::Select(front, 100).time == 4, "budgets select the lowest error within them");
+	check(Tuner::Select(front, 0.5f).time == 1, "budgets no result fits select the fastest one");
+
+	// config file
+	check(Tuner::Write(CONFIG_FILENAME, front, { 0.5f, 1, 2.5f, 3, 16.7f }), "the config file is written");
+	Tuner::Settings settings;
+	auto same = [](const Tuner::Settings& a, const Tuner::Settings& b) { return a.numBlockerSearchSamples == b.numBlockerSearchSamples && a.numPCFSamples == b.numPCFSamples && a.shadowMapBudget == b.shadowMapBudget && a.directionalLightShadowMapBias == b.directionalLightShadowMapBias; };
+	check(Tuner::Read(CONFIG_FILENAME, 3.2f, settings) && same(settings, Tuner::Select(front, 3.2f).settings), "the config file reads back the setting of the largest budget within the target");
+	check(Tuner::Read(CONFIG_FILENAME, 0.1f, settings) && same(settings, front[0].settings), "targets below every budget read back the smallest budget's setting");
+	std::remove(CONFIG_FILENAME);
+	check(!Tuner::Read(CONFIG_FILENAME, 16.7f, settings), "missing config files have no settings");
+
+	// session
+	auto candidates = Tuner::Grid({ 4, 16 }, { 4, 16, 64 }, { 128 }, { 0.001f });
+	Tuner::Settings reference{ 128, 128, 128, 0.001f };
+	Tuner::Session session(candidates, reference, numKeys, WARM_UP_FRAMES);
+	std::mt19937 generator(1);
+	auto keysInOrder = true, warmUpAtFirstKey = true;
+	size_t numFrames = 0, measuredKey = 0;
+	while (!session.isFinished())
+	{
+		auto& frameSettings = session.getSettings();
+		auto key = session.getKey();
+		if (session.isMeasuring())
+			keysInOrder &= key == measuredKey++ % numKeys;
+		else
+			warmUpAtFirstKey &= key == 0;
+		session.advance(renderTime(frameSettings), (session.isMeasuring()) ? render(frameSettings, key, generator) : std::vector<unsigned char>());
+		numFrames++;
+	}
+	check(numFrames == (candidates.size() + 1) * (numKeys + WARM_UP_FRAMES), "the reference and every candidate are rendered along the whole path, after their warm-up frames");
+	check(keysInOrder && warmUpAtFirstKey, "warm-up frames stay at the first key, measured frames go through the path in order");
+	check(session.getResults().size() == candidates.size() && std::abs(session.getProgress() - 1) < EPSILON, "every candidate has a result once finished");
+	auto timesMatch = true, errorsDecrease = true;
+	for (size_t i = 0; i < session.getResults().size(); i++)
+	{
+		auto& result = session.getResults()[i];
+		timesMatch &= same(result.settings, candidates[i]) && std::abs(result.time - renderTime(candidates[i])) < EPSILON;
+		if (i > 0 && candidates[i].numPCFSamples > candidates[i - 1].numPCFSamples)
+			errorsDecrease &= result.error < session.getResults()[i - 1].error;
+	}
+	check(timesMatch, "measured times are the average of the frame times");
+	check(errorsDecrease, "measured errors shrink with the PCF sample count");
+	auto sessionFront = Tuner::ParetoFront(session.getResults());
+	std::cout << std::endl << numKeys << " path keys, " << numFrames << " frames: " << sessionFront.size() << " Pareto-optimal settings out of " << candidates.size() << std::endl;
+	for (auto& result : sessionFront)
+		std::cout << "  " << result.settings.numBlockerSearchSamples << " blocker search / " << result.settings.numPCFSamples << " PCF samples: " << result.time << " ms, error " << result.error << std::endl;
+
+	return checkResults();
+}
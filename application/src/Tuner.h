@@ -0,0 +1,237 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// Automatic PCSS parameter tuning (no GL calls, rendering, timing and read backs are left to the caller)
+// Every candidate setting is rendered along a recorded camera path, its GPU time is averaged and its image is compared to the one
+// rendered with a high sample reference setting; the settings no other one beats in both time and error (i.e., the Pareto front)
+// are written out as the best choice for a list of frame budgets
+
+namespace Tuner
+{
+
+struct Settings
+{
+	size_t numBlockerSearchSamples;
+	size_t numPCFSamples;
+	// NOTE: shadow map memory budget in MB (resolutions are assigned from it)
+	float shadowMapBudget;
+	float directionalLightShadowMapBias;
+
+};
+
+struct Result
+{
+	Settings settings;
+	// NOTE: average GPU time in ms
+	float time;
+	// NOTE: average RMS error against the reference (0-1)
+	float error;
+
+};
+
+// NOTE: every combination, in order
+inline std::vector<Settings> Grid(const std::vector<size_t>& numBlockerSearchSamples, const std::vector<size_t>& numPCFSamples, const std::vector<float>& shadowMapBudgets, const std::vector<float>& biases)
+{
+	std::vector<Settings> grid;
+	for (auto blockerSearchSamples : numBlockerSearchSamples)
+		for (auto pcfSamples : numPCFSamples)
+			for (auto shadowMapBudget : shadowMapBudgets)
+				for (auto bias : biases)
+					grid.emplace_back(Settings{ blockerSearchSamples, pcfSamples, shadowMapBudget, bias });
+	return grid;
+}
+
+// NOTE: root mean square of the channel differences of two 8-bit images of the same size
+inline float ImageError(const std::vector<unsigned char>& image, const std::vector<unsigned char>& reference)
+{
+	if (image.empty() || image.size() != reference.size())
+		return 1;
+	double sum = 0;
+	for (size_t i = 0; i < image.size(); i++)
+	{
+		auto difference = (image[i] - (int)reference[i]) / 255.0;
+		sum += difference * difference;
+	}
+	return (float)std::sqrt(sum / image.size());
+}
+
+// NOTE: every factor-th pixel of an 8-bit RGB image in each direction (point sampled rather than filtered, so that sampling noise
+// still counts as error), used to keep the references of long paths small
+inline std::vector<unsigned char> Subsample(const std::vector<unsigned char>& image, size_t width, size_t height, size_t factor)
+{
+	if (factor <= 1 || image.size() != width * height * 3)
+		return image;
+	auto subsampledWidth = (width + factor - 1) / factor, subsampledHeight = (height + factor - 1) / factor;
+	std::vector<unsigned char> subsampled(subsampledWidth * subsampledHeight * 3);
+	for (size_t y = 0; y < subsampledHeight; y++)
+		for (size_t x = 0; x < subsampledWidth; x++)
+			std::copy_n(&image[(y * factor * width + x * factor) * 3], 3, &subsampled[(y * subsampledWidth + x) * 3]);
+	return subsampled;
+}
+
+// NOTE: by increasing time (and so decreasing error)
+inline std::vector<Result> ParetoFront(std::vector<Result> results)
+{
+	std::stable_sort(results.begin(), results.end(), [](const Result& a, const Result& b) { return a.time < b.time || (a.time == b.time && a.error < b.error); });
+	std::vector<Result> front;
+	for (auto& result : results)
+		if (front.empty() || result.error < front.back().error)
+			front.push_back(result);
+	return front;
+}
+
+// NOTE: lowest error within the budget, the fastest setting if none fits
+inline const Result& Select(const std::vector<Result>& front, float budget)
+{
+	size_t selected = 0;
+	for (size_t i = 0; i < front.size(); i++)
+		if (front[i].time <= budget)
+			selected = i;
+	return front[selected];
+}
+
+// one line per frame budget: <budget (ms)> <# blocker search samples> <# PCF samples> <shadow map budget (MB)> <bias> <time (ms)> <error>,
+// budgets that select the same setting as a smaller one are skipped
+inline bool Write(const std::string& filename, const std::vector<Result>& front, const std::vector<float>& budgets)
+{
+	if (front.empty())
+		return false;
+	std::ofstream out(filename);
+	if (!out.good())
+		return false;
+	out << "# frame budget (ms), # blocker search samples, # PCF samples, shadow map budget (MB), directional light shadow map bias, measured time (ms), error (RMS)" << std::endl;
+	const Result* previous = nullptr;
+	for (auto budget : budgets)
+	{
+		auto& result = Select(front, budget);
+		if (&result == previous)
+			continue;
+		out << budget << " " << result.settings.numBlockerSearchSamples << " " << result.settings.numPCFSamples << " " << result.settings.shadowMapBudget << " "
+			<< result.settings.directionalLightShadowMapBias << " " << result.time << " " << result.error << std::endl;
+		previous = &result;
+	}
+	return out.good();
+}
+
+// NOTE: settings of the largest budget within targetTime (the smallest budget if none is), false if the file has none
+inline bool Read(const std::string& filename, float targetTime, Settings& settings)
+{
+	std::ifstream in(filename);
+	std::string line;
+	bool found = false;
+	float selectedBudget = 0;
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream fields(line);
+		float budget;
+		Settings candidate;
+		if (!(fields >> budget >> candidate.numBlockerSearchSamples >> candidate.numPCFSamples >> candidate.shadowMapBudget >> candidate.directionalLightShadowMapBias))
+			continue;
+		auto fits = budget <= targetTime, selectedFits = selectedBudget <= targetTime;
+		if (!found || (fits && (!selectedFits || budget > selectedBudget)) || (!fits && !selectedFits && budget < selectedBudget))
+		{
+			settings = candidate;
+			selectedBudget = budget;
+			found = true;
+		}
+	}
+	return found;
+}
+
+// renders the reference first and then every candidate along the whole path, each pass starting with a few warm-up frames
+// at the first key (so that lagging timer queries and cached shadow maps settle) that aren't measured;
+// the reference images of every key are kept, so their number and size are up to the caller
+struct Session
+{
+	Session(const std::vector<Settings>& candidates, const Settings& reference, size_t numKeys, size_t numWarmUpFrames) :
+		candidates(candidates),
+		reference(reference),
+		numKeys(numKeys),
+		numWarmUpFrames(numWarmUpFrames),
+		pass(0),
+		frame(0),
+		totalTime(0),
+		totalError(0)
+	{
+	}
+
+	bool isFinished() const
+	{
+		return numKeys == 0 || pass > candidates.size();
+	}
+
+	// NOTE: settings and path key to render the current frame with
+	const Settings& getSettings() const
+	{
+		return (pass == 0) ? reference : candidates[pass - 1];
+	}
+
+	size_t getKey() const
+	{
+		return (frame < numWarmUpFrames) ? 0 : frame - numWarmUpFrames;
+	}
+
+	bool isMeasuring() const
+	{
+		return frame >= numWarmUpFrames;
+	}
+
+	// NOTE: fraction of the frames rendered
+	float getProgress() const
+	{
+		return (pass * (numWarmUpFrames + numKeys) + frame) / (float)((candidates.size() + 1) * (numWarmUpFrames + numKeys));
+	}
+
+	// NOTE: time (of this frame alone, not smoothed) and image of the frame rendered with getSettings() at getKey()
+	void advance(float time, const std::vector<unsigned char>& image)
+	{
+		if (isFinished())
+			return;
+		if (isMeasuring())
+		{
+			if (pass == 0)
+				references.push_back(image);
+			else
+			{
+				totalTime += time;
+				totalError += ImageError(image, references[getKey()]);
+			}
+		}
+		if (++frame < numWarmUpFrames + numKeys)
+			return;
+		if (pass > 0)
+			results.emplace_back(Result{ candidates[pass - 1], totalTime / numKeys, totalError / numKeys });
+		pass++;
+		frame = 0;
+		totalTime = totalError = 0;
+	}
+
+	const std::vector<Result>& getResults() const
+	{
+		return results;
+	}
+
+private:
+	std::vector<Settings> candidates;
+	Settings reference;
+	size_t numKeys;
+	size_t numWarmUpFrames;
+	size_t pass;
+	size_t frame;
+	float totalTime;
+	float totalError;
+	std::vector<std::vector<unsigned char>> references;
+	std::vector<Result> results;
+
+};
+
+} // namespace Tuner
@@ -0,0 +1,105 @@
+/*
+	Virtual shadow map page table test (CPU side of the virtual shadow map mode)
+
+	To compile:
+		g++ VirtualShadowMap.cpp -std=c++11 -O2 -o VirtualShadowMap
+
+	Usage:
+		VirtualShadowMap [<number of frames>]
+
+	Checks residency, caching across frames, LRU eviction, pool exhaustion and invalidation of the page table
+	against the expected page counts, then simulates a camera panning over the virtual shadow map and reports
+	how many pages are rendered per frame.
+*/
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+#include "VirtualShadowMap.h"
+#include "Check.h"
+
+#define VIRTUAL_PAGES_PER_SIDE 128
+#define PHYSICAL_PAGES_PER_SIDE 16
+#define DEFAULT_NUM_FRAMES 256
+// NOTE: in pages
+#define VIEW_SIZE 8
+
+//////////////////////////////////////////////////////////////////////////
+void requestView(VirtualShadowMap::PageTable& pageTable, size_t x0, size_t y0, size_t size)
+{
+	for (auto y = y0; y < y0 + size; y++)
+		for (auto x = x0; x < x0 + size; x++)
+			pageTable.request(x % VIRTUAL_PAGES_PER_SIDE, y % VIRTUAL_PAGES_PER_SIDE);
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	size_t numFrames = (argc >= 2) ? (size_t)std::atoi(argv[1]) : DEFAULT_NUM_FRAMES;
+	if (numFrames == 0)
+	{
+		std::cout << "invalid number of frames" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const size_t numUsablePages = PHYSICAL_PAGES_PER_SIDE * PHYSICAL_PAGES_PER_SIDE - 1;
+	VirtualShadowMap::PageTable pageTable(VIRTUAL_PAGES_PER_SIDE, PHYSICAL_PAGES_PER_SIDE);
+
+	// residency
+	pageTable.beginFrame();
+	requestView(pageTable, 0, 0, VIEW_SIZE);
+	pageTable.request(0, 0);
+	auto mappings = pageTable.update();
+	check(mappings.size() == VIEW_SIZE * VIEW_SIZE, "requested pages are mapped once");
+	check(pageTable.getNumResidentPages() == VIEW_SIZE * VIEW_SIZE, "requested pages are resident");
+	bool usesClearedPage = false;
+	for (auto& mapping : mappings)
+		usesClearedPage |= (mapping.physicalPage == 0);
+	check(!usesClearedPage, "cleared page is never mapped");
+	check(pageTable.getPhysicalPage(VIEW_SIZE, VIEW_SIZE) == 0, "non-resident pages read the cleared page");
+
+	// caching
+	pageTable.beginFrame();
+	requestView(pageTable, 1, 1, 1);
+	check(pageTable.update().empty(), "resident pages are not rendered again");
+	auto physicalPage = pageTable.getPhysicalPage(1, 1);
+
+	// LRU eviction (the pool overflows by 5 pages, which are taken from the pages not used since the first frame)
+	pageTable.beginFrame();
+	requestView(pageTable, VIEW_SIZE, 0, 14);
+	mappings = pageTable.update();
+	check(mappings.size() == 14 * 14 && pageTable.getNumResidentPages() == numUsablePages, "pool is filled before evicting");
+	check(pageTable.getPhysicalPage(1, 1) == physicalPage, "least recently used pages are evicted first");
+
+	// pool exhaustion
+	pageTable.beginFrame();
+	requestView(pageTable, 32, 32, 17);
+	mappings = pageTable.update();
+	check(mappings.size() == numUsablePages && pageTable.getNumMissingPages() == 17 * 17 - numUsablePages, "pages requested in the same frame are not evicted");
+
+	// invalidation
+	pageTable.invalidate();
+	check(pageTable.getNumResidentPages() == 0 && pageTable.getPhysicalPage(32, 32) == 0, "invalidation drops every page");
+	pageTable.beginFrame();
+	requestView(pageTable, 32, 32, VIEW_SIZE);
+	check(pageTable.update().size() == VIEW_SIZE * VIEW_SIZE, "invalidated pages are rendered again");
+
+	// camera panning one page every 4 frames
+	pageTable.invalidate();
+	size_t numRenderedPages = 0, maxRenderedPages = 0;
+	for (size_t frame = 0; frame < numFrames; frame++)
+	{
+		pageTable.beginFrame();
+		requestView(pageTable, frame / 4, 0, VIEW_SIZE);
+		auto numNewPages = pageTable.update().size();
+		numRenderedPages += numNewPages;
+		maxRenderedPages = std::max(maxRenderedPages, numNewPages);
+	}
+	std::cout << std::endl << "panning over " << numFrames << " frames (" << VIEW_SIZE << "x" << VIEW_SIZE << " visible pages): "
+		<< numRenderedPages / (double)numFrames << " rendered pages per frame on average, " << maxRenderedPages << " at most" << std::endl;
+	check(maxRenderedPages == VIEW_SIZE * VIEW_SIZE, "only the first frame renders every visible page");
+
+	return checkResults();
+}
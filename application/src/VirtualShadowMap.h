@@ -0,0 +1,159 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Virtual shadow maps: page table and physical page pool (no GL calls, rendering and uploads are left to the caller)
+// A virtual shadow map of virtualPagesPerSide^2 pages is backed by a pool of physicalPagesPerSide^2 physical pages,
+// pages requested in a frame are mapped (evicting the least recently used ones) and stay resident until evicted or invalidated
+
+#define NON_RESIDENT_PAGE -1
+
+namespace VirtualShadowMap
+{
+
+struct Mapping
+{
+	size_t virtualPage;
+	size_t physicalPage;
+
+};
+
+struct PageTable
+{
+	// NOTE: physical page 0 is never mapped, it's kept cleared (i.e., at the far plane) so that lookups into non-resident pages are lit
+	PageTable(size_t virtualPagesPerSide, size_t physicalPagesPerSide) :
+		virtualPagesPerSide(virtualPagesPerSide),
+		physicalPagesPerSide(physicalPagesPerSide),
+		frame(0),
+		numMissingPages(0),
+		physicalPages(virtualPagesPerSide * virtualPagesPerSide, NON_RESIDENT_PAGE),
+		requestFrames(virtualPagesPerSide * virtualPagesPerSide, 0),
+		virtualPages(physicalPagesPerSide * physicalPagesPerSide, (size_t)NON_RESIDENT_PAGE),
+		lastUsedFrames(physicalPagesPerSide * physicalPagesPerSide, 0)
+	{
+	}
+
+	// NOTE: requests of the previous frame are dropped, resident pages are kept
+	void beginFrame()
+	{
+		frame++;
+		requests.clear();
+	}
+
+	// marks a virtual page as needed by this frame (repeated requests are ignored)
+	void request(size_t x, size_t y)
+	{
+		auto virtualPage = y * virtualPagesPerSide + x;
+		if (requestFrames[virtualPage] == frame)
+			return;
+		requestFrames[virtualPage] = frame;
+		requests.push_back(virtualPage);
+	}
+
+	// maps the requested pages that are not resident, returns the ones that have to be rendered
+	// NOTE: only pages not requested in this frame can be evicted, so when the pool is too small the remaining requests
+	// stay non-resident (see getNumMissingPages())
+	std::vector<Mapping> update()
+	{
+		std::vector<Mapping> newMappings;
+		numMissingPages = 0;
+		for (auto virtualPage : requests)
+		{
+			auto physicalPage = physicalPages[virtualPage];
+			if (physicalPage != NON_RESIDENT_PAGE)
+			{
+				lastUsedFrames[physicalPage] = frame;
+				continue;
+			}
+			auto slot = findLeastRecentlyUsed();
+			if (slot == 0)
+			{
+				numMissingPages++;
+				continue;
+			}
+			if (virtualPages[slot] != (size_t)NON_RESIDENT_PAGE)
+				physicalPages[virtualPages[slot]] = NON_RESIDENT_PAGE;
+			virtualPages[slot] = virtualPage;
+			physicalPages[virtualPage] = (int)slot;
+			lastUsedFrames[slot] = frame;
+			newMappings.emplace_back(Mapping{ virtualPage, slot });
+		}
+		return newMappings;
+	}
+
+	// NOTE: every page becomes non-resident (e.g., when the light moves)
+	void invalidate()
+	{
+		std::fill(physicalPages.begin(), physicalPages.end(), NON_RESIDENT_PAGE);
+		std::fill(virtualPages.begin(), virtualPages.end(), (size_t)NON_RESIDENT_PAGE);
+		std::fill(lastUsedFrames.begin(), lastUsedFrames.end(), 0);
+	}
+
+	// NOTE: physical page of a virtual page (0, the cleared page, if it's not resident)
+	size_t getPhysicalPage(size_t x, size_t y) const
+	{
+		auto physicalPage = physicalPages[y * virtualPagesPerSide + x];
+		return (physicalPage == NON_RESIDENT_PAGE) ? 0 : (size_t)physicalPage;
+	}
+
+	size_t getNumResidentPages() const
+	{
+		size_t numResidentPages = 0;
+		for (size_t i = 1; i < virtualPages.size(); i++)
+			if (virtualPages[i] != (size_t)NON_RESIDENT_PAGE)
+				numResidentPages++;
+		return numResidentPages;
+	}
+
+	size_t getNumMissingPages() const
+	{
+		return numMissingPages;
+	}
+
+	size_t getVirtualPagesPerSide() const
+	{
+		return virtualPagesPerSide;
+	}
+
+	size_t getPhysicalPagesPerSide() const
+	{
+		return physicalPagesPerSide;
+	}
+
+private:
+	size_t virtualPagesPerSide;
+	size_t physicalPagesPerSide;
+	uint64_t frame;
+	size_t numMissingPages;
+	std::vector<size_t> requests;
+	// NOTE: virtual page -> physical page (or NON_RESIDENT_PAGE)
+	std::vector<int> physicalPages;
+	std::vector<uint64_t> requestFrames;
+	// NOTE: physical page -> virtual page (or NON_RESIDENT_PAGE)
+	std::vector<size_t> virtualPages;
+	std::vector<uint64_t> lastUsedFrames;
+
+	// NOTE: free pages first (they were last used in frame 0), returns 0 if every page is used by this frame
+	size_t findLeastRecentlyUsed() const
+	{
+		size_t selected = 0;
+		uint64_t minFrame = frame;
+		for (size_t i = 1; i < lastUsedFrames.size(); i++)
+		{
+			if (virtualPages[i] == (size_t)NON_RESIDENT_PAGE)
+				return i;
+			if (lastUsedFrames[i] < minFrame)
+			{
+				minFrame = lastUsedFrames[i];
+				selected = i;
+			}
+		}
+		return selected;
+	}
+
+};
+
+} // namespace VirtualShadowMap
@@ -11,6 +11,8 @@
 #include <algorithm>
 #include <stdexcept>
 #include <sstream>
+#include <array>
+#include <random>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -28,16 +30,95 @@
 #include "LightSource.h"
 #include "Animations.h"
 #include "PoissonGenerator.h"
+#include "BlueNoiseGenerator.h"
+#include "GPUTimer.h"
+#include "SummedAreaTable.h"
+#include "ShadowAtlas.h"
+#include "VirtualShadowMap.h"
+#include "ShadowScheduler.h"
+#include "ClusteredLighting.h"
+#include "ShadowWarp.h"
+#include "DynamicResolution.h"
+#include "Tuner.h"
 
 #define SCREEN_WIDTH 1024
 #define SCREEN_HEIGHT 768
 #define SHADOW_MAP_SIZE 4096
+// NOTE: point lights are soft-shadowed, so their 6 faces get a quarter of the directional shadow map texels each
+#define SHADOW_CUBE_MAP_SIZE 2048
+#define DUAL_PARABOLOID_SHADOW_MAP_SIZE 2048
+#define SPOT_LIGHT_SHADOW_MAP_SIZE 2048
+// NOTE: the sizes above are max. resolutions, the budget manager goes down to this one
+#define MIN_SHADOW_MAP_SIZE 256
+// NOTE: directional, spot and dual-paraboloid shadow maps are packed into the atlas, cube maps keep their own textures
+// (both clamped to GL_MAX_TEXTURE_SIZE at startup)
+#define SHADOW_ATLAS_WIDTH 8192
+#define SHADOW_ATLAS_MAX_HEIGHT 8192
+// NOTE: the resolutions are only reassigned when a light's priority (i.e., its camera dependent screen coverage) changed by more
+// than this factor since the last assignment, so that navigating doesn't reallocate the atlas (and invalidate every cached map)
+#define SHADOW_BUDGET_HYSTERESIS 2.0f
+// NOTE: in MB
+#define DEFAULT_SHADOW_MAP_BUDGET 256.0f
+#define DEFAULT_TARGET_FRAME_TIME 16.7f
+#define TUNING_CONFIG_FILENAME "pcss_tuning.cfg"
+// NOTE: every TUNING_PATH_STRIDE-th frame of the recorded camera path is rendered with each candidate setting
+// (or a larger stride for long paths, so that at most TUNING_MAX_KEYS reference images are kept)
+#define TUNING_PATH_STRIDE 4
+#define TUNING_MAX_KEYS 64
+// NOTE: images are compared at a fraction of the window resolution (every n-th pixel in each direction)
+#define TUNING_IMAGE_SUBSAMPLING 4
+#define TUNING_WARM_UP_FRAMES 16
+#define TUNING_REFERENCE_SAMPLES 128
+// NOTE: virtual shadow maps (directional lights only) are split into pages, backed by a pool of physical pages that takes
+// the light's atlas tile
+#define VIRTUAL_SHADOW_MAP_SIZE 16384
+#define VIRTUAL_SHADOW_MAP_PAGE_SIZE 128
+#define VIRTUAL_SHADOW_MAP_POOL_SIZE 4096
+// NOTE: screen pixels per feedback texel (in each dimension)
+#define VIRTUAL_SHADOW_MAP_FEEDBACK_DOWNSAMPLING 4
+// NOTE: frames between rendering the feedback and using it (it's read back asynchronously, through a ring of pixel buffers)
+#define VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY 2
+// NOTE: in ms
+#define DEFAULT_SHADOW_UPDATE_BUDGET 2.0f
+// NOTE: initial estimate (in ms per million texels), refined with the measured shadow passes time
+#define DEFAULT_SHADOW_UPDATE_COST 0.05f
+#define SHADOW_UPDATE_COST_SMOOTHING 0.9f
+// NOTE: bit j stands for the face GL_TEXTURE_CUBE_MAP_POSITIVE_X + j
+#define ALL_CUBE_FACES 0x3f
+// NOTE: in degrees, cube face frusta are widened so that filter kernels crossing face edges still find the casters of empty faces' neighbours
+#define CUBE_FACE_MARGIN 10.0f
+// NOTE: irradiance below which point and spot lights stop contributing (see LightSourceAdapter::updateInfluenceRadius())
+#define DEFAULT_LIGHT_CUTOFF 0.05f
+#define CLUSTER_GRID_WIDTH 16
+#define CLUSTER_GRID_HEIGHT 9
+#define CLUSTER_GRID_DEPTH 24
+#define MAX_NUM_CLUSTERED_LIGHTS 1024
+#define DEFAULT_NUM_CLUSTERED_LIGHTS 256
+#define CLUSTERED_LIGHT_MIN_RADIUS 0.5f
+#define CLUSTERED_LIGHT_MAX_RADIUS 2.0f
+#define CLUSTERED_LIGHT_POWER 0.25f
+#define CLUSTERED_LIGHTS_SEED 42
+#define MOMENT_MAP_SIZE 1024
+// NOTE: log2(MOMENT_MAP_SIZE), the 1x1 level holds the average moments
+#define MOMENT_MAP_MAX_LEVEL 10
+#define MIN_MAX_MAP_SIZE 256
+// NOTE: log2(MIN_MAX_MAP_SIZE), the 1x1 level bounds the whole shadow map
+#define MIN_MAX_MAP_MAX_LEVEL 8
 #define MOVE_SPEED 5.0f
 #define DEFAULT_DIRECTIONAL_LIGHT_SHADOW_MAP_BIAS 0.005f
 #define DEFAULT_POINT_LIGHT_SHADOW_MAP_BIAS 0.0075f
+// NOTE: shadow LOD tiers, view distances (world units) where the mid and far tiers start and the width of the transitions around them
+#define DEFAULT_SHADOW_LOD_MID_DISTANCE 8.0f
+#define DEFAULT_SHADOW_LOD_FAR_DISTANCE 20.0f
+#define DEFAULT_SHADOW_LOD_TRANSITION 2.0f
+#define DEFAULT_SHADOW_LOD_MID_SAMPLE_SCALE 0.25f
 #define FOV 60.0f
+#define MIN_SPOT_LIGHT_PENUMBRA_ANGLE 1.0f
+#define MAX_SPOT_LIGHT_ANGLE 89.0f
 #define NEAR 0.1f
 #define FAR 100.0f
+// NOTE: view distance the directional light shadow map warp is fitted to (about the extent of the light's orthographic projection)
+#define SHADOW_WARP_FAR 20.0f
 #define DEFAULT_OBJ_TEX0_FILENAME "wood.png"
 #define DEFAULT_GROUND_TEX0_FILENAME "brick_floor.jpg"
 // NOTE: requires change in fragments shaders
@@ -45,6 +126,15 @@
 #define DEFAULT_NUM_SAMPLES 16
 #define MIN_NUM_SAMPLES 4
 #define MAX_NUM_SAMPLES 256
+#define BLOCKER_SEARCH_DISTRIBUTION 0
+#define PCF_DISTRIBUTION 1
+#define BLOCKER_SEARCH_QUAD_DISTRIBUTION 2
+#define PCF_QUAD_DISTRIBUTION 3
+#define NUM_DISTRIBUTIONS 4
+#define LIGHT_SOURCES_BINDING_POINT 0
+#define DISTRIBUTIONS_BINDING_POINT 1
+#define BLUE_NOISE_TEXTURE_FILENAME "blue_noise.bmp"
+#define BLUE_NOISE_TEXTURE_SIZE 64
 
 const std::string SHADERS_DIR("shaders/");
 const std::string MEDIA_DIR("media/");
@@ -55,10 +145,78 @@ enum DisplayMode
 	HARD_SHADOWS = 0,
 	SOFT_SHADOWS,
 	BLOCKER_SEARCH,
-	PENUMBRA_ESTIMATE
+	PENUMBRA_ESTIMATE,
+	MOMENT_SOFT_SHADOWS
 
 };
 
+enum PointLightShadows
+{
+	CUBE_MAPS = 0,
+	DUAL_PARABOLOIDS
+
+};
+
+// NOTE: every shadow map stores linear depth (orthographic depth or distance to the light over its far plane), so fixed point formats
+// have the same precision everywhere in their range
+enum ShadowMapFormat
+{
+	DEPTH16 = 0,
+	DEPTH24,
+	DEPTH32F
+
+};
+
+enum MomentFiltering
+{
+	MIPMAPS = 0,
+	GPU_SUMMED_AREA_TABLES,
+	CPU_SUMMED_AREA_TABLES
+
+};
+
+// NOTE: navigator state of a recorded frame
+struct CameraPathKey
+{
+	glm::vec3 position;
+	float phi;
+	float theta;
+
+};
+
+// NOTE: static casters are rendered once into a cached layer per light, dynamic ones are drawn on top of a copy of it every frame
+struct ShadowCaster
+{
+	Mesh* mesh;
+	glm::mat4 model;
+	bool isStatic;
+	// NOTE: world space
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+
+};
+
+// NOTE: everything a shadow pass depends on (besides its storage), the shadow map is only re-rendered when any of them changes
+struct ShadowPassInputs
+{
+	LightType type;
+	glm::vec3 position;
+	glm::vec3 direction;
+	float cosOuterAngle;
+	bool isVirtual;
+	// NOTE: identity unless the shadow map is warped (see getShadowWarp())
+	glm::mat4 warp;
+	// NOTE: model matrices
+	std::vector<glm::mat4> staticCasters;
+	std::vector<glm::mat4> dynamicCasters;
+
+};
+
+bool isSameLight(const ShadowPassInputs& a, const ShadowPassInputs& b)
+{
+	return a.type == b.type && a.position == b.position && a.direction == b.direction && a.cosOuterAngle == b.cosOuterAngle && a.isVirtual == b.isVirtual && a.warp == b.warp;
+}
+
 struct ShadowMap
 {
 	size_t index;
@@ -70,6 +228,29 @@ struct ShadowMap
 	bool hasCubeMap;
 	GLuint cubeMap;
 	GLint cubeMapLocation;
+	GLint comparisonTextureLocation;
+	// NOTE: assigned by the budget manager (0 until then), texels per face
+	size_t resolution;
+	// NOTE: atlas tile (2D shadow maps only)
+	ShadowAtlas::Rect atlasRect;
+	// NOTE: directional lights in virtual shadow map mode only, created on demand
+	std::unique_ptr<VirtualShadowMap::PageTable> pageTable;
+	// NOTE: false until rendered, and again whenever its storage is (re)assigned
+	bool isValid;
+	ShadowPassInputs inputs;
+	// NOTE: directional lights only, warp the shadow map was rendered with
+	glm::mat4 warp;
+	// NOTE: point lights with cube maps only (the static layers of atlas tiles are in the static atlas)
+	GLuint staticCubeMap;
+	bool isStaticLayerValid;
+	// NOTE: frames deferred by the scheduler since the shadow map became dirty
+	size_t age;
+	// NOTE: cube maps only, faces without casters (skipped when rendering and short-circuited when shading)
+	int emptyCubeFaces;
+	// NOTE: model matrices of the casters inside each face, when it was last rendered
+	std::vector<glm::mat4> cubeFaceCasters[6];
+	// NOTE: priority its resolution was assigned with (see updateShadowMapBudget())
+	float budgetPriority;
 
 };
 
@@ -81,6 +262,9 @@ TwType g_vec3Type;
 TwType g_vec4Type;
 TwType g_lightType;
 TwType g_displayModeType;
+TwType g_momentFilteringType;
+TwType g_pointLightShadowsType;
+TwType g_shadowMapFormatType;
 LightType g_selectedLightType = DIRECTIONAL;
 size_t g_selectedLightSource = 0;
 std::vector<std::unique_ptr<LightSourceAdapter>> g_lightSources;
@@ -93,20 +277,163 @@ glm::vec3 g_ambientColor = glm::vec3(0.1f, 0.1f, 0.1f);
 glm::vec3 g_specularColor = glm::vec3(1, 1, 1);
 float g_specularity = 30;
 GLuint g_framebuffer = 0;
+GLuint g_momentFramebuffer = 0;
+GLuint g_momentBlurTexture = 0;
+// NOTE: one layer per light source, allocated on demand (i.e., when moment soft shadows are displayed)
+bool g_hasMomentMaps = false;
+GLuint g_momentMaps = 0;
+size_t g_numMomentMapLayers = 0;
+// NOTE: same layers as the moment maps
+GLuint g_summedAreaTables = 0;
+bool g_minMaxShadowMaps = false;
+// NOTE: one layer per light source, allocated on demand (i.e., when min/max shadow maps are enabled)
+bool g_hasMinMaxMaps = false;
+GLuint g_minMaxMaps = 0;
+size_t g_numMinMaxMapLayers = 0;
+GLuint g_minMaxFramebuffer = 0;
+float g_minMaxPassesTime = 0;
 float g_directionalLightShadowMapBias = DEFAULT_DIRECTIONAL_LIGHT_SHADOW_MAP_BIAS;
 float g_pointLightShadowMapBias = DEFAULT_POINT_LIGHT_SHADOW_MAP_BIAS;
 bool g_drawShadowMap = false;
 size_t g_shadowMapIndex = 0;
 size_t g_numBlockerSearchSamples = DEFAULT_NUM_SAMPLES;
 size_t g_numPCFSamples = DEFAULT_NUM_SAMPLES;
+bool g_shadowLOD = false;
+float g_shadowLODMidDistance = DEFAULT_SHADOW_LOD_MID_DISTANCE;
+float g_shadowLODFarDistance = DEFAULT_SHADOW_LOD_FAR_DISTANCE;
+float g_shadowLODTransition = DEFAULT_SHADOW_LOD_TRANSITION;
+float g_shadowLODMidSampleScale = DEFAULT_SHADOW_LOD_MID_SAMPLE_SCALE;
+bool g_shadowLODFilteredTap = true;
+// NOTE: receivers seen at grazing angles count as farther (screen-space derivatives of their position)
+bool g_shadowLODFootprint = false;
 int g_screenWidth = SCREEN_WIDTH, g_screenHeight = SCREEN_HEIGHT;
+// NOTE: internal resolution of the camera passes, upscaled to the window when smaller (see DynamicResolution)
+int g_renderWidth = SCREEN_WIDTH, g_renderHeight = SCREEN_HEIGHT;
+bool g_dynamicResolution = false;
+float g_targetFrameTime = DEFAULT_TARGET_FRAME_TIME;
+int g_qualityLevel = 0;
+float g_renderScale = 1;
+float g_shadowMapScale = 1;
+float g_sampleScale = 1;
+float g_frameTime = 0;
+GLuint g_sceneFramebuffer = 0;
+GLuint g_sceneTexture = 0;
+GLuint g_sceneDepthBuffer = 0;
+int g_sceneWidth = 0, g_sceneHeight = 0;
+// NOTE: sample counts the distributions were generated for (the settings scaled by the dynamic resolution controller)
+size_t g_numActiveBlockerSearchSamples = 0;
+size_t g_numActivePCFSamples = 0;
 float g_aspectRatio = SCREEN_WIDTH / (float)SCREEN_HEIGHT;
 float g_frustumSize = 1;
-GLuint g_distributions[2] = { 0, 0 };
+GLuint g_distributionsUniformBuffer = 0;
+GLuint g_blueNoise = 0;
+bool g_rotateSamples = true;
+bool g_useTextureGather = false;
+GLuint g_comparisonSampler = 0;
+float g_shadowPassesTime = 0;
+float g_forwardPassTime = 0;
+float g_momentPassesTime = 0;
 DisplayMode g_displayMode = DisplayMode::HARD_SHADOWS;
+MomentFiltering g_momentFiltering = MomentFiltering::MIPMAPS;
+PointLightShadows g_pointLightShadows = PointLightShadows::CUBE_MAPS;
+ShadowMapFormat g_shadowMapFormat = ShadowMapFormat::DEPTH24;
+// NOTE: format the atlas and the cube maps were allocated with
+GLenum g_shadowMapInternalFormat = 0;
+bool g_reverseZ = false;
+bool g_hasClipControl = false;
+int g_shadowDrawCalls = 0;
+float g_shadowMapMemory = 0;
+float g_peakShadowMapMemory = 0;
+float g_shadowMapBudget = DEFAULT_SHADOW_MAP_BUDGET;
+GLuint g_shadowAtlas = 0;
+size_t g_shadowAtlasHeight = 0;
+bool g_splitStaticCasters = true;
+// NOTE: static layers, same layout as the shadow atlas (allocated only while static casters are split)
+bool g_hasStaticLayers = false;
+GLuint g_staticShadowAtlas = 0;
+GLuint g_staticFramebuffer = 0;
+int g_numDynamicCasters = 0;
+bool g_multiPassShadows = false;
+bool g_warpShadowMaps = false;
+// NOTE: scales LiSPSM's optimal projection center distance (larger values weaken the warp)
+float g_shadowWarpFactor = 1;
+// NOTE: set while every tile of the atlas starts at the origin (i.e., the atlas is a single shadow map shared by every light)
+bool g_hasSharedShadowMap = false;
+// NOTE: HDR target the multi-pass forward pass adds every light into, allocated on demand
+GLuint g_accumulationFramebuffer = 0;
+GLuint g_accumulationTexture = 0;
+GLuint g_accumulationDepthBuffer = 0;
+int g_accumulationWidth = 0, g_accumulationHeight = 0;
+int g_numLightPasses = 0;
+bool g_shadowMasks = false;
+// NOTE: shadow factors of lights 0-3 and 4-7 (RGBA8) written by the shadow mask pass, allocated on demand
+GLuint g_shadowMaskFramebuffer = 0;
+GLuint g_shadowMaskTextures[2] = { 0, 0 };
+GLuint g_shadowMaskDepthBuffer = 0;
+int g_shadowMaskWidth = 0, g_shadowMaskHeight = 0;
+// NOTE: set when lights are added or removed (or change their shadow map storage)
+bool g_repackShadowAtlas = true;
+size_t g_shadowAtlasWidth = SHADOW_ATLAS_WIDTH;
+size_t g_shadowAtlasMaxHeight = SHADOW_ATLAS_MAX_HEIGHT;
+size_t g_maxCubeMapSize = SHADOW_CUBE_MAP_SIZE;
+bool g_virtualShadowMaps = false;
+// NOTE: one layer per light source, allocated on demand (i.e., when virtual shadow maps are enabled)
+bool g_hasPageTables = false;
+GLuint g_pageTables = 0;
+GLuint g_feedbackFramebuffer = 0;
+GLuint g_feedbackTexture = 0;
+GLuint g_feedbackDepthBuffer = 0;
+int g_feedbackWidth = 0, g_feedbackHeight = 0;
+GLuint g_feedbackPixelBuffers[VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY + 1] = {};
+// NOTE: 0 if the pixel buffer holds no pending read back
+GLsync g_feedbackFences[VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY + 1] = {};
+size_t g_feedbackFrame = 0;
+// NOTE: the latest feedback that was read back (world positions, so still valid a few frames later)
+std::vector<glm::vec4> g_feedback;
+int g_numResidentPages = 0;
+int g_numRenderedPages = 0;
+int g_numMissingPages = 0;
 bool g_animateLights = false;
+bool g_animateObj = false;
+bool g_cacheShadowMaps = true;
+int g_numCachedShadowMaps = 0;
+bool g_amortizeShadowUpdates = false;
+float g_shadowUpdateBudget = DEFAULT_SHADOW_UPDATE_BUDGET;
+float g_shadowUpdateCost = DEFAULT_SHADOW_UPDATE_COST;
+int g_numScheduledShadowMaps = 0;
+int g_numDeferredShadowMaps = 0;
+int g_numSkippedCubeFaces = 0;
+int g_maxShadowMapAge = 0;
+char g_shadowSchedule[256] = "";
+float g_lightCutoff = DEFAULT_LIGHT_CUTOFF;
+bool g_cullLights = true;
+int g_numVisibleLights = 0;
+int g_numCulledLights = 0;
+bool g_clusteredLighting = false;
+int g_numClusteredLights = DEFAULT_NUM_CLUSTERED_LIGHTS;
+// NOTE: unshadowed point lights, two texels each (see createClusteredLights())
+std::vector<glm::vec4> g_clusteredLights;
+GLuint g_clusterDataBuffer = 0;
+GLuint g_clusterDataTexture = 0;
+GLuint g_clusteredLightsBuffer = 0;
+GLuint g_clusteredLightsTexture = 0;
+float g_lightGridBuildTime = 0;
+int g_maxLightsPerCluster = 0;
+// NOTE: light indices that didn't fit the max. texture buffer size (clusters hold any number of lights otherwise)
+int g_numClusterOverflows = 0;
+size_t g_maxTextureBufferSize = 0;
+size_t g_clusterDataCapacity = 0;
 std::vector<std::unique_ptr<Animation>> g_lightSourceAnimations;
 std::unique_ptr<Animation> g_navigatorAnimation(nullptr);
+bool g_recordCameraPath = false;
+std::vector<CameraPathKey> g_cameraPath;
+int g_numCameraPathKeys = 0;
+std::unique_ptr<Tuner::Session> g_tuningSession(nullptr);
+size_t g_tuningPathStride = TUNING_PATH_STRIDE;
+// NOTE: settings (and dynamic resolution) in effect before tuning, restored afterwards
+Tuner::Settings g_untunedSettings;
+bool g_untunedDynamicResolution = false;
+float g_tuningProgress = 0;
 
 //////////////////////////////////////////////////////////////////////////
 void errorCallback(int error, const char* description)
@@ -307,10 +634,16 @@ void defineAnttweakbarStructs()
 		sizeof(glm::vec4),
 		NULL,
 		NULL);
-	TwEnumVal enumVals1[] = { { DIRECTIONAL, "Directional" },{ POINT, "Point" } };
-	g_lightType = TwDefineEnum("LightType", enumVals1, 2);
-	TwEnumVal enumVals2[] = { { DisplayMode::HARD_SHADOWS, "Hard Shadows" }, { DisplayMode::SOFT_SHADOWS, "Soft Shadows" },{ DisplayMode::BLOCKER_SEARCH, "Blocker Search" }, { DisplayMode::PENUMBRA_ESTIMATE, "Penumbra Estimate" } };
-	g_displayModeType = TwDefineEnum("DisplayMode", enumVals2, 4);
+	TwEnumVal enumVals1[] = { { DIRECTIONAL, "Directional" },{ POINT, "Point" },{ SPOT, "Spot" } };
+	g_lightType = TwDefineEnum("LightType", enumVals1, 3);
+	TwEnumVal enumVals2[] = { { DisplayMode::HARD_SHADOWS, "Hard Shadows" }, { DisplayMode::SOFT_SHADOWS, "Soft Shadows" },{ DisplayMode::BLOCKER_SEARCH, "Blocker Search" }, { DisplayMode::PENUMBRA_ESTIMATE, "Penumbra Estimate" }, { DisplayMode::MOMENT_SOFT_SHADOWS, "Soft Shadows (Moments)" } };
+	g_displayModeType = TwDefineEnum("DisplayMode", enumVals2, 5);
+	TwEnumVal enumVals3[] = { { MomentFiltering::MIPMAPS, "Mipmaps" }, { MomentFiltering::GPU_SUMMED_AREA_TABLES, "Summed-Area Tables (GPU)" }, { MomentFiltering::CPU_SUMMED_AREA_TABLES, "Summed-Area Tables (CPU)" } };
+	g_momentFilteringType = TwDefineEnum("MomentFiltering", enumVals3, 3);
+	TwEnumVal enumVals4[] = { { PointLightShadows::CUBE_MAPS, "Cube Maps" }, { PointLightShadows::DUAL_PARABOLOIDS, "Dual Paraboloids" } };
+	g_pointLightShadowsType = TwDefineEnum("PointLightShadows", enumVals4, 2);
+	TwEnumVal enumVals5[] = { { ShadowMapFormat::DEPTH16, "16-bit" }, { ShadowMapFormat::DEPTH24, "24-bit" }, { ShadowMapFormat::DEPTH32F, "32-bit (float)" } };
+	g_shadowMapFormatType = TwDefineEnum("ShadowMapFormat", enumVals5, 3);
 }
 
 void TW_CALL removeLightCallback(void *clientData)
@@ -331,273 +664,1535 @@ void TW_CALL removeLightCallback(void *clientData)
 	// FIXME: checking invariants
 	if (it3 == g_shadowMaps.end())
 		throw std::runtime_error("invalid shadow map");
-	if (it3->hasTexture)
-		glDeleteTextures(1, &it3->texture);
+	// NOTE: 2D shadow maps are atlas tiles, the atlas is re-packed instead
 	if (it3->hasCubeMap)
 		glDeleteTextures(1, &it3->cubeMap);
+	if (it3->staticCubeMap != 0)
+		glDeleteTextures(1, &it3->staticCubeMap);
 	g_shadowMaps.erase(it3);
+	g_repackShadowAtlas = true;
 	g_selectedLightSource = 0;
 }
 
-void TW_CALL addLightCallback(void *clientData)
+GLenum getShadowMapInternalFormat()
 {
-	auto i = g_lightSources.size();
-	std::string barName = "Light" + std::to_string(i);
-	auto newBar = TwNewBar(barName.c_str());
-	std::string label = "Light " + std::to_string(i) + "[";
-	switch (g_selectedLightType)
-	{
-	case DIRECTIONAL:
-		label += "Directional]";
-		break;
-	case POINT:
-		label += "Point]";
-		break;
-	default:
-		// FIXME: checking invariants
-		throw std::runtime_error("unknown light type");
-	}
-	TwDefine((barName + " label='" + label + "' ").c_str());
-	std::unique_ptr<LightSourceAdapter> adapter(new LightSourceAdapter(g_selectedLightType, i, newBar));
-	GLuint shadowMapTexture;
-	glGenTextures(1, &shadowMapTexture);
-	switch (g_selectedLightType)
+	switch (g_shadowMapFormat)
 	{
-	case DIRECTIONAL:
-		glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		g_shadowMaps.emplace_back(ShadowMap{ i, true, shadowMapTexture, -2, glm::mat4(1), -2, false, 0, -2 });
-		glBindTexture(GL_TEXTURE_2D, 0);
-		g_lightSourceAnimations.emplace_back(new Rotate(glm::vec3(0, 1, 0), 0.25f, true, *adapter));
-		break;
-	case POINT:
-		glBindTexture(GL_TEXTURE_CUBE_MAP, shadowMapTexture);
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_DEPTH_COMPONENT32, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_DEPTH_COMPONENT32, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, GL_DEPTH_COMPONENT32, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_DEPTH_COMPONENT32, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_DEPTH_COMPONENT32, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_DEPTH_COMPONENT32, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		g_shadowMaps.emplace_back(ShadowMap{ i, false, 0, -2, glm::mat4(1), -2, true, shadowMapTexture, -2 });
-		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-		g_lightSourceAnimations.emplace_back(new ForthAndBack(glm::vec3(0, 1, 0), 6, 2, true, *adapter));
-		break;
+	case ShadowMapFormat::DEPTH16:
+		return GL_DEPTH_COMPONENT16;
+	case ShadowMapFormat::DEPTH32F:
+		return GL_DEPTH_COMPONENT32F;
 	default:
-		// FIXME: checking invariants
-		throw std::runtime_error("unknown light type");
+		return GL_DEPTH_COMPONENT24;
 	}
-	g_lightSources.emplace_back(std::move(adapter));
-	g_lightSources[i]->initializeTwBar();
-	checkOpenGLError();
 }
 
-//////////////////////////////////////////////////////////////////////////
-template <size_t UniqueIndex>
-void TwAddStringVarRO(TwBar* bar, const char* name, const std::string& value, const std::string& def = "")
+// NOTE: 24 bits are padded to 4 bytes
+size_t getShadowMapTexelSize()
 {
-	static char cString[1024];
-	auto count = std::min((size_t)1023, value.size());
-	strncpy_s(cString, value.c_str(), count);
-	cString[count + 1] = (char)'\0';
-	TwAddVarRO(bar, name, TW_TYPE_CSSTRING(1024), cString, def.c_str());
+	return (g_shadowMapFormat == ShadowMapFormat::DEPTH16) ? 2 : 4;
 }
 
-template <size_t I>
-void TW_CALL setTex0Callback(const void* value, void* clientData = 0)
+void createShadowCubeMap(GLuint texture, GLsizei size)
 {
-	auto ptr = static_cast<const char*>(value);
-	strncpy_s(g_tex0Filename[I], ptr, 255);
-	g_tex0Filename[I][255] = (char)'/0';
-	int width, height;
-	auto image = SOIL_load_image((MEDIA_DIR + g_tex0Filename[I]).c_str(), &width, &height, 0, SOIL_LOAD_RGB);
-	if (image == nullptr)
-		return;
-	if (g_hasTex0[I])
-		glDeleteTextures(1, &g_tex0[I]);
-	g_hasTex0[I] = true;
-	glGenTextures(1, &g_tex0[I]);
-	glBindTexture(GL_TEXTURE_2D, g_tex0[I]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	auto internalFormat = getShadowMapInternalFormat();
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, internalFormat, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, internalFormat, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, internalFormat, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, internalFormat, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, internalFormat, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, internalFormat, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void createShadowAtlasTexture(GLuint texture, size_t height)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, getShadowMapInternalFormat(), (GLsizei)g_shadowAtlasWidth, (GLsizei)height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	SOIL_free_image_data(image);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-template <size_t I>
-void TW_CALL getTex0Callback(void* value, void* clientData)
+void createShadowAtlas(size_t height)
 {
-	auto ptr = static_cast<char*>(value);
-	strncpy(ptr, g_tex0Filename[I], 256);
+	if (g_shadowAtlas == 0)
+		glGenTextures(1, &g_shadowAtlas);
+	createShadowAtlasTexture(g_shadowAtlas, height);
+	g_shadowAtlasHeight = height;
 }
 
-void createPoissonDiscDistribution(GLuint texture, size_t numSamples)
+// NOTE: reverse-Z only pays off with a [0, 1] clip space depth (i.e., clip control), otherwise the depth range mapping cancels it
+bool useReverseZ()
 {
-	auto points = PoissonGenerator::GeneratePoissonPoints(numSamples * 2, PoissonGenerator::DefaultPRNG());
-	size_t attempts = 0;
-	while (points.size() < numSamples && ++attempts < 100)
-		points = PoissonGenerator::GeneratePoissonPoints(numSamples * 2, PoissonGenerator::DefaultPRNG());
-	if (attempts == 100)
-	{
-		std::cout << "couldn't generate Poisson-disc distribution with " << numSamples << " samples" << std::endl;
-		numSamples = points.size();
-	}
-	std::vector<float> data(numSamples * 2);
-	for (auto i = 0, j = 0; i < numSamples; i++, j += 2)
-	{
-		auto& point = points[i];
-		data[j] = point.x;
-		data[j + 1] = point.y;
-	}
-	glBindTexture(GL_TEXTURE_1D, texture);
-	glTexImage1D(GL_TEXTURE_1D, 0, GL_RG, numSamples, 0, GL_RG, GL_FLOAT, &data[0]);
-	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	return g_reverseZ && g_hasClipControl;
 }
 
-void TW_CALL setNumBlockerSearchSamplesCallback(const void* value, void* clientData)
+// NOTE: float depth for the offscreen camera targets, where reverse-Z distributes precision evenly (the default framebuffer keeps its fixed point depth,
+// so camera passes go through the scene framebuffer with reverse-Z, see useSceneFramebuffer())
+GLenum getCameraDepthFormat()
 {
-	g_numBlockerSearchSamples = *static_cast<const size_t*>(value);
-	g_numBlockerSearchSamples = glm::clamp<size_t>(g_numBlockerSearchSamples, MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
-	createPoissonDiscDistribution(g_distributions[0], g_numBlockerSearchSamples);
+	return (g_camera.reversedDepth) ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24;
 }
 
-void TW_CALL getNumBlockerSearchSamplesCallback(void* value, void* clientData)
+// NOTE: camera passes use reverse-Z when enabled, shadow passes always keep the conventional depth range
+// (their depths are linear, so reversing them wouldn't change their precision, and shaders compare them as closer is smaller)
+void setDepthConvention(bool reversed)
 {
-	*static_cast<size_t*>(value) = g_numBlockerSearchSamples;
+	if (g_hasClipControl)
+		glClipControl(GL_LOWER_LEFT, (reversed) ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE);
+	glDepthFunc((reversed) ? GL_GEQUAL : GL_LEQUAL);
+	glClearDepth((reversed) ? 0 : 1);
 }
 
-void TW_CALL setNumPCFSamplesCallback(const void* value, void* clientData)
+// NOTE: lights take turns in a single shadow map, each one rendered right before its own forward pass (hard and soft shadows only)
+bool isMultiPassShadows()
 {
-	g_numPCFSamples = *static_cast<const size_t*>(value);
-	g_numPCFSamples = glm::clamp<size_t>(g_numPCFSamples, MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
-	createPoissonDiscDistribution(g_distributions[1], g_numPCFSamples);
+	return g_multiPassShadows && (g_displayMode == DisplayMode::HARD_SHADOWS || g_displayMode == DisplayMode::SOFT_SHADOWS);
 }
 
-void TW_CALL getNumPCFSamplesCallback(void* value, void* clientData)
+// NOTE: virtual shadow maps and static layers are extra targets, which the single shadow map of multi-pass shadows rules out
+// (the toggles are kept, so that they apply again when multi-pass shadows are turned off)
+bool useVirtualShadowMaps()
 {
-	*static_cast<size_t*>(value) = g_numPCFSamples;
+	return g_virtualShadowMaps && !isMultiPassShadows();
 }
 
-//////////////////////////////////////////////////////////////////////////
-void LightSourceAdapter::initializeTwBar()
+bool useStaticLayers()
 {
-	TwAddVarRW(bar, "Enabled", TW_TYPE_BOOLCPP, &enabled, "");
-	switch (source.type)
+	return g_splitStaticCasters && !isMultiPassShadows();
+}
+
+// NOTE: shadow factors are evaluated by their own pass over a depth pre-pass, then read by a light pass without any shadow map code
+bool useShadowMasks()
+{
+	return g_shadowMasks && !isMultiPassShadows() && (g_displayMode == DisplayMode::HARD_SHADOWS || g_displayMode == DisplayMode::SOFT_SHADOWS || g_displayMode == DisplayMode::MOMENT_SOFT_SHADOWS);
+}
+
+// NOTE: the maps bound the content of the shadow atlas after the shadow passes, which the shared shadow map of multi-pass shadows doesn't keep
+bool useMinMaxShadowMaps()
+{
+	return g_minMaxShadowMaps && g_displayMode == DisplayMode::SOFT_SHADOWS && !isMultiPassShadows() && !useVirtualShadowMaps();
+}
+
+// NOTE: moment maps are prefiltered without the warp, and virtual shadow maps have their own texel distribution
+bool useShadowWarp()
+{
+	return g_warpShadowMaps && !useVirtualShadowMaps() && g_displayMode != DisplayMode::MOMENT_SOFT_SHADOWS;
+}
+
+// NOTE: cube maps are separate targets, so multi-pass shadows use dual-paraboloid maps
+bool useDualParaboloids()
+{
+	return g_pointLightShadows == PointLightShadows::DUAL_PARABOLOIDS || isMultiPassShadows();
+}
+
+// NOTE: point lights only keep the storage of the current point light shadows mode
+// (dual-paraboloid maps are atlas tiles, both hemispheres side by side, front (+z) on the left half and back (-z) on the right half)
+void updatePointLightShadowMap(ShadowMap& shadowMap)
+{
+	if (useDualParaboloids())
 	{
-	case DIRECTIONAL:
-		TwAddVarRO(bar, "Type", TW_TYPE_CSSTRING(1024), "Directional", "");
-		TwAddVarRW(bar, "Direction", g_vec3Type, &source.position, "");
-		break;
-	case POINT:
-		TwAddVarRO(bar, "Type", TW_TYPE_CSSTRING(1024), "Point", "");
-		TwAddVarRW(bar, "Position", g_vec3Type, &source.position, "");
-		break;
-	default:
-		// TODO:
-		throw std::runtime_error("");
+		if (shadowMap.hasTexture)
+			return;
+		if (shadowMap.hasCubeMap)
+			glDeleteTextures(1, &shadowMap.cubeMap);
+		shadowMap.hasCubeMap = false;
+		shadowMap.hasTexture = true;
+		shadowMap.texture = g_shadowAtlas;
 	}
-	TwAddVarRW(bar, "Diffuse Color", g_vec3Type, &source.diffuseColor, "");
-	TwAddVarRW(bar, "Diffuse Power", TW_TYPE_FLOAT, &source.diffusePower, "min=0 step=0.1");
-	TwAddVarRW(bar, "Specular Color", g_vec3Type, &source.specularColor, "");
-	TwAddVarRW(bar, "Specular Power", TW_TYPE_FLOAT, &source.specularPower, "min=0 step=0.1");
-	TwAddVarRW(bar, "Size", TW_TYPE_FLOAT, &source.size, "min=0.1 step=0.1");
-	TwAddButton(bar, "Remove", removeLightCallback, (void*)&index, 0);
+	else
+	{
+		if (shadowMap.hasCubeMap)
+			return;
+		shadowMap.hasTexture = false;
+		shadowMap.hasCubeMap = true;
+		glGenTextures(1, &shadowMap.cubeMap);
+	}
+	// NOTE: storage is (re)allocated by the budget manager
+	shadowMap.resolution = 0;
+	g_repackShadowAtlas = true;
+	checkOpenGLError();
 }
 
-//////////////////////////////////////////////////////////////////////////
-int main(int argc, char** argv)
+float getShadowMapMemory()
 {
-	if (argc < 2)
+	auto texelSize = getShadowMapTexelSize();
+	size_t bytes = g_shadowAtlasWidth * g_shadowAtlasHeight * texelSize;
+	if (g_hasStaticLayers)
+		bytes *= 2;
+	for (auto& shadowMap : g_shadowMaps)
 	{
-		std::cout << "usage: <obj file> [<directional light shadow map bias>] [<point light shadow map bias>]" << std::endl;
-		exit(EXIT_FAILURE);
+		if (shadowMap.hasCubeMap)
+			bytes += 6 * shadowMap.resolution * shadowMap.resolution * texelSize;
+		if (shadowMap.staticCubeMap != 0)
+			bytes += 6 * shadowMap.resolution * shadowMap.resolution * texelSize;
 	}
+	return bytes / (1024.0f * 1024.0f);
+}
 
-	if (argc >= 3)
-		g_directionalLightShadowMapBias = atof(argv[2]);
+// NOTE: fraction of the screen covered by the bounding sphere of the light's influence (i.e., its radius, up to its far plane),
+// directional lights cover it all
+float getScreenCoverage(const LightSourceAdapter& lightSource)
+{
+	if (lightSource.getType() == DIRECTIONAL)
+		return 1;
+	auto radius = std::min(POINT_LIGHT_FAR, lightSource.getInfluenceRadius());
+	auto distance = glm::length(lightSource.getPosition() - g_navigator.getPosition());
+	if (distance <= radius)
+		return 1;
+	auto tanAngularRadius = radius / std::sqrt(distance * distance - radius * radius);
+	auto ratio = tanAngularRadius / std::tan(glm::radians(FOV) * 0.5f);
+	return std::min(1.0f, ratio * ratio);
+}
 
-	if (argc >= 4)
-		g_pointLightShadowMapBias = atof(argv[3]);
+// NOTE: planes extracted from the view projection (Gribb-Hartmann), conservative near the frustum corners
+bool isSphereInFrustum(const glm::mat4& viewProjection, const glm::vec3& center, float radius)
+{
+	auto rows = glm::transpose(viewProjection);
+	glm::vec4 planes[6] = { rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] + rows[2], rows[3] - rows[2] };
+	for (auto& plane : planes)
+		if (glm::dot(plane.xyz(), center) + plane.w < -radius * glm::length(plane.xyz()))
+			return false;
+	return true;
+}
 
-	//////////////////////////////////////////////////////////////////////////
-	// Initialize GLFW and create window
+// NOTE: spot lights are bounded by the sphere of their influence radius too (i.e., regardless of their cone)
+bool isLightVisible(const LightSourceAdapter& lightSource, const glm::mat4& viewProjection)
+{
+	if (lightSource.getType() == DIRECTIONAL)
+		return true;
+	return isSphereInFrustum(viewProjection, lightSource.getPosition(), lightSource.getInfluenceRadius());
+}
 
-	if (!glfwInit())
+// NOTE: the page pool takes a whole atlas tile
+size_t getVirtualShadowMapPoolSize()
+{
+	return std::min<size_t>(VIRTUAL_SHADOW_MAP_POOL_SIZE, ShadowAtlas::FloorPowerOfTwo(std::min(g_shadowAtlasWidth, g_shadowAtlasMaxHeight)));
+}
+
+// assigns per-light resolutions within the memory budget and packs the 2D shadow maps into the atlas,
+// (re)allocating storage only when lights are added or removed or an assigned resolution changes
+void updateShadowMapBudget()
+{
+	for (auto i = 0; i < g_lightSources.size(); i++)
+		if (g_lightSources[i]->getType() == POINT)
+			updatePointLightShadowMap(g_shadowMaps[i]);
+
+	// NOTE: larger lights cast wider penumbrae, which hide the lower resolution
+	std::vector<float> priorities;
+	auto rebudget = g_repackShadowAtlas;
+	for (auto i = 0; i < g_lightSources.size(); i++)
 	{
-		exit(EXIT_FAILURE);
+		auto& lightSource = g_lightSources[i];
+		auto priority = (lightSource->isEnabled()) ? getScreenCoverage(*lightSource) / std::max(1.0f, lightSource->getSize()) : 0.0f;
+		auto previousPriority = g_shadowMaps[i].budgetPriority;
+		rebudget |= (priority == 0) != (previousPriority == 0) || priority > previousPriority * SHADOW_BUDGET_HYSTERESIS || priority * SHADOW_BUDGET_HYSTERESIS < previousPriority;
+		priorities.push_back(priority);
 	}
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "PCSS", NULL, NULL);
-	if (!window)
+	for (auto i = 0; i < g_lightSources.size(); i++)
 	{
-		glfwTerminate();
-		exit(EXIT_FAILURE);
+		if (rebudget)
+			g_shadowMaps[i].budgetPriority = priorities[i];
+		else
+			priorities[i] = g_shadowMaps[i].budgetPriority;
 	}
-	glfwMakeContextCurrent(window);
-	glfwSwapInterval(1);
-	glfwSetErrorCallback(errorCallback);
-	glfwSetKeyCallback(window, keyCallback);
-	glfwSetCharCallback(window, (GLFWcharfun)charCallback);
-	glfwSetMouseButtonCallback(window, mouseButtonCallback);
-	glfwSetCursorPosCallback(window, mouseMoveCallback);
-	glfwSetWindowSizeCallback(window, windowSizeCallback);
 
-	//////////////////////////////////////////////////////////////////////////
-	// Initialize GLEW
+	std::vector<ShadowAtlas::Demand> demands;
+	std::vector<bool> isAtlasTile;
+	for (auto i = 0; i < g_lightSources.size(); i++)
+	{
+		auto& lightSource = g_lightSources[i];
+		auto& shadowMap = g_shadowMaps[i];
+		size_t maxResolution, numFaces;
+		switch (lightSource->getType())
+		{
+		case DIRECTIONAL:
+			maxResolution = (useVirtualShadowMaps()) ? getVirtualShadowMapPoolSize() : SHADOW_MAP_SIZE;
+			numFaces = 1;
+			break;
+		case POINT:
+			maxResolution = (shadowMap.hasCubeMap) ? g_maxCubeMapSize : DUAL_PARABOLOID_SHADOW_MAP_SIZE;
+			numFaces = (shadowMap.hasCubeMap) ? 6 : 2;
+			break;
+		case SPOT:
+			maxResolution = SPOT_LIGHT_SHADOW_MAP_SIZE;
+			numFaces = 1;
+			break;
+		default:
+			// FIXME: checking invariants
+			throw std::runtime_error("unknown light type");
+		}
+		// NOTE: atlas tiles (their faces side by side) must fit the atlas width
+		if (shadowMap.hasTexture)
+			maxResolution = std::min(maxResolution, ShadowAtlas::FloorPowerOfTwo(std::min(g_shadowAtlasWidth / numFaces, g_shadowAtlasMaxHeight)));
+		// NOTE: scaled down by the dynamic resolution controller, except for page pools
+		if (!useVirtualShadowMaps() || lightSource->getType() != DIRECTIONAL)
+			maxResolution = std::max<size_t>(MIN_SHADOW_MAP_SIZE, (size_t)(maxResolution * g_shadowMapScale));
+		auto priority = priorities[i];
+		// NOTE: page pools keep their size (i.e., they are not scaled by the budget)
+		auto isPagePool = useVirtualShadowMaps() && lightSource->getType() == DIRECTIONAL;
+		demands.emplace_back(ShadowAtlas::Demand{ (size_t)(maxResolution * std::sqrt(priority)), (isPagePool) ? maxResolution : MIN_SHADOW_MAP_SIZE, numFaces, priority });
+		isAtlasTile.push_back(shadowMap.hasTexture);
+	}
 
-	glewExperimental = GL_TRUE;
-	glewInit();
+	// NOTE: static layers double the memory of every shadow map
+	auto budgetTexels = (size_t)(g_shadowMapBudget * 1024.0f * 1024.0f) / (getShadowMapTexelSize() * ((useStaticLayers()) ? 2 : 1));
+	auto multiPass = isMultiPassShadows();
+	std::vector<size_t> resolutions;
+	if (multiPass)
+	{
+		// NOTE: lights take turns in the same shadow map, so each one only has to fit the budget on its own
+		for (auto& demand : demands)
+			resolutions.push_back(ShadowAtlas::AssignResolutions(std::vector<ShadowAtlas::Demand>{ demand }, budgetTexels)[0]);
+	}
+	else
+		resolutions = ShadowAtlas::AssignResolutions(demands, budgetTexels);
 
-	//////////////////////////////////////////////////////////////////////////
-	// Initialize AntTweakBar
-	TwInit(TW_OPENGL_CORE, 0);
+	std::vector<ShadowAtlas::Rect> rects;
+	size_t atlasHeight = 0;
+	if (multiPass)
+	{
+		// NOTE: every tile starts at the origin, the atlas is as large as the largest one
+		for (auto i = 0; i < resolutions.size(); i++)
+		{
+			auto height = (isAtlasTile[i]) ? resolutions[i] : 0;
+			rects.emplace_back(ShadowAtlas::Rect{ 0, 0, height * demands[i].numFaces, height });
+			atlasHeight = std::max(atlasHeight, height);
+		}
+	}
+	else
+	{
+		while (true)
+		{
+			std::vector<ShadowAtlas::Rect> sizes;
+			for (auto i = 0; i < resolutions.size(); i++)
+			{
+				auto width = (isAtlasTile[i]) ? resolutions[i] * demands[i].numFaces : 0;
+				sizes.emplace_back(ShadowAtlas::Rect{ 0, 0, width, (isAtlasTile[i]) ? resolutions[i] : 0 });
+			}
+			atlasHeight = ShadowAtlas::Pack(sizes, g_shadowAtlasWidth, rects);
+			if (atlasHeight <= g_shadowAtlasMaxHeight || !ShadowAtlas::Reduce(demands, resolutions, isAtlasTile))
+				break;
+		}
+	}
 
-	defineAnttweakbarStructs();
+	auto formatChanged = getShadowMapInternalFormat() != g_shadowMapInternalFormat;
+	auto changed = g_repackShadowAtlas || g_hasStaticLayers != useStaticLayers() || g_hasSharedShadowMap != multiPass || formatChanged;
+	for (auto i = 0; i < resolutions.size(); i++)
+		changed |= (resolutions[i] != g_shadowMaps[i].resolution);
+	if (!changed)
+		return;
 
-	auto bar0 = TwNewBar("Global");
-	TwDefine(" Global position='10 10' size='400 400' ");
-	TwWindowSize(SCREEN_WIDTH, SCREEN_HEIGHT);
+	// NOTE: rounding up so that small changes in the packing don't reallocate the atlas
+	atlasHeight = std::max<size_t>(MIN_SHADOW_MAP_SIZE, ((atlasHeight + MIN_SHADOW_MAP_SIZE - 1) / MIN_SHADOW_MAP_SIZE) * MIN_SHADOW_MAP_SIZE);
+	if (atlasHeight != g_shadowAtlasHeight || formatChanged)
+		createShadowAtlas(atlasHeight);
+	if (useStaticLayers())
+	{
+		if (g_staticShadowAtlas == 0)
+			glGenTextures(1, &g_staticShadowAtlas);
+		createShadowAtlasTexture(g_staticShadowAtlas, atlasHeight);
+	}
+	else if (g_staticShadowAtlas != 0)
+	{
+		glDeleteTextures(1, &g_staticShadowAtlas);
+		g_staticShadowAtlas = 0;
+	}
+	g_hasStaticLayers = useStaticLayers();
+	g_hasSharedShadowMap = multiPass;
 
-	TwAddSeparator(bar0, 0, " group='Scene' ");
-	TwAddStringVarRO<0>(bar0, "OBJ", argv[1], "group=Scene");
-	setTex0Callback<0>(DEFAULT_OBJ_TEX0_FILENAME);
-	setTex0Callback<1>(DEFAULT_GROUND_TEX0_FILENAME);
-	TwAddVarCB(bar0, "Diffuse Map (OBJ)", TW_TYPE_CSSTRING(256), setTex0Callback<0>, getTex0Callback<0>, 0, "group=Scene");
-	TwAddVarCB(bar0, "Diffuse Map (ground)", TW_TYPE_CSSTRING(256), setTex0Callback<1>, getTex0Callback<1>, 0, "group=Scene");
-	TwAddVarRW(bar0, "Ambient Color", g_vec3Type, &g_ambientColor, "group=Scene");
-	TwAddVarRW(bar0, "Specular Color", g_vec3Type, &g_specularColor, "group=Scene");
-	TwAddVarRW(bar0, "Specularity", TW_TYPE_FLOAT, &g_specularity, "group=Scene");
+	for (auto i = 0; i < resolutions.size(); i++)
+	{
+		auto& shadowMap = g_shadowMaps[i];
+		if (shadowMap.hasCubeMap && (resolutions[i] != shadowMap.resolution || formatChanged))
+			createShadowCubeMap(shadowMap.cubeMap, (GLsizei)resolutions[i]);
+		if (shadowMap.hasCubeMap && useStaticLayers())
+		{
+			if (shadowMap.staticCubeMap == 0)
+				glGenTextures(1, &shadowMap.staticCubeMap);
+			createShadowCubeMap(shadowMap.staticCubeMap, (GLsizei)resolutions[i]);
+		}
+		else if (shadowMap.staticCubeMap != 0)
+		{
+			glDeleteTextures(1, &shadowMap.staticCubeMap);
+			shadowMap.staticCubeMap = 0;
+		}
+		if (shadowMap.hasTexture)
+		{
+			shadowMap.texture = g_shadowAtlas;
+			shadowMap.atlasRect = rects[i];
+		}
+		shadowMap.resolution = resolutions[i];
+		// NOTE: pages cached in the previous tile are lost, and so is the content of the other shadow maps
+		shadowMap.pageTable.reset();
+		shadowMap.isValid = false;
+		shadowMap.isStaticLayerValid = false;
+	}
+	g_repackShadowAtlas = false;
+	g_shadowMapInternalFormat = getShadowMapInternalFormat();
+	checkOpenGLError();
+}
 
-	TwAddSeparator(bar0, 0, " group='Shadows' ");
-	TwAddVarRW(bar0, "Shadow Map Bias (Directional Light)", TW_TYPE_FLOAT, &g_directionalLightShadowMapBias, "step=0.0001 group=Shadows");
-	TwAddVarRW(bar0, "Shadow Map Bias (Point Light)", TW_TYPE_FLOAT, &g_pointLightShadowMapBias, "step=0.0001 group=Shadows");
-	TwAddVarRW(bar0, "Draw Shadow Map", TW_TYPE_BOOLCPP, &g_drawShadowMap, "group=Shadows");
-	TwAddVarRW(bar0, "Shadow Map Index", TW_TYPE_INT32, &g_shadowMapIndex, "group=Shadows");
-	std::string definitionStr = "min=" + std::to_string(MIN_NUM_SAMPLES) + " max=" + std::to_string(MAX_NUM_SAMPLES) + " group=Shadows";
+// NOTE: the tile is cleared with the scissor test, so that the other tiles of the atlas are left untouched
+void beginShadowAtlasTile(const ShadowAtlas::Rect& rect)
+{
+	glViewport((GLint)rect.x, (GLint)rect.y, (GLsizei)rect.width, (GLsizei)rect.height);
+	glScissor((GLint)rect.x, (GLint)rect.y, (GLsizei)rect.width, (GLsizei)rect.height);
+	glEnable(GL_SCISSOR_TEST);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+}
+
+void createPageTables()
+{
+	auto virtualPagesPerSide = VIRTUAL_SHADOW_MAP_SIZE / VIRTUAL_SHADOW_MAP_PAGE_SIZE;
+	glGenTextures(1, &g_pageTables);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_pageTables);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG16F, virtualPagesPerSide, virtualPagesPerSide, MAX_NUM_LIGHT_SOURCES, 0, GL_RG, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	g_hasPageTables = true;
+	checkOpenGLError();
+}
+
+// NOTE: physical page coordinates of every virtual page, in the light's layer
+void uploadPageTable(const VirtualShadowMap::PageTable& pageTable, size_t layer)
+{
+	auto virtualPagesPerSide = pageTable.getVirtualPagesPerSide();
+	auto physicalPagesPerSide = pageTable.getPhysicalPagesPerSide();
+	std::vector<glm::vec2> entries(virtualPagesPerSide * virtualPagesPerSide);
+	for (size_t y = 0; y < virtualPagesPerSide; y++)
+	{
+		for (size_t x = 0; x < virtualPagesPerSide; x++)
+		{
+			auto physicalPage = pageTable.getPhysicalPage(x, y);
+			entries[y * virtualPagesPerSide + x] = glm::vec2(physicalPage % physicalPagesPerSide, physicalPage / physicalPagesPerSide);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_pageTables);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)layer, (GLsizei)virtualPagesPerSide, (GLsizei)virtualPagesPerSide, 1, GL_RG, GL_FLOAT, &entries[0]);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// NOTE: world positions of the visible receivers at a fraction of the screen resolution
+void updateFeedbackFramebuffer()
+{
+	auto width = std::max(1, g_renderWidth / VIRTUAL_SHADOW_MAP_FEEDBACK_DOWNSAMPLING);
+	auto height = std::max(1, g_renderHeight / VIRTUAL_SHADOW_MAP_FEEDBACK_DOWNSAMPLING);
+	if (g_feedbackFramebuffer != 0 && width == g_feedbackWidth && height == g_feedbackHeight)
+		return;
+	if (g_feedbackFramebuffer == 0)
+	{
+		glGenFramebuffers(1, &g_feedbackFramebuffer);
+		glGenTextures(1, &g_feedbackTexture);
+		glGenRenderbuffers(1, &g_feedbackDepthBuffer);
+	}
+	glBindTexture(GL_TEXTURE_2D, g_feedbackTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, g_feedbackDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, getCameraDepthFormat(), width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, g_feedbackFramebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_feedbackTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_feedbackDepthBuffer);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// NOTE: pending read backs have the previous size, they are dropped
+	if (g_feedbackPixelBuffers[0] == 0)
+		glGenBuffers(VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY + 1, g_feedbackPixelBuffers);
+	for (auto i = 0; i <= VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, g_feedbackPixelBuffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, width * height * sizeof(glm::vec4), 0, GL_STREAM_READ);
+		if (g_feedbackFences[i] != 0)
+		{
+			glDeleteSync(g_feedbackFences[i]);
+			g_feedbackFences[i] = 0;
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	g_feedbackWidth = width;
+	g_feedbackHeight = height;
+	checkOpenGLError();
+}
+
+// NOTE: starts the read back of this frame's feedback and takes the one started VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY frames earlier,
+// if the GPU is done with it (otherwise the previous feedback is kept, nothing waits)
+void readBackFeedback()
+{
+	auto slot = g_feedbackFrame % (VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY + 1);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, g_feedbackPixelBuffers[slot]);
+	glReadPixels(0, 0, g_feedbackWidth, g_feedbackHeight, GL_RGBA, GL_FLOAT, 0);
+	if (g_feedbackFences[slot] != 0)
+		glDeleteSync(g_feedbackFences[slot]);
+	g_feedbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	auto oldest = (g_feedbackFrame + 1) % (VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY + 1);
+	if (g_feedbackFences[oldest] != 0)
+	{
+		auto status = glClientWaitSync(g_feedbackFences[oldest], 0, 0);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+		{
+			auto size = g_feedbackWidth * g_feedbackHeight;
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, g_feedbackPixelBuffers[oldest]);
+			auto data = static_cast<const glm::vec4*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size * sizeof(glm::vec4), GL_MAP_READ_BIT));
+			if (data != nullptr)
+			{
+				g_feedback.assign(data, data + size);
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			}
+			glDeleteSync(g_feedbackFences[oldest]);
+			g_feedbackFences[oldest] = 0;
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	g_feedbackFrame++;
+}
+
+// NOTE: half float color, so that lights can be added without clamping before the final blit
+void updateAccumulationFramebuffer()
+{
+	if (g_accumulationFramebuffer != 0 && g_renderWidth == g_accumulationWidth && g_renderHeight == g_accumulationHeight)
+		return;
+	if (g_accumulationFramebuffer == 0)
+	{
+		glGenFramebuffers(1, &g_accumulationFramebuffer);
+		glGenTextures(1, &g_accumulationTexture);
+		glGenRenderbuffers(1, &g_accumulationDepthBuffer);
+	}
+	glBindTexture(GL_TEXTURE_2D, g_accumulationTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, g_renderWidth, g_renderHeight, 0, GL_RGBA, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, g_accumulationDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, getCameraDepthFormat(), g_renderWidth, g_renderHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, g_accumulationFramebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_accumulationTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_accumulationDepthBuffer);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	g_accumulationWidth = g_renderWidth;
+	g_accumulationHeight = g_renderHeight;
+	checkOpenGLError();
+}
+
+// NOTE: the masks are the fragment outputs 1 and 2 of the shadow mask pass variant of the forward shader (0, its color, is left out)
+void updateShadowMaskFramebuffer()
+{
+	if (g_shadowMaskFramebuffer != 0 && g_renderWidth == g_shadowMaskWidth && g_renderHeight == g_shadowMaskHeight)
+		return;
+	if (g_shadowMaskFramebuffer == 0)
+	{
+		glGenFramebuffers(1, &g_shadowMaskFramebuffer);
+		glGenTextures(2, g_shadowMaskTextures);
+		glGenRenderbuffers(1, &g_shadowMaskDepthBuffer);
+	}
+	for (auto i = 0; i < 2; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, g_shadowMaskTextures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, g_renderWidth, g_renderHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, g_shadowMaskDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, getCameraDepthFormat(), g_renderWidth, g_renderHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, g_shadowMaskFramebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_shadowMaskTextures[0], 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, g_shadowMaskTextures[1], 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_shadowMaskDepthBuffer);
+	GLenum drawBuffers[] = { GL_NONE, GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(3, drawBuffers);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	g_shadowMaskWidth = g_renderWidth;
+	g_shadowMaskHeight = g_renderHeight;
+	checkOpenGLError();
+}
+
+// NOTE: target of the camera passes when the render resolution is below the window's or with reverse-Z, copied (bilinearly upscaled) to the window
+// at the end of the frame
+void updateSceneFramebuffer()
+{
+	if (g_sceneFramebuffer != 0 && g_renderWidth == g_sceneWidth && g_renderHeight == g_sceneHeight)
+		return;
+	if (g_sceneFramebuffer == 0)
+	{
+		glGenFramebuffers(1, &g_sceneFramebuffer);
+		glGenTextures(1, &g_sceneTexture);
+		glGenRenderbuffers(1, &g_sceneDepthBuffer);
+	}
+	glBindTexture(GL_TEXTURE_2D, g_sceneTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, g_renderWidth, g_renderHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, g_sceneDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, getCameraDepthFormat(), g_renderWidth, g_renderHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, g_sceneFramebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_sceneTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_sceneDepthBuffer);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	g_sceneWidth = g_renderWidth;
+	g_sceneHeight = g_renderHeight;
+	checkOpenGLError();
+}
+
+bool isRenderResolutionScaled()
+{
+	return g_renderWidth != g_screenWidth || g_renderHeight != g_screenHeight;
+}
+
+// NOTE: reverse-Z needs the scene framebuffer's float depth, the default framebuffer's depth is fixed point
+bool useSceneFramebuffer()
+{
+	return isRenderResolutionScaled() || g_camera.reversedDepth;
+}
+
+GLuint getSceneFramebuffer()
+{
+	return (useSceneFramebuffer()) ? g_sceneFramebuffer : 0;
+}
+
+// NOTE: every feedback texel requests the page under it, if it can be shadowed at all (i.e., if it's inside the casters' bounds),
+// then requested pages are dilated by uvMargin so that the PCSS kernels of visible receivers find their blockers
+void requestVirtualShadowMapPages(VirtualShadowMap::PageTable& pageTable, const glm::mat4& viewProjection, const std::vector<glm::vec4>& feedback, const glm::vec3& castersMin, const glm::vec3& castersMax, float uvMargin)
+{
+	auto toUV = [&viewProjection](const glm::vec3& position)
+	{
+		auto projectedCoords = viewProjection * glm::vec4(position, 1);
+		return glm::vec2(projectedCoords) / projectedCoords.w * 0.5f + 0.5f;
+	};
+	auto castersUVMin = glm::vec2(1), castersUVMax = glm::vec2(0);
+	for (auto corner = 0; corner < 8; corner++)
+	{
+		auto uv = toUV(glm::vec3((corner & 1) ? castersMax.x : castersMin.x, (corner & 2) ? castersMax.y : castersMin.y, (corner & 4) ? castersMax.z : castersMin.z));
+		castersUVMin = glm::min(castersUVMin, uv);
+		castersUVMax = glm::max(castersUVMax, uv);
+	}
+	castersUVMin = glm::clamp(castersUVMin - uvMargin, 0.0f, 1.0f);
+	castersUVMax = glm::clamp(castersUVMax + uvMargin, 0.0f, 1.0f);
+
+	auto virtualPagesPerSide = (int)pageTable.getVirtualPagesPerSide();
+	std::vector<bool> touched(virtualPagesPerSide * virtualPagesPerSide, false);
+	for (auto& position : feedback)
+	{
+		if (position.w == 0)
+			continue;
+		auto uv = toUV(glm::vec3(position));
+		if (glm::any(glm::lessThan(uv, castersUVMin)) || glm::any(glm::greaterThan(uv, castersUVMax)))
+			continue;
+		auto x = std::min(virtualPagesPerSide - 1, (int)(uv.x * virtualPagesPerSide));
+		auto y = std::min(virtualPagesPerSide - 1, (int)(uv.y * virtualPagesPerSide));
+		touched[y * virtualPagesPerSide + x] = true;
+	}
+
+	auto margin = (int)std::ceil(uvMargin * virtualPagesPerSide);
+	pageTable.beginFrame();
+	for (auto y = 0; y < virtualPagesPerSide; y++)
+	{
+		for (auto x = 0; x < virtualPagesPerSide; x++)
+		{
+			if (!touched[y * virtualPagesPerSide + x])
+				continue;
+			for (auto y1 = std::max(0, y - margin); y1 <= std::min(virtualPagesPerSide - 1, y + margin); y1++)
+				for (auto x1 = std::max(0, x - margin); x1 <= std::min(virtualPagesPerSide - 1, x + margin); x1++)
+					pageTable.request(x1, y1);
+		}
+	}
+}
+
+// NOTE: trapezoid enclosing the camera frustum (up to SHADOW_WARP_FAR) in the light's orthographic shadow map plane,
+// mapped to the whole map with the projection center LiSPSM would choose (the map follows the camera, so it's dirty whenever the camera moves)
+glm::mat4 getShadowWarp(const LightSourceAdapter& lightSource)
+{
+	if (!useShadowWarp() || lightSource.getType() != DIRECTIONAL)
+		return glm::mat4(1);
+	auto lightViewProjection = lightSource.getViewProjection();
+	auto view = g_navigator.getLocalToWorldTransform();
+	auto cameraToWorld = glm::inverse(view);
+	auto inverseViewProjection = glm::inverse(g_camera.getProjection(g_aspectRatio) * view);
+	auto eye = (cameraToWorld * glm::vec4(0, 0, 0, 1)).xyz();
+	auto viewDirection = glm::normalize((cameraToWorld * glm::vec4(0, 0, -1, 0)).xyz());
+	auto zn = g_camera.zn, zf = std::min(g_camera.zf, SHADOW_WARP_FAR);
+	auto toLight = [&lightViewProjection](const glm::vec3& point)
+	{
+		auto projected = lightViewProjection * glm::vec4(point, 1);
+		return ShadowWarp::Point{ projected.x / projected.w, projected.y / projected.w };
+	};
+	// NOTE: the frustum edges, cut at the near plane and at zf
+	std::vector<ShadowWarp::Point> footprint;
+	for (auto corner = 0; corner < 8; corner++)
+	{
+		// NOTE: NDC depths 0 and 1 are in front of the camera with either depth convention
+		auto ndc = inverseViewProjection * glm::vec4((corner & 1) ? 1 : -1, (corner & 2) ? 1 : -1, (corner & 4) ? 1 : 0, 1);
+		auto edge = ndc.xyz() / ndc.w - eye;
+		auto depth = glm::dot(edge, viewDirection);
+		if (depth <= 0)
+			continue;
+		footprint.push_back(toLight(eye + edge * (zn / depth)));
+		footprint.push_back(toLight(eye + edge * (zf / depth)));
+	}
+	// NOTE: directional lights keep their direction in their position
+	auto sinGamma = glm::length(glm::cross(viewDirection, glm::normalize(lightSource.getPosition())));
+	ShadowWarp::Homography homography;
+	if (!ShadowWarp::Trapezoid(ShadowWarp::ClipToUnitSquare(ShadowWarp::ConvexHull(footprint)), toLight(eye + viewDirection * zn), toLight(eye + viewDirection * zf), ShadowWarp::LiSPSMApexRatio(zn, zf, sinGamma) * g_shadowWarpFactor, homography))
+		return glm::mat4(1);
+	// NOTE: (x, y, z, 1) to (u * w, v * w, 0, w)
+	glm::mat4 warp(0);
+	for (auto j = 0; j < 2; j++)
+	{
+		warp[j][0] = homography.m[j];
+		warp[j][1] = homography.m[3 + j];
+		warp[j][3] = homography.m[6 + j];
+	}
+	warp[3][0] = homography.m[2];
+	warp[3][1] = homography.m[5];
+	warp[3][3] = homography.m[8];
+	return warp;
+}
+
+ShadowPassInputs getShadowPassInputs(const LightSourceAdapter& lightSource, const std::vector<ShadowCaster>& casters)
+{
+	ShadowPassInputs inputs{ lightSource.getType(), lightSource.getPosition(), lightSource.getDirection(), lightSource.getCosOuterAngle(), useVirtualShadowMaps() && lightSource.getType() == DIRECTIONAL, getShadowWarp(lightSource) };
+	for (auto& caster : casters)
+		((caster.isStatic) ? inputs.staticCasters : inputs.dynamicCasters).push_back(caster.model);
+	return inputs;
+}
+
+size_t getShadowMapTexels(const ShadowMap& shadowMap)
+{
+	if (shadowMap.hasCubeMap)
+		return 6 * shadowMap.resolution * shadowMap.resolution;
+	return shadowMap.atlasRect.width * shadowMap.atlasRect.height;
+}
+
+// NOTE: in world units (directional lights move along an arc at the point light far plane)
+float getLightMotion(const ShadowPassInputs& current, const ShadowPassInputs& previous)
+{
+	if (current.type == DIRECTIONAL)
+	{
+		auto cosAngle = glm::dot(glm::normalize(current.position), glm::normalize(previous.position));
+		return glm::acos(glm::clamp(cosAngle, -1.0f, 1.0f)) * POINT_LIGHT_FAR;
+	}
+	return glm::length(current.position - previous.position);
+}
+
+// NOTE: "light: age" of the deferred maps after the scheduled ones, e.g. "0 2 | 1:3 4:1"
+void updateShadowScheduleString(const std::vector<bool>& isScheduled, const std::vector<bool>& isDeferred)
+{
+	std::string scheduled, deferred;
+	for (auto i = 0; i < g_shadowMaps.size(); i++)
+	{
+		if (isScheduled[i])
+			scheduled += std::to_string(i) + " ";
+		else if (isDeferred[i])
+			deferred += std::to_string(i) + ":" + std::to_string(g_shadowMaps[i].age) + " ";
+	}
+	auto schedule = scheduled + "| " + deferred;
+	auto count = std::min(sizeof(g_shadowSchedule) - 1, schedule.size());
+	strncpy_s(g_shadowSchedule, schedule.c_str(), count);
+	g_shadowSchedule[count] = '\0';
+}
+
+// NOTE: faces whose frustum (widened by CUBE_FACE_MARGIN) overlaps the bounds, see ALL_CUBE_FACES
+int getCubeFaceMask(const glm::vec3& lightPosition, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	auto relativeMin = boundsMin - lightPosition, relativeMax = boundsMax - lightPosition;
+	if (glm::length(glm::clamp(glm::vec3(0), relativeMin, relativeMax)) > POINT_LIGHT_FAR)
+		return 0;
+	auto slope = std::tan(glm::radians(45.0f + CUBE_FACE_MARGIN));
+	auto mask = 0;
+	for (int j = 0; j < 6; j++)
+	{
+		// NOTE: the face frustum is sign * p[axis] * slope >= |p[u]| and >= |p[v]|, i.e., 4 planes through the light
+		auto axis = j / 2, u = (axis + 1) % 3, v = (axis + 2) % 3;
+		auto sign = (j % 2 == 0) ? 1.0f : -1.0f;
+		auto inside = true;
+		for (int k = 0; k < 4 && inside; k++)
+		{
+			glm::vec3 normal(0);
+			normal[axis] = sign * slope;
+			normal[(k < 2) ? u : v] = (k % 2 == 0) ? 1.0f : -1.0f;
+			// NOTE: corner of the bounds farthest along the normal
+			glm::vec3 corner((normal.x >= 0) ? relativeMax.x : relativeMin.x, (normal.y >= 0) ? relativeMax.y : relativeMin.y, (normal.z >= 0) ? relativeMax.z : relativeMin.z);
+			inside = glm::dot(normal, corner) >= 0;
+		}
+		if (inside)
+			mask |= 1 << j;
+	}
+	return mask;
+}
+
+// NOTE: attaches the shadow map (or its static layer) to the bound framebuffer
+bool attachShadowMap(const ShadowMap& shadowMap, bool staticLayer)
+{
+	GLuint texture;
+	if (shadowMap.hasCubeMap)
+		texture = (staticLayer) ? shadowMap.staticCubeMap : shadowMap.cubeMap;
+	else
+		texture = (staticLayer) ? g_staticShadowAtlas : shadowMap.texture;
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+	return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// NOTE: the whole cube map or the atlas tile
+void setShadowMapViewport(const ShadowMap& shadowMap)
+{
+	if (shadowMap.hasCubeMap)
+		glViewport(0, 0, (GLsizei)shadowMap.resolution, (GLsizei)shadowMap.resolution);
+	else
+		glViewport((GLint)shadowMap.atlasRect.x, (GLint)shadowMap.atlasRect.y, (GLsizei)shadowMap.atlasRect.width, (GLsizei)shadowMap.atlasRect.height);
+}
+
+// NOTE: cube faces other than cubeFaces are left untouched (by attaching the faces one by one, then the whole cube map again)
+void clearShadowMap(const ShadowMap& shadowMap, bool staticLayer, int cubeFaces)
+{
+	if (shadowMap.hasCubeMap)
+	{
+		setShadowMapViewport(shadowMap);
+		if (cubeFaces == ALL_CUBE_FACES)
+		{
+			glClear(GL_DEPTH_BUFFER_BIT);
+			return;
+		}
+		auto cubeMap = (staticLayer) ? shadowMap.staticCubeMap : shadowMap.cubeMap;
+		for (int j = 0; j < 6; j++)
+		{
+			if ((cubeFaces & (1 << j)) == 0)
+				continue;
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, cubeMap, 0);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMap, 0);
+	}
+	else
+		beginShadowAtlasTile(shadowMap.atlasRect);
+}
+
+// NOTE: depth blits from the static layer, one per face for cube maps (layered attachments can't be blitted as a whole)
+void copyStaticLayer(const ShadowMap& shadowMap, int cubeFaces)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, g_staticFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, g_framebuffer);
+	if (shadowMap.hasCubeMap)
+	{
+		auto size = (GLint)shadowMap.resolution;
+		for (int j = 0; j < 6; j++)
+		{
+			if ((cubeFaces & (1 << j)) == 0)
+				continue;
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, shadowMap.staticCubeMap, 0);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, shadowMap.cubeMap, 0);
+			glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		}
+	}
+	else
+	{
+		auto& rect = shadowMap.atlasRect;
+		glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, g_staticShadowAtlas, 0);
+		glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap.texture, 0);
+		glBlitFramebuffer((GLint)rect.x, (GLint)rect.y, (GLint)(rect.x + rect.width), (GLint)(rect.y + rect.height), (GLint)rect.x, (GLint)rect.y, (GLint)(rect.x + rect.width), (GLint)(rect.y + rect.height), GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, g_framebuffer);
+}
+
+// NOTE: with static casters split, static casters are rendered into the static layer only when it's dirty and every pass starts
+// from a copy of it, so that only dynamic casters are drawn each time (the program and its light uniforms are expected to be set);
+// cube maps only update cubeFaces, which drawCaster is given too (the static layer always gets all faces)
+template <typename DrawCaster>
+bool renderShadowMap(ShadowMap& shadowMap, const std::vector<ShadowCaster>& casters, bool isStaticLayerDirty, DrawCaster drawCaster, int cubeFaces = ALL_CUBE_FACES)
+{
+	if (useStaticLayers() && isStaticLayerDirty)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, g_staticFramebuffer);
+		if (!attachShadowMap(shadowMap, true))
+			return false;
+		clearShadowMap(shadowMap, true, ALL_CUBE_FACES);
+		for (auto& caster : casters)
+			if (caster.isStatic)
+				drawCaster(caster, ALL_CUBE_FACES);
+		shadowMap.isStaticLayerValid = true;
+	}
+	if (useStaticLayers())
+		copyStaticLayer(shadowMap, cubeFaces);
+	glBindFramebuffer(GL_FRAMEBUFFER, g_framebuffer);
+	if (!attachShadowMap(shadowMap, false))
+		return false;
+	// NOTE: set even when nothing is cleared (i.e., a clean static layer was copied), the previous light's viewport is still current
+	setShadowMapViewport(shadowMap);
+	if (!useStaticLayers())
+	{
+		clearShadowMap(shadowMap, false, cubeFaces);
+		shadowMap.isStaticLayerValid = false;
+	}
+	for (auto& caster : casters)
+		if (!useStaticLayers() || !caster.isStatic)
+			drawCaster(caster, cubeFaces);
+	return true;
+}
+
+// NOTE: world space bounds of transformed bounds
+void transformBounds(const glm::mat4& model, const glm::vec3& min, const glm::vec3& max, glm::vec3& worldMin, glm::vec3& worldMax)
+{
+	worldMin = glm::vec3(FLT_MAX);
+	worldMax = glm::vec3(-FLT_MAX);
+	for (auto corner = 0; corner < 8; corner++)
+	{
+		auto position = glm::vec3(model * glm::vec4((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z, 1));
+		worldMin = glm::min(worldMin, position);
+		worldMax = glm::max(worldMax, position);
+	}
+}
+
+// NOTE: maps a virtual page to the whole clip space (applied after the light's view projection)
+glm::mat4 getVirtualPageCrop(size_t x, size_t y, size_t virtualPagesPerSide)
+{
+	auto scale = (float)virtualPagesPerSide;
+	return glm::translate(glm::mat4(1), glm::vec3(scale - 1 - 2.0f * x, scale - 1 - 2.0f * y, 0)) * glm::scale(glm::mat4(1), glm::vec3(scale, scale, 1));
+}
+
+// NOTE: offset in xy and scale in zw, in atlas texture coordinates
+glm::vec4 getShadowAtlasRect(const ShadowMap& shadowMap)
+{
+	auto height = (float)std::max<size_t>(1, g_shadowAtlasHeight);
+	return glm::vec4(shadowMap.atlasRect.x / (float)g_shadowAtlasWidth, shadowMap.atlasRect.y / height, shadowMap.atlasRect.width / (float)g_shadowAtlasWidth, shadowMap.atlasRect.height / height);
+}
+
+Tuner::Settings getTuningSettings()
+{
+	return Tuner::Settings{ g_numBlockerSearchSamples, g_numPCFSamples, g_shadowMapBudget, g_directionalLightShadowMapBias };
+}
+
+// NOTE: sample distributions and shadow map resolutions follow on the next frame
+void applyTuningSettings(const Tuner::Settings& settings)
+{
+	g_numBlockerSearchSamples = glm::clamp<size_t>(settings.numBlockerSearchSamples, MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
+	g_numPCFSamples = glm::clamp<size_t>(settings.numPCFSamples, MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
+	g_shadowMapBudget = std::max(16.0f, settings.shadowMapBudget);
+	g_directionalLightShadowMapBias = settings.directionalLightShadowMapBias;
+}
+
+// NOTE: recording restarts the path
+void TW_CALL setRecordCameraPathCallback(const void* value, void* clientData)
+{
+	g_recordCameraPath = *static_cast<const bool*>(value);
+	if (g_recordCameraPath)
+		g_cameraPath.clear();
+}
+
+void TW_CALL getRecordCameraPathCallback(void* value, void* clientData)
+{
+	*static_cast<bool*>(value) = g_recordCameraPath;
+}
+
+// NOTE: sweeps the candidates around the current bias along the recorded path (see Tuner), the results are written to TUNING_CONFIG_FILENAME
+void TW_CALL tunePCSSCallback(void *clientData)
+{
+	if (g_tuningSession != nullptr || g_cameraPath.empty())
+		return;
+	g_recordCameraPath = false;
+	g_untunedSettings = getTuningSettings();
+	g_untunedDynamicResolution = g_dynamicResolution;
+	auto bias = g_directionalLightShadowMapBias;
+	auto candidates = Tuner::Grid({ 4, 8, 16, 32 }, { 4, 8, 16, 32, 64 }, { 64, 128, 256 }, { bias * 0.5f, bias, bias * 2 });
+	Tuner::Settings reference{ TUNING_REFERENCE_SAMPLES, TUNING_REFERENCE_SAMPLES, std::max(g_shadowMapBudget, 256.0f), bias };
+	g_tuningPathStride = std::max<size_t>(TUNING_PATH_STRIDE, (g_cameraPath.size() + TUNING_MAX_KEYS - 1) / TUNING_MAX_KEYS);
+	auto numKeys = (g_cameraPath.size() + g_tuningPathStride - 1) / g_tuningPathStride;
+	g_tuningSession = std::unique_ptr<Tuner::Session>(new Tuner::Session(candidates, reference, numKeys, TUNING_WARM_UP_FRAMES));
+}
+
+void TW_CALL addLightCallback(void *clientData)
+{
+	auto i = g_lightSources.size();
+	std::string barName = "Light" + std::to_string(i);
+	auto newBar = TwNewBar(barName.c_str());
+	std::string label = "Light " + std::to_string(i) + "[";
+	switch (g_selectedLightType)
+	{
+	case DIRECTIONAL:
+		label += "Directional]";
+		break;
+	case POINT:
+		label += "Point]";
+		break;
+	case SPOT:
+		label += "Spot]";
+		break;
+	default:
+		// FIXME: checking invariants
+		throw std::runtime_error("unknown light type");
+	}
+	TwDefine((barName + " label='" + label + "' ").c_str());
+	std::unique_ptr<LightSourceAdapter> adapter(new LightSourceAdapter(g_selectedLightType, i, newBar));
+	// NOTE: resolutions (and atlas tiles) are assigned by the budget manager before the next shadow passes
+	switch (g_selectedLightType)
+	{
+	case DIRECTIONAL:
+		g_shadowMaps.emplace_back(ShadowMap{ i, true, g_shadowAtlas, -2, glm::mat4(1), -2, false, 0, -2, -2 });
+		g_lightSourceAnimations.emplace_back(new Rotate(glm::vec3(0, 1, 0), 0.25f, true, *adapter));
+		break;
+	case POINT:
+		if (g_pointLightShadows == PointLightShadows::DUAL_PARABOLOIDS)
+			g_shadowMaps.emplace_back(ShadowMap{ i, true, g_shadowAtlas, -2, glm::mat4(1), -2, false, 0, -2, -2 });
+		else
+		{
+			GLuint shadowCubeMap;
+			glGenTextures(1, &shadowCubeMap);
+			g_shadowMaps.emplace_back(ShadowMap{ i, false, 0, -2, glm::mat4(1), -2, true, shadowCubeMap, -2, -2 });
+		}
+		g_lightSourceAnimations.emplace_back(new ForthAndBack(glm::vec3(0, 1, 0), 6, 2, true, *adapter));
+		break;
+	case SPOT:
+		g_shadowMaps.emplace_back(ShadowMap{ i, true, g_shadowAtlas, -2, glm::mat4(1), -2, false, 0, -2, -2 });
+		// NOTE: sweeping the cone across the scene
+		g_lightSourceAnimations.emplace_back(new ForthAndBack(glm::vec3(1, 0, 0), 4, 2, true, *adapter));
+		break;
+	default:
+		// FIXME: checking invariants
+		throw std::runtime_error("unknown light type");
+	}
+	g_lightSources.emplace_back(std::move(adapter));
+	g_lightSources[i]->initializeTwBar();
+	g_repackShadowAtlas = true;
+	checkOpenGLError();
+}
+
+//////////////////////////////////////////////////////////////////////////
+template <size_t UniqueIndex>
+void TwAddStringVarRO(TwBar* bar, const char* name, const std::string& value, const std::string& def = "")
+{
+	static char cString[1024];
+	auto count = std::min((size_t)1023, value.size());
+	strncpy_s(cString, value.c_str(), count);
+	cString[count + 1] = (char)'\0';
+	TwAddVarRO(bar, name, TW_TYPE_CSSTRING(1024), cString, def.c_str());
+}
+
+template <size_t I>
+void TW_CALL setTex0Callback(const void* value, void* clientData = 0)
+{
+	auto ptr = static_cast<const char*>(value);
+	strncpy_s(g_tex0Filename[I], ptr, 255);
+	g_tex0Filename[I][255] = (char)'/0';
+	int width, height;
+	auto image = SOIL_load_image((MEDIA_DIR + g_tex0Filename[I]).c_str(), &width, &height, 0, SOIL_LOAD_RGB);
+	if (image == nullptr)
+		return;
+	if (g_hasTex0[I])
+		glDeleteTextures(1, &g_tex0[I]);
+	g_hasTex0[I] = true;
+	glGenTextures(1, &g_tex0[I]);
+	glBindTexture(GL_TEXTURE_2D, g_tex0[I]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	SOIL_free_image_data(image);
+}
+
+template <size_t I>
+void TW_CALL getTex0Callback(void* value, void* clientData)
+{
+	auto ptr = static_cast<char*>(value);
+	strncpy(ptr, g_tex0Filename[I], 256);
+}
+
+// NOTE: farthest-point order (every point is the farthest from the ones before it), so that any prefix of a distribution is
+// itself well spread (shadow LOD takes fewer samples than a distribution holds)
+void orderProgressively(std::vector<PoissonGenerator::sPoint>& points, size_t numPoints)
+{
+	numPoints = std::min(numPoints, points.size());
+	std::vector<float> distances(numPoints, FLT_MAX);
+	for (size_t i = 1; i < numPoints; i++)
+	{
+		auto& last = points[i - 1];
+		auto farthest = i;
+		for (auto j = i; j < numPoints; j++)
+		{
+			auto dx = points[j].x - last.x, dy = points[j].y - last.y;
+			distances[j] = std::min(distances[j], dx * dx + dy * dy);
+			if (distances[j] > distances[farthest])
+				farthest = j;
+		}
+		std::swap(points[i], points[farthest]);
+		std::swap(distances[i], distances[farthest]);
+	}
+}
+
+// NOTE: distributions are stored in the Distributions uniform block, two samples per vec4 (see RandomDirection() in fragment shader)
+// quad distributions are used by the texture gather variants, where every sample covers 2x2 texels
+void createPoissonDiscDistribution(size_t distribution, size_t numSamples)
+{
+	auto points = PoissonGenerator::GeneratePoissonPoints(numSamples * 2, PoissonGenerator::DefaultPRNG());
+	size_t attempts = 0;
+	while (points.size() < numSamples && ++attempts < 100)
+		points = PoissonGenerator::GeneratePoissonPoints(numSamples * 2, PoissonGenerator::DefaultPRNG());
+	if (attempts == 100)
+	{
+		std::cout << "couldn't generate Poisson-disc distribution with " << numSamples << " samples" << std::endl;
+		numSamples = points.size();
+	}
+	orderProgressively(points, numSamples);
+	std::vector<glm::vec2> data(MAX_NUM_SAMPLES, glm::vec2(0, 0));
+	for (auto i = 0; i < numSamples; i++)
+	{
+		auto& point = points[i];
+		data[i] = glm::vec2(point.x, point.y) * 2.0f - 1.0f;
+	}
+	// NOTE: preserving uniform buffer binding (light sources are updated from callbacks)
+	GLint previousUniformBuffer;
+	glGetIntegerv(GL_UNIFORM_BUFFER_BINDING, &previousUniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, g_distributionsUniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, distribution * MAX_NUM_SAMPLES * sizeof(glm::vec2), MAX_NUM_SAMPLES * sizeof(glm::vec2), &data[0]);
+	glBindBuffer(GL_UNIFORM_BUFFER, previousUniformBuffer);
+}
+
+// NOTE: blue-noise texture is generated offline by BlueNoise.cpp, generating it here is just a fallback
+void createBlueNoiseTexture(GLuint texture)
+{
+	int width, height;
+	auto image = SOIL_load_image((MEDIA_DIR + BLUE_NOISE_TEXTURE_FILENAME).c_str(), &width, &height, 0, SOIL_LOAD_L);
+	std::vector<unsigned char> data;
+	if (image == nullptr)
+	{
+		std::cout << "couldn't load blue-noise texture (" << BLUE_NOISE_TEXTURE_FILENAME << "), generating one" << std::endl;
+		width = height = BLUE_NOISE_TEXTURE_SIZE;
+		auto values = BlueNoiseGenerator::GenerateBlueNoise(BLUE_NOISE_TEXTURE_SIZE, PoissonGenerator::DefaultPRNG());
+		data.resize(values.size());
+		for (size_t i = 0; i < values.size(); i++)
+			data[i] = (unsigned char)(values[i] * 256.0f);
+	}
+	else
+	{
+		data.assign(image, image + width * height);
+		SOIL_free_image_data(image);
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, &data[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// NOTE: unshadowed point lights scattered over the ground, position and radius followed by color and power
+void createClusteredLights()
+{
+	std::mt19937 generator(CLUSTERED_LIGHTS_SEED);
+	std::uniform_real_distribution<float> horizontal(-10, 10), vertical(0, 1), radius(CLUSTERED_LIGHT_MIN_RADIUS, CLUSTERED_LIGHT_MAX_RADIUS), hue(0, 6);
+	g_clusteredLights.clear();
+	for (size_t i = 0; i < MAX_NUM_CLUSTERED_LIGHTS; i++)
+	{
+		auto x = horizontal(generator), y = vertical(generator), z = horizontal(generator);
+		g_clusteredLights.emplace_back(x, y, z, radius(generator));
+		auto h = hue(generator);
+		auto color = glm::clamp(glm::vec3(std::abs(h - 3) - 1, 2 - std::abs(h - 2), 2 - std::abs(h - 4)), 0.0f, 1.0f);
+		g_clusteredLights.emplace_back(color, CLUSTERED_LIGHT_POWER);
+	}
+}
+
+void createTextureBuffer(GLuint& buffer, GLuint& texture, GLenum internalFormat)
+{
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, 16, 0, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	checkOpenGLError();
+}
+
+// NOTE: the buffer storage is reallocated (i.e., orphaned) every time, the texture keeps pointing at the buffer object
+void uploadTextureBuffer(GLuint buffer, const void* data, size_t size)
+{
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)size, data, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// NOTE: same as uploadTextureBuffer() for data whose size changes every frame, the storage grows (doubling) when the data
+// doesn't fit and is otherwise orphaned at its current capacity
+void streamTextureBuffer(GLuint buffer, size_t& capacity, const void* data, size_t size)
+{
+	if (size > capacity)
+		capacity = std::max(size, capacity * 2);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)capacity, 0, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, (GLsizeiptr)size, data);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void createMomentMaps(size_t numLayers)
+{
+	if (g_hasMomentMaps)
+	{
+		glDeleteTextures(1, &g_momentMaps);
+		glDeleteTextures(1, &g_summedAreaTables);
+	}
+	g_hasMomentMaps = true;
+	g_numMomentMapLayers = numLayers;
+	glGenTextures(1, &g_momentMaps);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_momentMaps);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, MOMENT_MAP_SIZE, MOMENT_MAP_SIZE, (GLsizei)numLayers, 0, GL_RGBA, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	// NOTE: reads outside of the table must return 0 (i.e., an empty sum)
+	glGenTextures(1, &g_summedAreaTables);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_summedAreaTables);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, MOMENT_MAP_SIZE, MOMENT_MAP_SIZE, (GLsizei)numLayers, 0, GL_RGBA, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, glm::value_ptr(glm::vec4(0)));
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	checkOpenGLError();
+}
+
+// NOTE: every level is rendered by its own reduction pass (mipmap generation would average depths)
+void createMinMaxMaps(size_t numLayers)
+{
+	if (g_hasMinMaxMaps)
+		glDeleteTextures(1, &g_minMaxMaps);
+	else
+	{
+		glGenFramebuffers(1, &g_minMaxFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, g_minMaxFramebuffer);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	g_hasMinMaxMaps = true;
+	g_numMinMaxMapLayers = numLayers;
+	glGenTextures(1, &g_minMaxMaps);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_minMaxMaps);
+	for (auto level = 0; level <= MIN_MAX_MAP_MAX_LEVEL; level++)
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RG32F, MIN_MAX_MAP_SIZE >> level, MIN_MAX_MAP_SIZE >> level, (GLsizei)numLayers, 0, GL_RG, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, MIN_MAX_MAP_MAX_LEVEL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	checkOpenGLError();
+}
+
+// NOTE: CPU fallback of the summed-area table passes (reads the moment maps back, stalling the pipeline)
+void buildSummedAreaTablesOnCPU()
+{
+	const size_t layerSize = MOMENT_MAP_SIZE * MOMENT_MAP_SIZE * 4;
+	std::vector<float> moments(layerSize * g_numMomentMapLayers), tables(layerSize * g_numMomentMapLayers), averages(4 * g_numMomentMapLayers);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_momentMaps);
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_FLOAT, &moments[0]);
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, MOMENT_MAP_MAX_LEVEL, GL_RGBA, GL_FLOAT, &averages[0]);
+	// NOTE: centered on the same averages the fragment shader adds back
+	for (size_t i = 0; i < g_numMomentMapLayers; i++)
+		SummedAreaTable::Build(&moments[i * layerSize], MOMENT_MAP_SIZE, MOMENT_MAP_SIZE, 4, &averages[i * 4], &tables[i * layerSize]);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_summedAreaTables);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, MOMENT_MAP_SIZE, MOMENT_MAP_SIZE, (GLsizei)g_numMomentMapLayers, GL_RGBA, GL_FLOAT, &tables[0]);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	checkOpenGLError();
+}
+
+// NOTE: regenerates the distributions whose sample count changed (i.e., a setting or the dynamic resolution controller's scale)
+void updateSampleDistributions()
+{
+	auto numBlockerSearchSamples = glm::clamp<size_t>((size_t)(g_numBlockerSearchSamples * g_sampleScale), MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
+	if (numBlockerSearchSamples != g_numActiveBlockerSearchSamples)
+	{
+		createPoissonDiscDistribution(BLOCKER_SEARCH_DISTRIBUTION, numBlockerSearchSamples);
+		createPoissonDiscDistribution(BLOCKER_SEARCH_QUAD_DISTRIBUTION, numBlockerSearchSamples / 4);
+		g_numActiveBlockerSearchSamples = numBlockerSearchSamples;
+	}
+	auto numPCFSamples = glm::clamp<size_t>((size_t)(g_numPCFSamples * g_sampleScale), MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
+	if (numPCFSamples != g_numActivePCFSamples)
+	{
+		createPoissonDiscDistribution(PCF_DISTRIBUTION, numPCFSamples);
+		createPoissonDiscDistribution(PCF_QUAD_DISTRIBUTION, numPCFSamples / 4);
+		g_numActivePCFSamples = numPCFSamples;
+	}
+}
+
+void TW_CALL setNumBlockerSearchSamplesCallback(const void* value, void* clientData)
+{
+	g_numBlockerSearchSamples = *static_cast<const size_t*>(value);
+	g_numBlockerSearchSamples = glm::clamp<size_t>(g_numBlockerSearchSamples, MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
+	updateSampleDistributions();
+}
+
+void TW_CALL getNumBlockerSearchSamplesCallback(void* value, void* clientData)
+{
+	*static_cast<size_t*>(value) = g_numBlockerSearchSamples;
+}
+
+void TW_CALL setNumPCFSamplesCallback(const void* value, void* clientData)
+{
+	g_numPCFSamples = *static_cast<const size_t*>(value);
+	g_numPCFSamples = glm::clamp<size_t>(g_numPCFSamples, MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
+	updateSampleDistributions();
+}
+
+void TW_CALL getNumPCFSamplesCallback(void* value, void* clientData)
+{
+	*static_cast<size_t*>(value) = g_numPCFSamples;
+}
+
+// NOTE: spot light cone angles are stored as cosines (see LightSource), clientData points to one of them
+// NOTE: the inner angle is kept MIN_SPOT_LIGHT_PENUMBRA_ANGLE below the outer one, since the cone falloff is a smoothstep()
+// from the outer to the inner cosine (undefined when they meet or cross)
+void TW_CALL setSpotLightInnerAngleCallback(const void* value, void* clientData)
+{
+	auto source = static_cast<LightSource*>(clientData);
+	auto outerAngle = glm::degrees(glm::acos(source->cosOuterAngle));
+	auto innerAngle = glm::clamp(*static_cast<const float*>(value), 0.0f, outerAngle - MIN_SPOT_LIGHT_PENUMBRA_ANGLE);
+	source->cosInnerAngle = glm::cos(glm::radians(innerAngle));
+}
+
+void TW_CALL getSpotLightInnerAngleCallback(void* value, void* clientData)
+{
+	*static_cast<float*>(value) = glm::degrees(glm::acos(static_cast<LightSource*>(clientData)->cosInnerAngle));
+}
+
+void TW_CALL setSpotLightOuterAngleCallback(const void* value, void* clientData)
+{
+	auto source = static_cast<LightSource*>(clientData);
+	auto innerAngle = glm::degrees(glm::acos(source->cosInnerAngle));
+	auto outerAngle = glm::clamp(*static_cast<const float*>(value), innerAngle + MIN_SPOT_LIGHT_PENUMBRA_ANGLE, MAX_SPOT_LIGHT_ANGLE);
+	source->cosOuterAngle = glm::cos(glm::radians(outerAngle));
+}
+
+void TW_CALL getSpotLightOuterAngleCallback(void* value, void* clientData)
+{
+	*static_cast<float*>(value) = glm::degrees(glm::acos(static_cast<LightSource*>(clientData)->cosOuterAngle));
+}
+
+//////////////////////////////////////////////////////////////////////////
+void LightSourceAdapter::initializeTwBar()
+{
+	TwAddVarRW(bar, "Enabled", TW_TYPE_BOOLCPP, &enabled, "");
+	switch (source.type)
+	{
+	case DIRECTIONAL:
+		TwAddVarRO(bar, "Type", TW_TYPE_CSSTRING(1024), "Directional", "");
+		TwAddVarRW(bar, "Direction", g_vec3Type, &source.position, "");
+		break;
+	case POINT:
+		TwAddVarRO(bar, "Type", TW_TYPE_CSSTRING(1024), "Point", "");
+		TwAddVarRW(bar, "Position", g_vec3Type, &source.position, "");
+		break;
+	case SPOT:
+		TwAddVarRO(bar, "Type", TW_TYPE_CSSTRING(1024), "Spot", "");
+		TwAddVarRW(bar, "Position", g_vec3Type, &source.position, "");
+		TwAddVarRW(bar, "Direction", g_vec3Type, &source.direction, "");
+		TwAddVarCB(bar, "Inner Angle", TW_TYPE_FLOAT, setSpotLightInnerAngleCallback, getSpotLightInnerAngleCallback, &source, "min=0 max=88 step=1");
+		TwAddVarCB(bar, "Outer Angle", TW_TYPE_FLOAT, setSpotLightOuterAngleCallback, getSpotLightOuterAngleCallback, &source, "min=1 max=89 step=1");
+		break;
+	default:
+		// TODO:
+		throw std::runtime_error("");
+	}
+	TwAddVarRW(bar, "Diffuse Color", g_vec3Type, &source.diffuseColor, "");
+	TwAddVarRW(bar, "Diffuse Power", TW_TYPE_FLOAT, &source.diffusePower, "min=0 step=0.1");
+	TwAddVarRW(bar, "Specular Color", g_vec3Type, &source.specularColor, "");
+	TwAddVarRW(bar, "Specular Power", TW_TYPE_FLOAT, &source.specularPower, "min=0 step=0.1");
+	TwAddVarRW(bar, "Size", TW_TYPE_FLOAT, &source.size, "min=0.1 step=0.1");
+	TwAddButton(bar, "Remove", removeLightCallback, (void*)&index, 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cout << "usage: <obj file> [<directional light shadow map bias>] [<point light shadow map bias>] [<tuning config file>]" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (argc >= 3)
+		g_directionalLightShadowMapBias = atof(argv[2]);
+
+	if (argc >= 4)
+		g_pointLightShadowMapBias = atof(argv[3]);
+
+	// NOTE: settings of the largest frame budget within the target frame time (written by the PCSS tuner)
+	if (argc >= 5)
+	{
+		Tuner::Settings settings;
+		if (Tuner::Read(argv[4], g_targetFrameTime, settings))
+			applyTuningSettings(settings);
+		else
+			std::cout << "couldn't read tuning config " << argv[4] << std::endl;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Initialize GLFW and create window
+
+	if (!glfwInit())
+	{
+		exit(EXIT_FAILURE);
+	}
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "PCSS", NULL, NULL);
+	if (!window)
+	{
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(1);
+	glfwSetErrorCallback(errorCallback);
+	glfwSetKeyCallback(window, keyCallback);
+	glfwSetCharCallback(window, (GLFWcharfun)charCallback);
+	glfwSetMouseButtonCallback(window, mouseButtonCallback);
+	glfwSetCursorPosCallback(window, mouseMoveCallback);
+	glfwSetWindowSizeCallback(window, windowSizeCallback);
+
+	//////////////////////////////////////////////////////////////////////////
+	// Initialize GLEW
+
+	glewExperimental = GL_TRUE;
+	glewInit();
+	g_hasClipControl = GLEW_VERSION_4_5 || GLEW_ARB_clip_control;
+	GLint maxTextureSize, maxCubeMapTextureSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxCubeMapTextureSize);
+	g_shadowAtlasWidth = std::min<size_t>(SHADOW_ATLAS_WIDTH, ShadowAtlas::FloorPowerOfTwo((size_t)maxTextureSize));
+	g_shadowAtlasMaxHeight = std::min<size_t>(SHADOW_ATLAS_MAX_HEIGHT, (size_t)maxTextureSize);
+	g_maxCubeMapSize = std::min<size_t>(SHADOW_CUBE_MAP_SIZE, ShadowAtlas::FloorPowerOfTwo((size_t)maxCubeMapTextureSize));
+	GLint maxTextureBufferSize;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+	g_maxTextureBufferSize = (size_t)maxTextureBufferSize;
+
+	//////////////////////////////////////////////////////////////////////////
+	// Initialize AntTweakBar
+	TwInit(TW_OPENGL_CORE, 0);
+
+	defineAnttweakbarStructs();
+
+	auto bar0 = TwNewBar("Global");
+	TwDefine(" Global position='10 10' size='400 400' ");
+	TwWindowSize(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+	TwAddSeparator(bar0, 0, " group='Scene' ");
+	TwAddStringVarRO<0>(bar0, "OBJ", argv[1], "group=Scene");
+	setTex0Callback<0>(DEFAULT_OBJ_TEX0_FILENAME);
+	setTex0Callback<1>(DEFAULT_GROUND_TEX0_FILENAME);
+	TwAddVarCB(bar0, "Diffuse Map (OBJ)", TW_TYPE_CSSTRING(256), setTex0Callback<0>, getTex0Callback<0>, 0, "group=Scene");
+	TwAddVarCB(bar0, "Diffuse Map (ground)", TW_TYPE_CSSTRING(256), setTex0Callback<1>, getTex0Callback<1>, 0, "group=Scene");
+	TwAddVarRW(bar0, "Ambient Color", g_vec3Type, &g_ambientColor, "group=Scene");
+	TwAddVarRW(bar0, "Specular Color", g_vec3Type, &g_specularColor, "group=Scene");
+	TwAddVarRW(bar0, "Specularity", TW_TYPE_FLOAT, &g_specularity, "group=Scene");
+	TwAddVarRW(bar0, "Animate OBJ", TW_TYPE_BOOLCPP, &g_animateObj, "group=Scene");
+	TwAddVarRW(bar0, "# Dynamic Casters", TW_TYPE_INT32, &g_numDynamicCasters, "min=0 max=8 group=Scene");
+	TwAddVarRW(bar0, "Reverse-Z (Clip Control)", TW_TYPE_BOOLCPP, &g_reverseZ, "group=Scene");
+
+	TwAddSeparator(bar0, 0, " group='Shadows' ");
+	TwAddVarRW(bar0, "Shadow Map Bias (Directional Light)", TW_TYPE_FLOAT, &g_directionalLightShadowMapBias, "step=0.0001 group=Shadows");
+	TwAddVarRW(bar0, "Shadow Map Bias (Point Light)", TW_TYPE_FLOAT, &g_pointLightShadowMapBias, "step=0.0001 group=Shadows");
+	TwAddVarRW(bar0, "Draw Shadow Map", TW_TYPE_BOOLCPP, &g_drawShadowMap, "group=Shadows");
+	TwAddVarRW(bar0, "Shadow Map Index", TW_TYPE_INT32, &g_shadowMapIndex, "group=Shadows");
+	std::string definitionStr = "min=" + std::to_string(MIN_NUM_SAMPLES) + " max=" + std::to_string(MAX_NUM_SAMPLES) + " group=Shadows";
 	TwAddVarCB(bar0, "# Blocker Search Samples", TW_TYPE_INT32, setNumBlockerSearchSamplesCallback, getNumBlockerSearchSamplesCallback, 0, definitionStr.c_str());
 	TwAddVarCB(bar0, "# PCF Samples", TW_TYPE_INT32, setNumPCFSamplesCallback, getNumPCFSamplesCallback, 0, definitionStr.c_str());
+	TwAddVarRW(bar0, "Rotate Samples (Blue Noise)", TW_TYPE_BOOLCPP, &g_rotateSamples, "group=Shadows");
+	TwAddVarRW(bar0, "Shadow LOD (Soft Shadows)", TW_TYPE_BOOLCPP, &g_shadowLOD, "group=Shadows");
+	TwAddVarRW(bar0, "Shadow LOD Mid Distance", TW_TYPE_FLOAT, &g_shadowLODMidDistance, "min=0 step=0.5 group=Shadows");
+	TwAddVarRW(bar0, "Shadow LOD Far Distance", TW_TYPE_FLOAT, &g_shadowLODFarDistance, "min=0 step=0.5 group=Shadows");
+	TwAddVarRW(bar0, "Shadow LOD Transition", TW_TYPE_FLOAT, &g_shadowLODTransition, "min=0 step=0.5 group=Shadows");
+	TwAddVarRW(bar0, "Shadow LOD Mid Sample Scale", TW_TYPE_FLOAT, &g_shadowLODMidSampleScale, "min=0 max=1 step=0.05 group=Shadows");
+	TwAddVarRW(bar0, "Shadow LOD Filtered Far Tap", TW_TYPE_BOOLCPP, &g_shadowLODFilteredTap, "group=Shadows");
+	TwAddVarRW(bar0, "Shadow LOD Footprint (Grazing Angles)", TW_TYPE_BOOLCPP, &g_shadowLODFootprint, "group=Shadows");
+	TwAddVarRW(bar0, "Use Texture Gather", TW_TYPE_BOOLCPP, &g_useTextureGather, "group=Shadows");
 	TwAddVarRW(bar0, "Display Mode", g_displayModeType, &g_displayMode, " group=Shadows");
+	TwAddVarRW(bar0, "Moment Filtering", g_momentFilteringType, &g_momentFiltering, " group=Shadows");
+	TwAddVarRW(bar0, "Min/Max Shadow Maps (Soft Shadows)", TW_TYPE_BOOLCPP, &g_minMaxShadowMaps, "group=Shadows");
+	TwAddVarRW(bar0, "Point Light Shadows", g_pointLightShadowsType, &g_pointLightShadows, " group=Shadows");
+	TwAddVarRW(bar0, "Shadow Map Format", g_shadowMapFormatType, &g_shadowMapFormat, " group=Shadows");
+	TwAddVarRW(bar0, "Shadow Map Budget (MB)", TW_TYPE_FLOAT, &g_shadowMapBudget, "min=16 step=16 group=Shadows");
+	TwAddVarRW(bar0, "Virtual Shadow Maps (Directional Lights)", TW_TYPE_BOOLCPP, &g_virtualShadowMaps, "group=Shadows");
+	TwAddVarRW(bar0, "Cache Shadow Maps", TW_TYPE_BOOLCPP, &g_cacheShadowMaps, "group=Shadows");
+	TwAddVarRW(bar0, "Cache Static Casters", TW_TYPE_BOOLCPP, &g_splitStaticCasters, "group=Shadows");
+	TwAddVarRW(bar0, "Warp Shadow Maps (LiSPSM)", TW_TYPE_BOOLCPP, &g_warpShadowMaps, "group=Shadows");
+	TwAddVarRW(bar0, "Shadow Warp Factor", TW_TYPE_FLOAT, &g_shadowWarpFactor, "min=0.1 step=0.1 group=Shadows");
+	TwAddVarRW(bar0, "Multi-Pass Shadows (Single Shadow Map)", TW_TYPE_BOOLCPP, &g_multiPassShadows, "group=Shadows");
+	TwAddVarRW(bar0, "Shadow Masks (Split Pass)", TW_TYPE_BOOLCPP, &g_shadowMasks, "group=Shadows");
+	TwAddVarRW(bar0, "Amortize Shadow Updates", TW_TYPE_BOOLCPP, &g_amortizeShadowUpdates, "group=Shadows");
+	TwAddVarRW(bar0, "Shadow Update Budget (ms)", TW_TYPE_FLOAT, &g_shadowUpdateBudget, "min=0.1 step=0.1 group=Shadows");
+
+	TwAddSeparator(bar0, 0, " group='Performance' ");
+	TwAddVarRO(bar0, "Visible Lights", TW_TYPE_INT32, &g_numVisibleLights, "group=Performance");
+	TwAddVarRO(bar0, "Culled Lights", TW_TYPE_INT32, &g_numCulledLights, "group=Performance");
+	TwAddVarRO(bar0, "Shadow Passes (ms)", TW_TYPE_FLOAT, &g_shadowPassesTime, "precision=3 group=Performance");
+	TwAddVarRO(bar0, "Shadow Draw Calls", TW_TYPE_INT32, &g_shadowDrawCalls, "group=Performance");
+	TwAddVarRO(bar0, "Cached Shadow Maps", TW_TYPE_INT32, &g_numCachedShadowMaps, "group=Performance");
+	TwAddVarRO(bar0, "Scheduled Shadow Maps", TW_TYPE_INT32, &g_numScheduledShadowMaps, "group=Performance");
+	TwAddVarRO(bar0, "Deferred Shadow Maps", TW_TYPE_INT32, &g_numDeferredShadowMaps, "group=Performance");
+	TwAddVarRO(bar0, "Skipped Cube Faces", TW_TYPE_INT32, &g_numSkippedCubeFaces, "group=Performance");
+	TwAddVarRO(bar0, "Max. Shadow Map Age", TW_TYPE_INT32, &g_maxShadowMapAge, "group=Performance");
+	TwAddVarRO(bar0, "Shadow Update Cost (ms/MTexel)", TW_TYPE_FLOAT, &g_shadowUpdateCost, "precision=4 group=Performance");
+	TwAddVarRO(bar0, "Shadow Schedule (scheduled | deferred:age)", TW_TYPE_CSSTRING(sizeof(g_shadowSchedule)), g_shadowSchedule, "group=Performance");
+	TwAddVarRO(bar0, "Shadow Map Memory (MB)", TW_TYPE_FLOAT, &g_shadowMapMemory, "precision=1 group=Performance");
+	TwAddVarRO(bar0, "Peak Shadow Map Memory (MB)", TW_TYPE_FLOAT, &g_peakShadowMapMemory, "precision=1 group=Performance");
+	TwAddVarRO(bar0, "Resident Pages", TW_TYPE_INT32, &g_numResidentPages, "group=Performance");
+	TwAddVarRO(bar0, "Rendered Pages", TW_TYPE_INT32, &g_numRenderedPages, "group=Performance");
+	TwAddVarRO(bar0, "Missing Pages", TW_TYPE_INT32, &g_numMissingPages, "group=Performance");
+	TwAddVarRO(bar0, "Moment Passes (ms)", TW_TYPE_FLOAT, &g_momentPassesTime, "precision=3 group=Performance");
+	TwAddVarRO(bar0, "Min/Max Passes (ms)", TW_TYPE_FLOAT, &g_minMaxPassesTime, "precision=3 group=Performance");
+	TwAddVarRO(bar0, "Forward Pass (ms)", TW_TYPE_FLOAT, &g_forwardPassTime, "precision=3 group=Performance");
+	TwAddVarRO(bar0, "Frame Time (ms)", TW_TYPE_FLOAT, &g_frameTime, "precision=3 group=Performance");
+	TwAddVarRW(bar0, "Dynamic Resolution", TW_TYPE_BOOLCPP, &g_dynamicResolution, "group=Performance");
+	TwAddVarRW(bar0, "Target Frame Time (ms)", TW_TYPE_FLOAT, &g_targetFrameTime, "min=1 step=0.5 group=Performance");
+	TwAddVarRO(bar0, "Quality Level", TW_TYPE_INT32, &g_qualityLevel, "group=Performance");
+	TwAddVarRO(bar0, "Render Scale", TW_TYPE_FLOAT, &g_renderScale, "precision=2 group=Performance");
+	TwAddVarRO(bar0, "Shadow Map Scale", TW_TYPE_FLOAT, &g_shadowMapScale, "precision=2 group=Performance");
+	TwAddVarRO(bar0, "Sample Scale", TW_TYPE_FLOAT, &g_sampleScale, "precision=2 group=Performance");
+	TwAddVarCB(bar0, "Record Camera Path", TW_TYPE_BOOLCPP, setRecordCameraPathCallback, getRecordCameraPathCallback, 0, "group=Performance");
+	TwAddVarRO(bar0, "Camera Path Frames", TW_TYPE_INT32, &g_numCameraPathKeys, "group=Performance");
+	TwAddButton(bar0, "Tune PCSS (Camera Path)", tunePCSSCallback, 0, "group=Performance");
+	TwAddVarRO(bar0, "Tuning Progress (%)", TW_TYPE_FLOAT, &g_tuningProgress, "precision=1 group=Performance");
+	TwAddVarRO(bar0, "Light Passes", TW_TYPE_INT32, &g_numLightPasses, "group=Performance");
+	TwAddVarRO(bar0, "Light Grid Build (ms)", TW_TYPE_FLOAT, &g_lightGridBuildTime, "precision=3 group=Performance");
+	TwAddVarRO(bar0, "Max. Lights per Cluster", TW_TYPE_INT32, &g_maxLightsPerCluster, "group=Performance");
+	TwAddVarRO(bar0, "Cluster Overflows", TW_TYPE_INT32, &g_numClusterOverflows, "group=Performance");
 
 	TwAddSeparator(bar0, 0, " group='Lights' ");
 	TwAddVarRW(bar0, "Animate Lights", TW_TYPE_BOOLCPP, &g_animateLights, "group=Lights");
 	TwAddVarRW(bar0, "Selected Light", TW_TYPE_INT32, &g_selectedLightSource, "group=Lights");
 	TwAddVarRW(bar0, "Light Type", g_lightType, &g_selectedLightType, "group=Lights");
 	TwAddButton(bar0, "Add Light", addLightCallback, 0, "group=Lights");
+	TwAddVarRW(bar0, "Light Cutoff", TW_TYPE_FLOAT, &g_lightCutoff, "min=0.001 step=0.005 group=Lights");
+	TwAddVarRW(bar0, "Cull Lights", TW_TYPE_BOOLCPP, &g_cullLights, "group=Lights");
+	TwAddVarRW(bar0, "Clustered Lighting", TW_TYPE_BOOLCPP, &g_clusteredLighting, "group=Lights");
+	TwAddVarRW(bar0, "# Clustered Lights", TW_TYPE_INT32, &g_numClusteredLights, ("min=0 max=" + std::to_string(MAX_NUM_CLUSTERED_LIGHTS) + " group=Lights").c_str());
 
 	//////////////////////////////////////////////////////////////////////////
 	// Setup basic GL states
@@ -613,6 +2208,17 @@ int main(int argc, char** argv)
 		Shader shader0(SHADERS_DIR + "shadow_pass.vs.glsl", SHADERS_DIR + "shadow_pass.fs.glsl");
 		Shader shader1(SHADERS_DIR + "fullscreen.vs.glsl", SHADERS_DIR + "draw_shadow_map.fs.glsl");
 		Shader shader2(SHADERS_DIR + "common.vs.glsl", SHADERS_DIR + "blinn_phong_textured_and_shadowed.fs.glsl");
+		Shader shader3(SHADERS_DIR + "fullscreen.vs.glsl", SHADERS_DIR + "shadow_moments.fs.glsl");
+		Shader shader4(SHADERS_DIR + "fullscreen.vs.glsl", SHADERS_DIR + "gaussian_blur.fs.glsl");
+		Shader shader5(SHADERS_DIR + "fullscreen.vs.glsl", SHADERS_DIR + "summed_area_table.fs.glsl");
+		Shader shader6(SHADERS_DIR + "shadow_pass_layered.vs.glsl", SHADERS_DIR + "shadow_pass_layered.gs.glsl", SHADERS_DIR + "shadow_pass_point_light.fs.glsl");
+		Shader shader7(SHADERS_DIR + "shadow_pass_paraboloid.vs.glsl", SHADERS_DIR + "shadow_pass_point_light.fs.glsl");
+		Shader shader8(SHADERS_DIR + "shadow_pass_spot_light.vs.glsl", SHADERS_DIR + "shadow_pass_point_light.fs.glsl");
+		Shader shader9(SHADERS_DIR + "common.vs.glsl", SHADERS_DIR + "virtual_shadow_map_feedback.fs.glsl");
+		Shader shader10(SHADERS_DIR + "common.vs.glsl", SHADERS_DIR + "blinn_phong_textured_and_shadowed.fs.glsl", std::vector<std::string>{ "SHADOW_MASKS" });
+		Shader shader11(SHADERS_DIR + "fullscreen.vs.glsl", SHADERS_DIR + "min_max_shadow_map.fs.glsl");
+		Shader shader12(SHADERS_DIR + "shadow_pass.vs.glsl", SHADERS_DIR + "shadow_pass.fs.glsl", std::vector<std::string>{ "WARPED" });
+		Shader shader13(SHADERS_DIR + "common.vs.glsl", SHADERS_DIR + "blinn_phong_textured_and_shadowed.fs.glsl", std::vector<std::string>{ "SHADOW_MASK_PASS" });
 
 		//////////////////////////////////////////////////////////////////////////
 		// Load OBJ file
@@ -627,6 +2233,14 @@ int main(int argc, char** argv)
 		}
 		Mesh objMesh(vertices, uvs, normals);
 
+		// NOTE: bounds of the shadow casters (i.e., the OBJ), used to request virtual shadow map pages
+		glm::vec3 objMin(FLT_MAX), objMax(-FLT_MAX);
+		for (auto& vertex : vertices)
+		{
+			objMin = glm::min(objMin, vertex);
+			objMax = glm::max(objMax, vertex);
+		}
+
 		vertices.clear();
 		uvs.clear();
 		normals.clear();
@@ -646,53 +2260,244 @@ int main(int argc, char** argv)
 		glBindFramebuffer(GL_FRAMEBUFFER, g_framebuffer);
 		glDrawBuffer(GL_NONE);
 		glReadBuffer(GL_NONE);
+		glGenFramebuffers(1, &g_staticFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, g_staticFramebuffer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		// NOTE: moment maps are blurred in two separable passes, ping-ponging with this (single layer) texture
+		glGenTextures(1, &g_momentBlurTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, g_momentBlurTexture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, MOMENT_MAP_SIZE, MOMENT_MAP_SIZE, 1, 0, GL_RGBA, GL_FLOAT, 0);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		glGenFramebuffers(1, &g_momentFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, g_momentFramebuffer);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 		GLint uModelViewProjection0 = glGetUniformLocation(shader0, "modelViewProjection");
 
-		GLint uModel_shader2 = glGetUniformLocation(shader2, "model");
-		GLint uView_shader2 = glGetUniformLocation(shader2, "view");
-		GLint uInvView_shader2 = glGetUniformLocation(shader2, "invView");
-		GLint uProjection_shader2 = glGetUniformLocation(shader2, "projection");
-		GLint uLightProjection_shader2 = glGetUniformLocation(shader2, "lightProjection");
-		GLint uEyePosition_shader2 = glGetUniformLocation(shader2, "eyePosition");
-		GLint uTex0_shader2 = glGetUniformLocation(shader2, "tex0");
-		GLint uAmbientColor_shader2 = glGetUniformLocation(shader2, "ambientColor");
-		GLint uSpecularColor_shader2 = glGetUniformLocation(shader2, "specularColor");
-		GLint uSpecularity_shader2 = glGetUniformLocation(shader2, "specularity");
-		GLint uDirectionalLightShadowMapBias_shader2 = glGetUniformLocation(shader2, "directionalLightShadowMapBias");
-		GLint uPointLightShadowMapBias_shader2 = glGetUniformLocation(shader2, "pointLightShadowMapBias");
-		GLint uFrustumSize_shader2 = glGetUniformLocation(shader2, "frustumSize");
-		GLint uDistribution0_shader2 = glGetUniformLocation(shader2, "distribution0");
-		GLint uDistribution1_shader2 = glGetUniformLocation(shader2, "distribution1");
-		GLint uNumBlockerSearchSamples_shader2 = glGetUniformLocation(shader2, "numBlockerSearchSamples");
-		GLint uNumPCFSamples_shader2 = glGetUniformLocation(shader2, "numPCFSamples");
-		GLint uDisplayMode_shader2 = glGetUniformLocation(shader2, "displayMode");
-		GLint uSelectedLightSource_shader2 = glGetUniformLocation(shader2, "selectedLightSource");
+		GLint uModelViewProjection_shader12 = glGetUniformLocation(shader12, "modelViewProjection");
+		GLint uWarp_shader12 = glGetUniformLocation(shader12, "warp");
+
+		GLint uFaceViewProjections_shader6 = glGetUniformLocation(shader6, "faceViewProjections");
+		GLint uLightPosition_shader6 = glGetUniformLocation(shader6, "lightPosition");
+		GLint uFarPlane_shader6 = glGetUniformLocation(shader6, "farPlane");
+		GLint uModel_shader6 = glGetUniformLocation(shader6, "model");
+		GLint uFaces_shader6 = glGetUniformLocation(shader6, "faces");
+
+		GLint uLightPosition_shader7 = glGetUniformLocation(shader7, "lightPosition");
+		GLint uFarPlane_shader7 = glGetUniformLocation(shader7, "farPlane");
+		GLint uHemisphere_shader7 = glGetUniformLocation(shader7, "hemisphere");
+		GLint uModel_shader7 = glGetUniformLocation(shader7, "model");
+
+		GLint uViewProjection_shader8 = glGetUniformLocation(shader8, "viewProjection");
+		GLint uLightPosition_shader8 = glGetUniformLocation(shader8, "lightPosition");
+		GLint uFarPlane_shader8 = glGetUniformLocation(shader8, "farPlane");
+		GLint uModel_shader8 = glGetUniformLocation(shader8, "model");
+
+		GLint uModel_shader9 = glGetUniformLocation(shader9, "model");
+		GLint uView_shader9 = glGetUniformLocation(shader9, "view");
+		GLint uProjection_shader9 = glGetUniformLocation(shader9, "projection");
+
+		GLint uShadowMap_shader3 = glGetUniformLocation(shader3, "shadowMap");
+		GLint uOrigin_shader3 = glGetUniformLocation(shader3, "origin");
+		GLint uDownsampling_shader3 = glGetUniformLocation(shader3, "downsampling");
+		GLint uUpsampling_shader3 = glGetUniformLocation(shader3, "upsampling");
+
+		GLint uSource_shader4 = glGetUniformLocation(shader4, "source");
+		GLint uDirection_shader4 = glGetUniformLocation(shader4, "direction");
+		GLint uLayer_shader4 = glGetUniformLocation(shader4, "layer");
+
+		GLint uSource_shader5 = glGetUniformLocation(shader5, "source");
+		GLint uLayer_shader5 = glGetUniformLocation(shader5, "layer");
+		GLint uDirection_shader5 = glGetUniformLocation(shader5, "direction");
+		GLint uStride_shader5 = glGetUniformLocation(shader5, "stride");
+		GLint uAverageLevel_shader5 = glGetUniformLocation(shader5, "averageLevel");
+
+		GLint uShadowMap_shader11 = glGetUniformLocation(shader11, "shadowMap");
+		GLint uSource_shader11 = glGetUniformLocation(shader11, "source");
+		GLint uLevel_shader11 = glGetUniformLocation(shader11, "level");
+		GLint uLayer_shader11 = glGetUniformLocation(shader11, "layer");
+		GLint uOrigin_shader11 = glGetUniformLocation(shader11, "origin");
+		GLint uDownsampling_shader11 = glGetUniformLocation(shader11, "downsampling");
+		GLint uUpsampling_shader11 = glGetUniformLocation(shader11, "upsampling");
+
+		// NOTE: shadow uniforms of the forward program, which is the shadow mask pass variant (shader13) while shadow masks are on
+		// (shader2 is only drawn with when they are off), looked up again whenever it changes (see forwardProgram)
+		GLint uModel_shader2, uView_shader2, uProjection_shader2, uPointLightNear_shader2, uPointLightFar_shader2, uUseDualParaboloids_shader2,
+			uEyePosition_shader2, uTex0_shader2, uAmbientColor_shader2, uSpecularColor_shader2, uSpecularity_shader2, uDirectionalLightShadowMapBias_shader2,
+			uPointLightShadowMapBias_shader2, uShadowMapRects_shader2, uShadowAtlasSize_shader2, uShadowMapLightPositions_shader2, uEmptyCubeFaces_shader2,
+			uUseVirtualShadowMaps_shader2, uPageTables_shader2, uVirtualPagesPerSide_shader2, uPhysicalPagesPerSide_shader2, uMomentMaps_shader2,
+			uMomentMapSize_shader2, uSummedAreaTables_shader2, uUseSummedAreaTables_shader2, uFrustumSize_shader2, uBlueNoise_shader2, uRotateSamples_shader2,
+			uUseTextureGather_shader2, uNumBlockerSearchSamples_shader2, uNumPCFSamples_shader2, uUseShadowLOD_shader2, uShadowLODMidDistance_shader2,
+			uShadowLODFarDistance_shader2, uShadowLODTransition_shader2, uShadowLODMidSampleScale_shader2, uUseShadowLODFilteredTap_shader2,
+			uUseShadowLODFootprint_shader2, uPixelFootprint_shader2, uDisplayMode_shader2, uSelectedLightSource_shader2, uCulledLights_shader2,
+			uUseClusteredLighting_shader2, uClusterData_shader2, uClusteredLights_shader2, uClusterGridSize_shader2, uScreenSize_shader2,
+			uClusterNear_shader2, uClusterFar_shader2, uUseMinMaxShadowMaps_shader2, uWarpedShadowMaps_shader2, uShadowMapWarps_shader2, uMinMaxMaps_shader2;
+		auto getUniformLocations_shader2 = [&](GLuint program)
+		{
+			uModel_shader2 = glGetUniformLocation(program, "model");
+			uView_shader2 = glGetUniformLocation(program, "view");
+			uProjection_shader2 = glGetUniformLocation(program, "projection");
+			uPointLightNear_shader2 = glGetUniformLocation(program, "pointLightNear");
+			uPointLightFar_shader2 = glGetUniformLocation(program, "pointLightFar");
+			uUseDualParaboloids_shader2 = glGetUniformLocation(program, "useDualParaboloids");
+			uEyePosition_shader2 = glGetUniformLocation(program, "eyePosition");
+			uTex0_shader2 = glGetUniformLocation(program, "tex0");
+			uAmbientColor_shader2 = glGetUniformLocation(program, "ambientColor");
+			uSpecularColor_shader2 = glGetUniformLocation(program, "specularColor");
+			uSpecularity_shader2 = glGetUniformLocation(program, "specularity");
+			uDirectionalLightShadowMapBias_shader2 = glGetUniformLocation(program, "directionalLightShadowMapBias");
+			uPointLightShadowMapBias_shader2 = glGetUniformLocation(program, "pointLightShadowMapBias");
+			uShadowMapRects_shader2 = glGetUniformLocation(program, "shadowMapRects");
+			uShadowAtlasSize_shader2 = glGetUniformLocation(program, "shadowAtlasSize");
+			uShadowMapLightPositions_shader2 = glGetUniformLocation(program, "shadowMapLightPositions");
+			uEmptyCubeFaces_shader2 = glGetUniformLocation(program, "emptyCubeFaces");
+			uUseVirtualShadowMaps_shader2 = glGetUniformLocation(program, "useVirtualShadowMaps");
+			uPageTables_shader2 = glGetUniformLocation(program, "pageTables");
+			uVirtualPagesPerSide_shader2 = glGetUniformLocation(program, "virtualPagesPerSide");
+			uPhysicalPagesPerSide_shader2 = glGetUniformLocation(program, "physicalPagesPerSide");
+			uMomentMaps_shader2 = glGetUniformLocation(program, "momentMaps");
+			uMomentMapSize_shader2 = glGetUniformLocation(program, "momentMapSize");
+			uSummedAreaTables_shader2 = glGetUniformLocation(program, "summedAreaTables");
+			uUseSummedAreaTables_shader2 = glGetUniformLocation(program, "useSummedAreaTables");
+			uFrustumSize_shader2 = glGetUniformLocation(program, "frustumSize");
+			uBlueNoise_shader2 = glGetUniformLocation(program, "blueNoise");
+			uRotateSamples_shader2 = glGetUniformLocation(program, "rotateSamples");
+			uUseTextureGather_shader2 = glGetUniformLocation(program, "useTextureGather");
+			uNumBlockerSearchSamples_shader2 = glGetUniformLocation(program, "numBlockerSearchSamples");
+			uNumPCFSamples_shader2 = glGetUniformLocation(program, "numPCFSamples");
+			uUseShadowLOD_shader2 = glGetUniformLocation(program, "useShadowLOD");
+			uShadowLODMidDistance_shader2 = glGetUniformLocation(program, "shadowLODMidDistance");
+			uShadowLODFarDistance_shader2 = glGetUniformLocation(program, "shadowLODFarDistance");
+			uShadowLODTransition_shader2 = glGetUniformLocation(program, "shadowLODTransition");
+			uShadowLODMidSampleScale_shader2 = glGetUniformLocation(program, "shadowLODMidSampleScale");
+			uUseShadowLODFilteredTap_shader2 = glGetUniformLocation(program, "useShadowLODFilteredTap");
+			uUseShadowLODFootprint_shader2 = glGetUniformLocation(program, "useShadowLODFootprint");
+			uPixelFootprint_shader2 = glGetUniformLocation(program, "pixelFootprint");
+			uDisplayMode_shader2 = glGetUniformLocation(program, "displayMode");
+			uSelectedLightSource_shader2 = glGetUniformLocation(program, "selectedLightSource");
+			uCulledLights_shader2 = glGetUniformLocation(program, "culledLights");
+			uUseClusteredLighting_shader2 = glGetUniformLocation(program, "useClusteredLighting");
+			uClusterData_shader2 = glGetUniformLocation(program, "clusterData");
+			uClusteredLights_shader2 = glGetUniformLocation(program, "clusteredLights");
+			uClusterGridSize_shader2 = glGetUniformLocation(program, "clusterGridSize");
+			uScreenSize_shader2 = glGetUniformLocation(program, "screenSize");
+			uClusterNear_shader2 = glGetUniformLocation(program, "clusterNear");
+			uClusterFar_shader2 = glGetUniformLocation(program, "clusterFar");
+			uUseMinMaxShadowMaps_shader2 = glGetUniformLocation(program, "useMinMaxShadowMaps");
+			uWarpedShadowMaps_shader2 = glGetUniformLocation(program, "warpedShadowMaps");
+			uShadowMapWarps_shader2 = glGetUniformLocation(program, "shadowMapWarps");
+			uMinMaxMaps_shader2 = glGetUniformLocation(program, "minMaxMaps");
+		};
+		GLuint forwardProgram = shader2;
+		getUniformLocations_shader2(forwardProgram);
+
+		GLint uModel_shader10 = glGetUniformLocation(shader10, "model");
+		GLint uView_shader10 = glGetUniformLocation(shader10, "view");
+		GLint uProjection_shader10 = glGetUniformLocation(shader10, "projection");
+		GLint uEyePosition_shader10 = glGetUniformLocation(shader10, "eyePosition");
+		GLint uTex0_shader10 = glGetUniformLocation(shader10, "tex0");
+		GLint uAmbientColor_shader10 = glGetUniformLocation(shader10, "ambientColor");
+		GLint uSpecularColor_shader10 = glGetUniformLocation(shader10, "specularColor");
+		GLint uSpecularity_shader10 = glGetUniformLocation(shader10, "specularity");
+		GLint uCulledLights_shader10 = glGetUniformLocation(shader10, "culledLights");
+		GLint uShadowMasks0_shader10 = glGetUniformLocation(shader10, "shadowMasks0");
+		GLint uShadowMasks1_shader10 = glGetUniformLocation(shader10, "shadowMasks1");
+		GLint uUseClusteredLighting_shader10 = glGetUniformLocation(shader10, "useClusteredLighting");
+		GLint uClusterData_shader10 = glGetUniformLocation(shader10, "clusterData");
+		GLint uClusteredLights_shader10 = glGetUniformLocation(shader10, "clusteredLights");
+		GLint uClusterGridSize_shader10 = glGetUniformLocation(shader10, "clusterGridSize");
+		GLint uScreenSize_shader10 = glGetUniformLocation(shader10, "screenSize");
+		GLint uClusterNear_shader10 = glGetUniformLocation(shader10, "clusterNear");
+		GLint uClusterFar_shader10 = glGetUniformLocation(shader10, "clusterFar");
 
 		glm::mat4 objModel(1);
 		glm::mat4 planeModel(glm::translate(glm::mat4(1), glm::vec3(0, -0.25f, 0)));
 
+		// NOTE: dynamic casters are smaller copies of the OBJ orbiting it
+		auto objCenter = (objMin + objMax) * 0.5f;
+		auto orbitRadius = std::max(objMax.x - objMin.x, objMax.z - objMin.z) * 0.75f;
+		float orbitAngle = 0;
+		auto getDynamicCasterModel = [&](int k)
+		{
+			auto angle = orbitAngle + k * 2.0f * glm::pi<float>() / std::max(1, g_numDynamicCasters);
+			return glm::translate(glm::mat4(1), objCenter + glm::vec3(std::cos(angle), 0, std::sin(angle)) * orbitRadius) * glm::scale(glm::mat4(1), glm::vec3(0.25f)) * glm::translate(glm::mat4(1), -objCenter);
+		};
+
 		//////////////////////////////////////////////////////////////////////////
 		// Create light sources uniform buffer
 
 		GLuint lightSourcesBlockIndex = glGetUniformBlockIndex(shader2, "LightSources");
-		glUniformBlockBinding(shader2, lightSourcesBlockIndex, 0);
 		GLuint lightSourcesUniformBuffer = 0;
 		if (lightSourcesBlockIndex != GL_INVALID_INDEX)
 		{
+			glUniformBlockBinding(shader2, lightSourcesBlockIndex, LIGHT_SOURCES_BINDING_POINT);
+			glUniformBlockBinding(shader13, glGetUniformBlockIndex(shader13, "LightSources"), LIGHT_SOURCES_BINDING_POINT);
 			glGenBuffers(1, &lightSourcesUniformBuffer);
-			glBindBufferBase(GL_UNIFORM_BUFFER, lightSourcesBlockIndex, lightSourcesUniformBuffer);
+			glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_SOURCES_BINDING_POINT, lightSourcesUniformBuffer);
 		}
+		GLuint lightSourcesBlockIndex_shader10 = glGetUniformBlockIndex(shader10, "LightSources");
+		if (lightSourcesBlockIndex_shader10 != GL_INVALID_INDEX)
+			glUniformBlockBinding(shader10, lightSourcesBlockIndex_shader10, LIGHT_SOURCES_BINDING_POINT);
 		glBindBuffer(GL_UNIFORM_BUFFER, lightSourcesUniformBuffer);
 		glBufferData(GL_UNIFORM_BUFFER, sizeof(LightSource) * MAX_NUM_LIGHT_SOURCES, 0, GL_DYNAMIC_DRAW);
 		glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
 		//////////////////////////////////////////////////////////////////////////
-		// Create Poisson-disc distributions
-		glGenTextures(2, g_distributions);
-		createPoissonDiscDistribution(g_distributions[0], g_numBlockerSearchSamples);
-		createPoissonDiscDistribution(g_distributions[1], g_numPCFSamples);
+		// Create Poisson-disc distributions uniform buffer
+
+		GLuint distributionsBlockIndex = glGetUniformBlockIndex(shader2, "Distributions");
+		if (distributionsBlockIndex != GL_INVALID_INDEX)
+		{
+			glUniformBlockBinding(shader2, distributionsBlockIndex, DISTRIBUTIONS_BINDING_POINT);
+			glUniformBlockBinding(shader13, glGetUniformBlockIndex(shader13, "Distributions"), DISTRIBUTIONS_BINDING_POINT);
+		}
+		glGenBuffers(1, &g_distributionsUniformBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, g_distributionsUniformBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, NUM_DISTRIBUTIONS * MAX_NUM_SAMPLES * sizeof(glm::vec2), 0, GL_STATIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, DISTRIBUTIONS_BINDING_POINT, g_distributionsUniformBuffer);
+
+		updateSampleDistributions();
+
+		//////////////////////////////////////////////////////////////////////////
+		// Create comparison sampler (hardware depth comparison in PCF, shadow map textures themselves are sampled without comparison)
+
+		glGenSamplers(1, &g_comparisonSampler);
+		glSamplerParameteri(g_comparisonSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glSamplerParameteri(g_comparisonSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(g_comparisonSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glSamplerParameteri(g_comparisonSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glSamplerParameteri(g_comparisonSampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glSamplerParameteri(g_comparisonSampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		GPUTimer shadowPassesTimer;
+		GPUTimer momentPassesTimer;
+		GPUTimer minMaxPassesTimer;
+		GPUTimer forwardPassTimer;
+		DynamicResolution::Controller qualityController;
+
+		//////////////////////////////////////////////////////////////////////////
+		// Create blue-noise texture (per-pixel rotation of the Poisson-disc distributions)
+		glGenTextures(1, &g_blueNoise);
+		createBlueNoiseTexture(g_blueNoise);
+
+		//////////////////////////////////////////////////////////////////////////
+		// Create clustered lights and light grid (texture buffers, re-uploaded every frame)
+		createClusteredLights();
+		createTextureBuffer(g_clusterDataBuffer, g_clusterDataTexture, GL_R32UI);
+		createTextureBuffer(g_clusteredLightsBuffer, g_clusteredLightsTexture, GL_RGBA32F);
+		uploadTextureBuffer(g_clusteredLightsBuffer, &g_clusteredLights[0], g_clusteredLights.size() * sizeof(glm::vec4));
+		ClusteredLighting::Grid lightGrid(CLUSTER_GRID_WIDTH, CLUSTER_GRID_HEIGHT, CLUSTER_GRID_DEPTH);
+		std::vector<ClusteredLighting::Sphere> clusteredLightSpheres;
+		std::vector<uint32_t> clusterData;
 
 		while (!glfwWindowShouldClose(window))
 		{
@@ -703,61 +2508,549 @@ int main(int argc, char** argv)
 
 			//glCullFace(GL_FRONT);
 
-			glBindFramebuffer(GL_FRAMEBUFFER, g_framebuffer);
-			glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+			// NOTE: unsmoothed GPU time of the passes whose query results were read this frame (for the tuner, which compares settings frame by frame)
+			auto frameGPUTime = 0.0f;
+
+			shadowPassesTimer.begin();
+
+			// NOTE: the tuner drives the settings and the camera, at full resolution
+			if (g_tuningSession != nullptr)
+			{
+				g_dynamicResolution = false;
+				g_navigatorAnimation = nullptr;
+				applyTuningSettings(g_tuningSession->getSettings());
+				auto& key = g_cameraPath[std::min(g_tuningSession->getKey() * g_tuningPathStride, g_cameraPath.size() - 1)];
+				g_navigator.setPosition(key.position);
+				g_navigator.setOrientation(key.phi, key.theta);
+			}
+
+			// NOTE: offscreen camera targets are reallocated with the depth format of the new convention
+			if (g_camera.reversedDepth != useReverseZ())
+			{
+				g_camera.reversedDepth = useReverseZ();
+				g_feedbackWidth = g_accumulationWidth = g_shadowMaskWidth = g_sceneWidth = 0;
+			}
+
+			g_renderWidth = std::max(1, (int)(g_screenWidth * g_renderScale));
+			g_renderHeight = std::max(1, (int)(g_screenHeight * g_renderScale));
+			if (useSceneFramebuffer())
+				updateSceneFramebuffer();
+			updateSampleDistributions();
+
+			auto multiPass = isMultiPassShadows();
+
+			// NOTE: lights whose influence is outside the camera frustum are skipped by both the shadow and the forward passes
+			auto cameraViewProjection = g_camera.getProjection(g_aspectRatio) * g_navigator.getLocalToWorldTransform();
+			std::vector<bool> isCulled(g_lightSources.size(), false);
+			int culledLights = 0;
+			g_numVisibleLights = g_numCulledLights = 0;
 			for (auto i = 0; i < g_lightSources.size(); i++)
 			{
 				auto& lightSource = g_lightSources[i];
+				lightSource->updateInfluenceRadius(g_lightCutoff);
 				if (!lightSource->isEnabled())
 					continue;
+				isCulled[i] = g_cullLights && !isLightVisible(*lightSource, cameraViewProjection);
+				if (isCulled[i])
+				{
+					culledLights |= 1 << i;
+					g_numCulledLights++;
+				}
+				else
+					g_numVisibleLights++;
+			}
+
+			updateShadowMapBudget();
+
+			// NOTE: the OBJ is static unless animated
+			std::vector<ShadowCaster> casters;
+			casters.emplace_back(ShadowCaster{ &objMesh, objModel, !g_animateObj });
+			for (auto k = 0; k < g_numDynamicCasters; k++)
+				casters.emplace_back(ShadowCaster{ &objMesh, getDynamicCasterModel(k), false });
+			glm::vec3 castersMin(FLT_MAX), castersMax(-FLT_MAX);
+			for (auto& caster : casters)
+			{
+				transformBounds(caster.model, objMin, objMax, caster.boundsMin, caster.boundsMax);
+				castersMin = glm::min(castersMin, caster.boundsMin);
+				castersMax = glm::max(castersMax, caster.boundsMax);
+			}
+
+			// NOTE: virtual shadow map feedback (asynchronous read back, see readBackFeedback())
+			if (useVirtualShadowMaps())
+			{
+				if (!g_hasPageTables)
+					createPageTables();
+				updateFeedbackFramebuffer();
+				glBindFramebuffer(GL_FRAMEBUFFER, g_feedbackFramebuffer);
+				glViewport(0, 0, g_feedbackWidth, g_feedbackHeight);
+				setDepthConvention(g_camera.reversedDepth);
+				glClearColor(0, 0, 0, 0);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				glUseProgram(shader9);
+				glUniformMatrix4fv(uView_shader9, 1, GL_FALSE, glm::value_ptr(g_navigator.getLocalToWorldTransform()));
+				glUniformMatrix4fv(uProjection_shader9, 1, GL_FALSE, glm::value_ptr(g_camera.getProjection(g_aspectRatio)));
+				for (auto& caster : casters)
+				{
+					glUniformMatrix4fv(uModel_shader9, 1, GL_FALSE, glm::value_ptr(caster.model));
+					caster.mesh->draw();
+				}
+				glUniformMatrix4fv(uModel_shader9, 1, GL_FALSE, glm::value_ptr(planeModel));
+				planeMesh.draw();
+				readBackFeedback();
+			}
+			else
+			{
+				for (auto& shadowMap : g_shadowMaps)
+					shadowMap.pageTable.reset();
+				g_feedback.clear();
+			}
+			g_numResidentPages = g_numRenderedPages = g_numMissingPages = 0;
+
+			g_shadowDrawCalls = 0;
+			g_numCachedShadowMaps = 0;
+			std::vector<ShadowPassInputs> shadowPassInputs(g_lightSources.size());
+			std::vector<bool> isStaticLayerDirty(g_lightSources.size(), false), isDirty(g_lightSources.size(), false);
+			std::vector<ShadowScheduler::Candidate> candidates(g_lightSources.size(), ShadowScheduler::Candidate{ 0, 0, 0, 0, false });
+			std::vector<bool> isDeferrable(g_lightSources.size(), false);
+			// NOTE: cube maps only update the faces whose casters changed
+			std::vector<int> dirtyCubeFaces(g_lightSources.size(), 0), emptyCubeFaces(g_lightSources.size(), 0);
+			std::vector<std::array<std::vector<glm::mat4>, 6>> cubeFaceCasters(g_lightSources.size());
+			for (auto i = 0; i < g_lightSources.size(); i++)
+			{
+				auto& lightSource = g_lightSources[i];
+				if (!lightSource->isEnabled() || isCulled[i])
+					continue;
+				auto& shadowMap = g_shadowMaps[i];
+				auto& inputs = shadowPassInputs[i] = getShadowPassInputs(*lightSource, casters);
+				isStaticLayerDirty[i] = !g_cacheShadowMaps || !shadowMap.isValid || !isSameLight(inputs, shadowMap.inputs) || (useStaticLayers() && !shadowMap.isStaticLayerValid) || inputs.staticCasters != shadowMap.inputs.staticCasters;
+				isDirty[i] = isStaticLayerDirty[i] || inputs.dynamicCasters != shadowMap.inputs.dynamicCasters;
+				if (shadowMap.hasCubeMap)
+				{
+					for (auto& caster : casters)
+					{
+						auto faces = getCubeFaceMask(lightSource->getPosition(), caster.boundsMin, caster.boundsMax);
+						for (int j = 0; j < 6; j++)
+							if (faces & (1 << j))
+								cubeFaceCasters[i][j].push_back(caster.model);
+					}
+					for (int j = 0; j < 6; j++)
+					{
+						if (cubeFaceCasters[i][j].empty())
+							emptyCubeFaces[i] |= 1 << j;
+						if (isStaticLayerDirty[i] || cubeFaceCasters[i][j] != shadowMap.cubeFaceCasters[j])
+							dirtyCubeFaces[i] |= 1 << j;
+					}
+					isDirty[i] = dirtyCubeFaces[i] != 0;
+				}
+				// NOTE: virtual shadow maps manage their own pages every frame
+				isDeferrable[i] = isDirty[i] && !inputs.isVirtual;
+				auto isMandatory = !shadowMap.isValid || shadowMap.inputs.type != inputs.type || shadowMap.inputs.isVirtual != inputs.isVirtual;
+				candidates[i] = ShadowScheduler::Candidate{ getShadowMapTexels(shadowMap) * g_shadowUpdateCost / 1000000.0f, getScreenCoverage(*lightSource), (shadowMap.isValid) ? getLightMotion(inputs, shadowMap.inputs) : 0.0f, shadowMap.age, isMandatory };
+			}
+
+			// NOTE: stale shadow maps keep their content, and are looked up with the light position (and view projection) they were rendered with
+			std::vector<bool> isScheduled(g_lightSources.size(), true);
+			if (g_amortizeShadowUpdates)
+			{
+				std::vector<ShadowScheduler::Candidate> deferrableCandidates;
+				for (auto i = 0; i < g_lightSources.size(); i++)
+					if (isDeferrable[i])
+						deferrableCandidates.push_back(candidates[i]);
+				auto selected = ShadowScheduler::Schedule(deferrableCandidates, g_shadowUpdateBudget);
+				for (auto i = 0, j = 0; i < g_lightSources.size(); i++)
+					if (isDeferrable[i])
+						isScheduled[i] = selected[j++];
+			}
+			g_numScheduledShadowMaps = g_numDeferredShadowMaps = g_maxShadowMapAge = g_numSkippedCubeFaces = 0;
+			size_t renderedTexels = 0;
+
+			// NOTE: renders the shadow map of light i, returns false if it couldn't be attached
+			auto renderShadowPass = [&](int i)
+			{
+				auto& lightSource = g_lightSources[i];
 				auto& shadowMap = g_shadowMaps[i];
+				setDepthConvention(false);
 				switch (lightSource->getType())
 				{
 				case DIRECTIONAL:
 				{
-					glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap.texture, 0);
-					if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-						continue;
+					if (useVirtualShadowMaps())
+					{
+						glBindFramebuffer(GL_FRAMEBUFFER, g_framebuffer);
+						glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap.texture, 0);
+						if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+							return false;
+						auto viewProjection = lightSource->getViewProjection();
+						auto virtualPagesPerSide = VIRTUAL_SHADOW_MAP_SIZE / VIRTUAL_SHADOW_MAP_PAGE_SIZE;
+						auto physicalPagesPerSide = shadowMap.resolution / VIRTUAL_SHADOW_MAP_PAGE_SIZE;
+						auto invalidated = shadowMap.pageTable == nullptr || isDirty[i] || viewProjection != shadowMap.viewProjection;
+						// NOTE: cached pages are only valid for the view projection they were rendered with
+						if (shadowMap.pageTable == nullptr)
+							shadowMap.pageTable.reset(new VirtualShadowMap::PageTable(virtualPagesPerSide, physicalPagesPerSide));
+						else if (invalidated)
+							shadowMap.pageTable->invalidate();
+						if (invalidated)
+							beginShadowAtlasTile(shadowMap.atlasRect);
+						shadowMap.viewProjection = viewProjection;
+						shadowMap.warp = glm::mat4(1);
+						// NOTE: same estimate as the blocker search width (see SearchWidth() in the main fragment shader)
+						auto uvMargin = (g_displayMode == DisplayMode::HARD_SHADOWS) ? 0.0f : lightSource->getSize() / g_frustumSize * (1 - NEAR) / std::max(1.0f, g_navigator.getPosition().z);
+						requestVirtualShadowMapPages(*shadowMap.pageTable, viewProjection, g_feedback, castersMin, castersMax, uvMargin);
+						auto mappings = shadowMap.pageTable->update();
+						glUseProgram(shader0);
+						for (auto& mapping : mappings)
+						{
+							auto physicalX = mapping.physicalPage % physicalPagesPerSide, physicalY = mapping.physicalPage / physicalPagesPerSide;
+							beginShadowAtlasTile(ShadowAtlas::Rect{ shadowMap.atlasRect.x + physicalX * VIRTUAL_SHADOW_MAP_PAGE_SIZE, shadowMap.atlasRect.y + physicalY * VIRTUAL_SHADOW_MAP_PAGE_SIZE, VIRTUAL_SHADOW_MAP_PAGE_SIZE, VIRTUAL_SHADOW_MAP_PAGE_SIZE });
+							auto crop = getVirtualPageCrop(mapping.virtualPage % virtualPagesPerSide, mapping.virtualPage / virtualPagesPerSide, virtualPagesPerSide);
+							for (auto& caster : casters)
+							{
+								glUniformMatrix4fv(uModelViewProjection0, 1, GL_FALSE, glm::value_ptr(crop * viewProjection * caster.model));
+								caster.mesh->draw();
+								g_shadowDrawCalls++;
+							}
+						}
+						if (invalidated || !mappings.empty())
+							uploadPageTable(*shadowMap.pageTable, i);
+						g_numResidentPages += (int)shadowMap.pageTable->getNumResidentPages();
+						g_numRenderedPages += (int)mappings.size();
+						g_numMissingPages += (int)shadowMap.pageTable->getNumMissingPages();
+						renderedTexels += mappings.size() * VIRTUAL_SHADOW_MAP_PAGE_SIZE * VIRTUAL_SHADOW_MAP_PAGE_SIZE;
+						if (!isDirty[i] && mappings.empty())
+							g_numCachedShadowMaps++;
+						break;
+					}
 					// TODO: compute view projection only when needed
 					auto viewProjection = shadowMap.viewProjection = lightSource->getViewProjection();
-					glClear(GL_DEPTH_BUFFER_BIT);
-					glUseProgram(shader0);
-					glUniformMatrix4fv(uModelViewProjection0, 1, GL_FALSE, glm::value_ptr(viewProjection));
-					objMesh.draw();
+					shadowMap.warp = shadowPassInputs[i].warp;
+					auto isWarped = shadowMap.warp != glm::mat4(1);
+					auto uModelViewProjection = (isWarped) ? uModelViewProjection_shader12 : uModelViewProjection0;
+					glUseProgram((isWarped) ? shader12 : shader0);
+					if (isWarped)
+						glUniformMatrix4fv(uWarp_shader12, 1, GL_FALSE, glm::value_ptr(shadowMap.warp));
+					auto rendered = renderShadowMap(shadowMap, casters, isStaticLayerDirty[i], [&](const ShadowCaster& caster, int)
+					{
+						glUniformMatrix4fv(uModelViewProjection, 1, GL_FALSE, glm::value_ptr(viewProjection * caster.model));
+						caster.mesh->draw();
+						g_shadowDrawCalls++;
+					});
+					if (!rendered)
+						return false;
 				}
 				break;
 				case POINT:
 				{
+					if (shadowMap.hasTexture)
+					{
+						// NOTE: warping happens per vertex, so triangles are not curved (i.e., coarse geometry shows seams)
+						glUseProgram(shader7);
+						glUniform3fv(uLightPosition_shader7, 1, glm::value_ptr(lightSource->getPosition()));
+						glUniform1f(uFarPlane_shader7, POINT_LIGHT_FAR);
+						glEnable(GL_CLIP_DISTANCE0);
+						auto rendered = renderShadowMap(shadowMap, casters, isStaticLayerDirty[i], [&](const ShadowCaster& caster, int)
+						{
+							glUniformMatrix4fv(uModel_shader7, 1, GL_FALSE, glm::value_ptr(caster.model));
+							for (int j = 0; j < 2; j++)
+							{
+								glViewport((GLint)(shadowMap.atlasRect.x + j * shadowMap.resolution), (GLint)shadowMap.atlasRect.y, (GLsizei)shadowMap.resolution, (GLsizei)shadowMap.resolution);
+								glUniform1f(uHemisphere_shader7, (j == 0) ? 1.0f : -1.0f);
+								caster.mesh->draw();
+								g_shadowDrawCalls++;
+							}
+						});
+						glDisable(GL_CLIP_DISTANCE0);
+						if (!rendered)
+							return false;
+						break;
+					}
+					// NOTE: the whole cube map is attached as a layered target, instances are routed to faces by the geometry shader
+					glm::mat4 faceViewProjections[6];
 					for (int j = 0; j < 6; j++)
+						faceViewProjections[j] = lightSource->getViewProjection(GL_TEXTURE_CUBE_MAP_POSITIVE_X + j);
+					glUseProgram(shader6);
+					glUniformMatrix4fv(uFaceViewProjections_shader6, 6, GL_FALSE, glm::value_ptr(faceViewProjections[0]));
+					glUniform3fv(uLightPosition_shader6, 1, glm::value_ptr(lightSource->getPosition()));
+					glUniform1f(uFarPlane_shader6, POINT_LIGHT_FAR);
+					// NOTE: one instance per face the caster overlaps (among the ones being updated)
+					auto rendered = renderShadowMap(shadowMap, casters, isStaticLayerDirty[i], [&](const ShadowCaster& caster, int faces)
 					{
-						auto textureTarget = GL_TEXTURE_CUBE_MAP_POSITIVE_X + j;
-						glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureTarget, shadowMap.cubeMap, 0);
-						if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-							continue;
-						auto viewProjection = lightSource->getViewProjection(textureTarget);
-						glClear(GL_DEPTH_BUFFER_BIT);
-						glUseProgram(shader0);
-						glUniformMatrix4fv(uModelViewProjection0, 1, GL_FALSE, glm::value_ptr(viewProjection));
-						objMesh.draw();
+						faces &= getCubeFaceMask(lightSource->getPosition(), caster.boundsMin, caster.boundsMax);
+						GLint faceList[6];
+						GLsizei numFaces = 0;
+						for (int j = 0; j < 6; j++)
+							if (faces & (1 << j))
+								faceList[numFaces++] = j;
+						if (numFaces == 0)
+							return;
+						glUniform1iv(uFaces_shader6, numFaces, faceList);
+						glUniformMatrix4fv(uModel_shader6, 1, GL_FALSE, glm::value_ptr(caster.model));
+						caster.mesh->drawInstanced(numFaces);
+						g_shadowDrawCalls++;
+					}, dirtyCubeFaces[i]);
+					if (!rendered)
+						return false;
+					for (int j = 0; j < 6; j++)
+					{
+						if ((dirtyCubeFaces[i] & (1 << j)) == 0 || (emptyCubeFaces[i] & (1 << j)) != 0)
+							g_numSkippedCubeFaces++;
+						shadowMap.cubeFaceCasters[j] = cubeFaceCasters[i][j];
 					}
+					shadowMap.emptyCubeFaces = emptyCubeFaces[i];
+				}
+				break;
+				case SPOT:
+				{
+					auto viewProjection = shadowMap.viewProjection = lightSource->getViewProjection();
+					glUseProgram(shader8);
+					glUniformMatrix4fv(uViewProjection_shader8, 1, GL_FALSE, glm::value_ptr(viewProjection));
+					glUniform3fv(uLightPosition_shader8, 1, glm::value_ptr(lightSource->getPosition()));
+					glUniform1f(uFarPlane_shader8, POINT_LIGHT_FAR);
+					auto rendered = renderShadowMap(shadowMap, casters, isStaticLayerDirty[i], [&](const ShadowCaster& caster, int)
+					{
+						glUniformMatrix4fv(uModel_shader8, 1, GL_FALSE, glm::value_ptr(caster.model));
+						caster.mesh->draw();
+						g_shadowDrawCalls++;
+					});
+					if (!rendered)
+						return false;
 				}
 				break;
 				// FIXME: checking invariants
 				default:
 					throw std::runtime_error("unknown light type");
 				}
+				return true;
+			};
+
+			for (auto i = 0; i < g_lightSources.size(); i++)
+			{
+				auto& lightSource = g_lightSources[i];
+				if (!lightSource->isEnabled() || isCulled[i])
+					continue;
+				auto& shadowMap = g_shadowMaps[i];
+				auto& inputs = shadowPassInputs[i];
+				// NOTE: rendered right before the light's forward pass instead (see below), only its view projection is needed up front
+				if (multiPass)
+				{
+					if (lightSource->getType() != POINT)
+						shadowMap.viewProjection = lightSource->getViewProjection();
+					shadowMap.warp = inputs.warp;
+					shadowMap.inputs = inputs;
+					continue;
+				}
+				if (!isDirty[i] && !inputs.isVirtual)
+				{
+					g_numCachedShadowMaps++;
+					continue;
+				}
+				if (!isScheduled[i])
+				{
+					shadowMap.age++;
+					g_numDeferredShadowMaps++;
+					g_maxShadowMapAge = std::max(g_maxShadowMapAge, (int)shadowMap.age);
+					continue;
+				}
+				if (!renderShadowPass(i))
+					continue;
+				if (!inputs.isVirtual)
+				{
+					renderedTexels += getShadowMapTexels(shadowMap);
+					g_numScheduledShadowMaps++;
+				}
+				shadowMap.inputs = inputs;
+				shadowMap.isValid = true;
+				shadowMap.age = 0;
+			}
+
+			// NOTE: the query result lags a few frames behind, so it's tagged with the texels rendered in the frame it measures
+			// (the raw time includes fixed costs, which is good enough for a running estimate)
+			if (shadowPassesTimer.end(renderedTexels) && shadowPassesTimer.getLastTag() > 0)
+				g_shadowUpdateCost = SHADOW_UPDATE_COST_SMOOTHING * g_shadowUpdateCost + (1 - SHADOW_UPDATE_COST_SMOOTHING) * (shadowPassesTimer.getLastTime() / (shadowPassesTimer.getLastTag() / 1000000.0f));
+			g_shadowPassesTime = shadowPassesTimer.getElapsedTime();
+			frameGPUTime += shadowPassesTimer.getLastTime();
+			updateShadowScheduleString(isScheduled, isDeferrable);
+			g_shadowMapMemory = getShadowMapMemory();
+			g_peakShadowMapMemory = std::max(g_peakShadowMapMemory, g_shadowMapMemory);
+
+			//////////////////////////////////////////////////////////////////////////
+			// Moment passes (moments, horizontal blur, vertical blur, mipmaps and optional summed-area tables)
+
+			if (g_displayMode == DisplayMode::MOMENT_SOFT_SHADOWS)
+			{
+				momentPassesTimer.begin();
+
+				if (!g_hasMomentMaps || g_numMomentMapLayers < g_lightSources.size())
+					createMomentMaps(std::max<size_t>(1, g_lightSources.size()));
+
+				glBindFramebuffer(GL_FRAMEBUFFER, g_momentFramebuffer);
+				glViewport(0, 0, MOMENT_MAP_SIZE, MOMENT_MAP_SIZE);
+				glDisable(GL_DEPTH_TEST);
+				glActiveTexture(GL_TEXTURE0);
+				for (auto i = 0; i < g_lightSources.size(); i++)
+				{
+					auto& lightSource = g_lightSources[i];
+					auto& shadowMap = g_shadowMaps[i];
+					if (!lightSource->isEnabled() || lightSource->getType() != DIRECTIONAL || useVirtualShadowMaps())
+						continue;
+
+					glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_momentMaps, 0, (GLint)i);
+					if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+						continue;
+					glUseProgram(shader3);
+					glBindTexture(GL_TEXTURE_2D, shadowMap.texture);
+					glUniform1i(uShadowMap_shader3, 0);
+					glUniform2i(uOrigin_shader3, (GLint)shadowMap.atlasRect.x, (GLint)shadowMap.atlasRect.y);
+					glUniform1i(uDownsampling_shader3, (GLint)std::max<size_t>(1, shadowMap.resolution / MOMENT_MAP_SIZE));
+					glUniform1i(uUpsampling_shader3, (GLint)std::max<size_t>(1, MOMENT_MAP_SIZE / std::max<size_t>(1, shadowMap.resolution)));
+					glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+					glUseProgram(shader4);
+					glUniform1i(uSource_shader4, 0);
+					glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_momentBlurTexture, 0, 0);
+					glBindTexture(GL_TEXTURE_2D_ARRAY, g_momentMaps);
+					glUniform2f(uDirection_shader4, 1.0f / MOMENT_MAP_SIZE, 0);
+					glUniform1i(uLayer_shader4, (GLint)i);
+					glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+					glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_momentMaps, 0, (GLint)i);
+					glBindTexture(GL_TEXTURE_2D_ARRAY, g_momentBlurTexture);
+					glUniform2f(uDirection_shader4, 0, 1.0f / MOMENT_MAP_SIZE);
+					glUniform1i(uLayer_shader4, 0);
+					glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+				}
+				glBindTexture(GL_TEXTURE_2D_ARRAY, g_momentMaps);
+				glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+				if (g_momentFiltering == MomentFiltering::GPU_SUMMED_AREA_TABLES)
+				{
+					// NOTE: log2(MOMENT_MAP_SIZE) horizontal passes followed by as many vertical passes,
+					// ping-ponging between the blur texture (even passes) and the table (odd passes)
+					glUseProgram(shader5);
+					glUniform1i(uSource_shader5, 0);
+					for (auto i = 0; i < g_lightSources.size(); i++)
+					{
+						auto& lightSource = g_lightSources[i];
+						if (!lightSource->isEnabled() || lightSource->getType() != DIRECTIONAL || useVirtualShadowMaps())
+							continue;
+
+						auto pass = 0;
+						for (auto j = 0; j < 2; j++)
+						{
+							glUniform2i(uDirection_shader5, 1 - j, j);
+							for (auto stride = 1; stride < MOMENT_MAP_SIZE; stride *= 2, pass++)
+							{
+								if (pass == 0)
+									glBindTexture(GL_TEXTURE_2D_ARRAY, g_momentMaps);
+								else
+									glBindTexture(GL_TEXTURE_2D_ARRAY, (pass % 2 == 0) ? g_summedAreaTables : g_momentBlurTexture);
+								if (pass % 2 == 0)
+									glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_momentBlurTexture, 0, 0);
+								else
+									glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_summedAreaTables, 0, (GLint)i);
+								glUniform1i(uLayer_shader5, (pass % 2 == 0) ? (GLint)i : 0);
+								glUniform1i(uAverageLevel_shader5, (pass == 0) ? MOMENT_MAP_MAX_LEVEL : -1);
+								glUniform1i(uStride_shader5, stride);
+								glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+							}
+						}
+					}
+				}
+				else if (g_momentFiltering == MomentFiltering::CPU_SUMMED_AREA_TABLES)
+					buildSummedAreaTablesOnCPU();
+
+				glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+				glEnable(GL_DEPTH_TEST);
+
+				momentPassesTimer.end();
+				g_momentPassesTime = momentPassesTimer.getElapsedTime();
+				frameGPUTime += momentPassesTimer.getLastTime();
+			}
+			else
+				g_momentPassesTime = 0;
+
+			//////////////////////////////////////////////////////////////////////////
+			// Min/max passes (light's atlas tile into the first level, then each level into the next one)
+
+			if (useMinMaxShadowMaps())
+			{
+				minMaxPassesTimer.begin();
+
+				if (!g_hasMinMaxMaps || g_numMinMaxMapLayers < g_lightSources.size())
+					createMinMaxMaps(std::max<size_t>(1, g_lightSources.size()));
+
+				glBindFramebuffer(GL_FRAMEBUFFER, g_minMaxFramebuffer);
+				glDisable(GL_DEPTH_TEST);
+				glUseProgram(shader11);
+				glUniform1i(uShadowMap_shader11, 0);
+				glUniform1i(uSource_shader11, 1);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, g_minMaxMaps);
+				glActiveTexture(GL_TEXTURE0);
+				for (auto i = 0; i < g_lightSources.size(); i++)
+				{
+					auto& lightSource = g_lightSources[i];
+					auto& shadowMap = g_shadowMaps[i];
+					if (!lightSource->isEnabled() || lightSource->getType() != DIRECTIONAL)
+						continue;
+
+					glUniform1i(uLayer_shader11, (GLint)i);
+					for (auto level = 0; level <= MIN_MAX_MAP_MAX_LEVEL; level++)
+					{
+						glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, g_minMaxMaps, level, (GLint)i);
+						if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+							break;
+						glViewport(0, 0, MIN_MAX_MAP_SIZE >> level, MIN_MAX_MAP_SIZE >> level);
+						glUniform1i(uLevel_shader11, level);
+						if (level == 0)
+						{
+							glBindTexture(GL_TEXTURE_2D, shadowMap.texture);
+							glUniform2i(uOrigin_shader11, (GLint)shadowMap.atlasRect.x, (GLint)shadowMap.atlasRect.y);
+							glUniform1i(uDownsampling_shader11, (GLint)std::max<size_t>(1, shadowMap.resolution / MIN_MAX_MAP_SIZE));
+							glUniform1i(uUpsampling_shader11, (GLint)std::max<size_t>(1, MIN_MAX_MAP_SIZE / std::max<size_t>(1, shadowMap.resolution)));
+						}
+						// NOTE: a single level of the source is visible to the pass (the previous one), so that it never samples the level it renders to
+						auto sourceLevel = (level == 0) ? MIN_MAX_MAP_MAX_LEVEL : level - 1;
+						glActiveTexture(GL_TEXTURE1);
+						glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, sourceLevel);
+						glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, sourceLevel);
+						glActiveTexture(GL_TEXTURE0);
+						glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+					}
+				}
+				glActiveTexture(GL_TEXTURE1);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, MIN_MAX_MAP_MAX_LEVEL);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, 0);
+				glEnable(GL_DEPTH_TEST);
+
+				minMaxPassesTimer.end();
+				g_minMaxPassesTime = minMaxPassesTimer.getElapsedTime();
+				frameGPUTime += minMaxPassesTimer.getLastTime();
 			}
+			else
+				g_minMaxPassesTime = 0;
 
 			//////////////////////////////////////////////////////////////////////////
 			// Forward pass
 
 			//glCullFace(GL_BACK);
 
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
-			glViewport(0, 0, g_screenWidth, g_screenHeight);
+			forwardPassTimer.begin();
+
+			glBindFramebuffer(GL_FRAMEBUFFER, getSceneFramebuffer());
+			glViewport(0, 0, g_renderWidth, g_renderHeight);
+			setDepthConvention(g_camera.reversedDepth);
 
 			glClearColor(g_ambientColor.r, g_ambientColor.g, g_ambientColor.b, 0.0f);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			if (multiPass && !g_drawShadowMap)
+			{
+				updateAccumulationFramebuffer();
+				glBindFramebuffer(GL_FRAMEBUFFER, g_accumulationFramebuffer);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			}
 			if (g_drawShadowMap)
 			{
 				if (g_shadowMapIndex >= 0 && g_shadowMapIndex < g_lightSources.size())
@@ -767,6 +3060,8 @@ int main(int argc, char** argv)
 					glActiveTexture(GL_TEXTURE0);
 					glBindTexture(GL_TEXTURE_2D, g_shadowMaps[g_shadowMapIndex].texture);
 					glUniform1i(uShadowMap, 0);
+					auto uRect = glGetUniformLocation(shader1, "rect");
+					glUniform4fv(uRect, 1, glm::value_ptr(getShadowAtlasRect(g_shadowMaps[g_shadowMapIndex])));
 					glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 				}
 				checkOpenGLError();
@@ -775,39 +3070,56 @@ int main(int argc, char** argv)
 			{
 				auto eyePosition = g_navigator.getPosition();
 				auto view = g_navigator.getLocalToWorldTransform();
-				auto invView = glm::inverse(view);
 				auto projection = g_camera.getProjection(g_aspectRatio);
-				auto lightProjection = glm::perspective(glm::radians(90.0f), 1.0f, 1.0f, 10.0f);
+
+				//////////////////////////////////////////////////////////////////////////
+				// Build light grid
+
+				if (g_clusteredLighting)
+				{
+					auto buildStart = std::chrono::high_resolution_clock::now();
+					lightGrid.setup(projection[0][0], projection[1][1], g_camera.zn, g_camera.zf);
+					clusteredLightSpheres.clear();
+					for (auto k = 0; k < g_numClusteredLights; k++)
+					{
+						auto& positionAndRadius = g_clusteredLights[k * 2];
+						auto viewPosition = view * glm::vec4(positionAndRadius.xyz(), 1);
+						clusteredLightSpheres.emplace_back(ClusteredLighting::Sphere{ viewPosition.x, viewPosition.y, viewPosition.z, positionAndRadius.w });
+					}
+					lightGrid.cull(clusteredLightSpheres);
+					g_numClusterOverflows = (int)lightGrid.pack(clusterData, g_maxTextureBufferSize);
+					g_lightGridBuildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+					g_maxLightsPerCluster = (int)lightGrid.getMaxLightsPerCluster();
+					streamTextureBuffer(g_clusterDataBuffer, g_clusterDataCapacity, &clusterData[0], clusterData.size() * sizeof(uint32_t));
+				}
 
 				//////////////////////////////////////////////////////////////////////////
 				// Draw OBJ
 
-				glUseProgram(shader2);
+				GLuint program = (useShadowMasks()) ? (GLuint)shader13 : (GLuint)shader2;
+				if (program != forwardProgram)
+				{
+					forwardProgram = program;
+					getUniformLocations_shader2(forwardProgram);
+					for (auto& shadowMap : g_shadowMaps)
+						shadowMap.textureLocation = shadowMap.viewProjectionLocation = shadowMap.cubeMapLocation = shadowMap.comparisonTextureLocation = -2;
+				}
+				glUseProgram(forwardProgram);
 
 				if (uEyePosition_shader2 != -1)
 					glUniform3fv(uEyePosition_shader2, 1, glm::value_ptr(eyePosition));
 				if (uView_shader2 != -1)
 					glUniformMatrix4fv(uView_shader2, 1, GL_FALSE, glm::value_ptr(view));
-				if (uInvView_shader2 != -1)
-					glUniformMatrix4fv(uInvView_shader2, 1, GL_FALSE, glm::value_ptr(invView));
 				if (uProjection_shader2 != -1)
 					glUniformMatrix4fv(uProjection_shader2, 1, GL_FALSE, glm::value_ptr(projection));
-				if (uLightProjection_shader2 != -1)
-					glUniformMatrix4fv(uLightProjection_shader2, 1, GL_FALSE, glm::value_ptr(lightProjection));
-				if (uModel_shader2 != -1)
-					glUniformMatrix4fv(uModel_shader2, 1, GL_FALSE, glm::value_ptr(objModel));
-				if (uTex0_shader2 != -1)
-				{
-					glActiveTexture(GL_TEXTURE0);
-					glBindTexture(GL_TEXTURE_2D, g_tex0[0]);
-					glUniform1i(uTex0_shader2, 0);
-				}
+				if (uPointLightNear_shader2 != -1)
+					glUniform1f(uPointLightNear_shader2, POINT_LIGHT_NEAR);
+				if (uPointLightFar_shader2 != -1)
+					glUniform1f(uPointLightFar_shader2, POINT_LIGHT_FAR);
+				if (uUseDualParaboloids_shader2 != -1)
+					glUniform1i(uUseDualParaboloids_shader2, (GLint)useDualParaboloids());
 				if (uAmbientColor_shader2 != -1)
 					glUniform3fv(uAmbientColor_shader2, 1, glm::value_ptr(g_ambientColor));
-				if (uSpecularColor_shader2 != -1)
-					glUniform3fv(uSpecularColor_shader2, 1, glm::value_ptr(g_specularColor));
-				if (uSpecularity_shader2 != -1)
-					glUniform1f(uSpecularity_shader2, g_specularity);
 				if (lightSourcesBlockIndex != GL_INVALID_INDEX)
 				{
 					glBindBuffer(GL_UNIFORM_BUFFER, lightSourcesUniformBuffer);
@@ -820,6 +3132,84 @@ int main(int argc, char** argv)
 					glUniform1f(uPointLightShadowMapBias_shader2, g_pointLightShadowMapBias);
 				if (uFrustumSize_shader2 != -1)
 					glUniform1f(uFrustumSize_shader2, g_frustumSize);
+				if (uMomentMaps_shader2 != -1 && g_hasMomentMaps)
+				{
+					auto texUnit = 2 * g_shadowMaps.size() + 3;
+					glActiveTexture(GL_TEXTURE0 + texUnit);
+					glBindTexture(GL_TEXTURE_2D_ARRAY, g_momentMaps);
+					glUniform1i(uMomentMaps_shader2, (GLint)texUnit);
+				}
+				if (uMomentMapSize_shader2 != -1)
+					glUniform1f(uMomentMapSize_shader2, (float)MOMENT_MAP_SIZE);
+				if (uShadowMapWarps_shader2 != -1)
+				{
+					std::vector<glm::mat4> shadowMapWarps(MAX_NUM_LIGHT_SOURCES, glm::mat4(1));
+					int warpedShadowMaps = 0;
+					for (auto i = 0; i < g_shadowMaps.size(); i++)
+					{
+						if (g_shadowMaps[i].warp == glm::mat4(1))
+							continue;
+						shadowMapWarps[i] = g_shadowMaps[i].warp;
+						warpedShadowMaps |= 1 << i;
+					}
+					glUniformMatrix4fv(uShadowMapWarps_shader2, MAX_NUM_LIGHT_SOURCES, GL_FALSE, glm::value_ptr(shadowMapWarps[0]));
+					if (uWarpedShadowMaps_shader2 != -1)
+						glUniform1i(uWarpedShadowMaps_shader2, warpedShadowMaps);
+				}
+				if (uUseMinMaxShadowMaps_shader2 != -1)
+					glUniform1i(uUseMinMaxShadowMaps_shader2, (GLint)useMinMaxShadowMaps());
+				if (uMinMaxMaps_shader2 != -1 && g_hasMinMaxMaps)
+				{
+					auto texUnit = 2 * g_shadowMaps.size() + 10;
+					glActiveTexture(GL_TEXTURE0 + texUnit);
+					glBindTexture(GL_TEXTURE_2D_ARRAY, g_minMaxMaps);
+					glUniform1i(uMinMaxMaps_shader2, (GLint)texUnit);
+				}
+				if (uSummedAreaTables_shader2 != -1 && g_hasMomentMaps)
+				{
+					auto texUnit = 2 * g_shadowMaps.size() + 4;
+					glActiveTexture(GL_TEXTURE0 + texUnit);
+					glBindTexture(GL_TEXTURE_2D_ARRAY, g_summedAreaTables);
+					glUniform1i(uSummedAreaTables_shader2, (GLint)texUnit);
+				}
+				if (uUseSummedAreaTables_shader2 != -1)
+					glUniform1i(uUseSummedAreaTables_shader2, (GLint)(g_momentFiltering != MomentFiltering::MIPMAPS));
+				if (uShadowMapRects_shader2 != -1 && !g_shadowMaps.empty())
+				{
+					std::vector<glm::vec4> shadowMapRects;
+					for (auto& shadowMap : g_shadowMaps)
+						shadowMapRects.emplace_back(getShadowAtlasRect(shadowMap));
+					glUniform4fv(uShadowMapRects_shader2, (GLsizei)shadowMapRects.size(), glm::value_ptr(shadowMapRects[0]));
+				}
+				if (uShadowMapLightPositions_shader2 != -1 && !g_shadowMaps.empty())
+				{
+					std::vector<glm::vec3> shadowMapLightPositions;
+					for (auto& shadowMap : g_shadowMaps)
+						shadowMapLightPositions.emplace_back(shadowMap.inputs.position);
+					glUniform3fv(uShadowMapLightPositions_shader2, (GLsizei)shadowMapLightPositions.size(), glm::value_ptr(shadowMapLightPositions[0]));
+				}
+				if (uEmptyCubeFaces_shader2 != -1 && !g_shadowMaps.empty())
+				{
+					std::vector<GLint> emptyCubeFaces;
+					for (auto& shadowMap : g_shadowMaps)
+						emptyCubeFaces.push_back((shadowMap.hasCubeMap) ? shadowMap.emptyCubeFaces : 0);
+					glUniform1iv(uEmptyCubeFaces_shader2, (GLsizei)emptyCubeFaces.size(), &emptyCubeFaces[0]);
+				}
+				if (uShadowAtlasSize_shader2 != -1)
+					glUniform2f(uShadowAtlasSize_shader2, (float)g_shadowAtlasWidth, (float)std::max<size_t>(1, g_shadowAtlasHeight));
+				if (uUseVirtualShadowMaps_shader2 != -1)
+					glUniform1i(uUseVirtualShadowMaps_shader2, (GLint)useVirtualShadowMaps());
+				if (uPageTables_shader2 != -1 && g_hasPageTables)
+				{
+					auto texUnit = 2 * g_shadowMaps.size() + 5;
+					glActiveTexture(GL_TEXTURE0 + texUnit);
+					glBindTexture(GL_TEXTURE_2D_ARRAY, g_pageTables);
+					glUniform1i(uPageTables_shader2, (GLint)texUnit);
+				}
+				if (uVirtualPagesPerSide_shader2 != -1)
+					glUniform1i(uVirtualPagesPerSide_shader2, VIRTUAL_SHADOW_MAP_SIZE / VIRTUAL_SHADOW_MAP_PAGE_SIZE);
+				if (uPhysicalPagesPerSide_shader2 != -1)
+					glUniform1i(uPhysicalPagesPerSide_shader2, (GLint)(getVirtualShadowMapPoolSize() / VIRTUAL_SHADOW_MAP_PAGE_SIZE));
 				for (auto i = 0; i < g_shadowMaps.size(); i++)
 				{
 					auto& lightSource = g_lightSources[i];
@@ -828,11 +3218,13 @@ int main(int argc, char** argv)
 					auto& shadowMap = g_shadowMaps[i];
 					switch (lightSource->getType())
 					{
+					// NOTE: spot lights are bound like directional lights (their comparison texture is unused)
 					case DIRECTIONAL:
+					case SPOT:
 					{
 						auto uShadowMap = shadowMap.textureLocation;
 						if (uShadowMap == -2)
-							uShadowMap = shadowMap.textureLocation = glGetUniformLocation(shader2, ("shadowMap" + std::to_string(i)).c_str());
+							uShadowMap = shadowMap.textureLocation = glGetUniformLocation(forwardProgram, ("shadowMap" + std::to_string(i)).c_str());
 						if (uShadowMap == -1)
 							continue;
 						glActiveTexture(GL_TEXTURE0 + i + 1);
@@ -840,17 +3232,40 @@ int main(int argc, char** argv)
 						glUniform1i(uShadowMap, (GLint)i + 1);
 						auto uShadowMapViewProjection = shadowMap.viewProjectionLocation;
 						if (uShadowMapViewProjection == -2)
-							uShadowMapViewProjection = shadowMap.viewProjectionLocation = glGetUniformLocation(shader2, ("shadowMapViewProjection" + std::to_string(i)).c_str());
+							uShadowMapViewProjection = shadowMap.viewProjectionLocation = glGetUniformLocation(forwardProgram, ("shadowMapViewProjection" + std::to_string(i)).c_str());
 						if (uShadowMapViewProjection == -1)
 							continue;
 						glUniformMatrix4fv(uShadowMapViewProjection, 1, GL_FALSE, glm::value_ptr(shadowMap.viewProjection));
+						auto uShadowMapComparison = shadowMap.comparisonTextureLocation;
+						if (uShadowMapComparison == -2)
+							uShadowMapComparison = shadowMap.comparisonTextureLocation = glGetUniformLocation(forwardProgram, ("shadowMapComparison" + std::to_string(i)).c_str());
+						if (uShadowMapComparison == -1)
+							continue;
+						auto texUnit = g_shadowMaps.size() + 3 + i;
+						glActiveTexture(GL_TEXTURE0 + texUnit);
+						glBindTexture(GL_TEXTURE_2D, shadowMap.texture);
+						glBindSampler(texUnit, g_comparisonSampler);
+						glUniform1i(uShadowMapComparison, (GLint)texUnit);
 					}
 					break;
 					case POINT:
 					{
+						// NOTE: dual-paraboloid maps are bound as the light's (2D) shadow map
+						if (shadowMap.hasTexture)
+						{
+							auto uShadowMap = shadowMap.textureLocation;
+							if (uShadowMap == -2)
+								uShadowMap = shadowMap.textureLocation = glGetUniformLocation(forwardProgram, ("shadowMap" + std::to_string(i)).c_str());
+							if (uShadowMap == -1)
+								continue;
+							glActiveTexture(GL_TEXTURE0 + i + 1);
+							glBindTexture(GL_TEXTURE_2D, shadowMap.texture);
+							glUniform1i(uShadowMap, (GLint)i + 1);
+							break;
+						}
 						auto uShadowCubeMap = shadowMap.cubeMapLocation;
 						if (uShadowCubeMap == -2)
-							uShadowCubeMap = shadowMap.cubeMapLocation = glGetUniformLocation(shader2, ("shadowCubeMap" + std::to_string(i)).c_str());
+							uShadowCubeMap = shadowMap.cubeMapLocation = glGetUniformLocation(forwardProgram, ("shadowCubeMap" + std::to_string(i)).c_str());
 						if (uShadowCubeMap == -1)
 							continue;
 						glActiveTexture(GL_TEXTURE0 + i + 1);
@@ -863,49 +3278,276 @@ int main(int argc, char** argv)
 						throw std::runtime_error("unknown light type");
 					}
 				}
-				if (uDistribution0_shader2 != -1)
+				if (uBlueNoise_shader2 != -1)
 				{
 					auto texUnit = g_shadowMaps.size() + 2;
 					glActiveTexture(GL_TEXTURE0 + texUnit);
-					glBindTexture(GL_TEXTURE_1D, g_distributions[0]);
-					glUniform1i(uDistribution0_shader2, texUnit);
-				}
-				if (uDistribution1_shader2 != -1)
-				{
-					auto texUnit = g_shadowMaps.size() + 3;
-					glActiveTexture(GL_TEXTURE0 + texUnit);
-					glBindTexture(GL_TEXTURE_1D, g_distributions[1]);
-					glUniform1i(uDistribution1_shader2, texUnit);
+					glBindTexture(GL_TEXTURE_2D, g_blueNoise);
+					glUniform1i(uBlueNoise_shader2, texUnit);
 				}
+				if (uRotateSamples_shader2 != -1)
+					glUniform1i(uRotateSamples_shader2, (GLint)g_rotateSamples);
+				if (uUseTextureGather_shader2 != -1)
+					glUniform1i(uUseTextureGather_shader2, (GLint)g_useTextureGather);
 				if (uNumBlockerSearchSamples_shader2 != -1)
-					glUniform1i(uNumBlockerSearchSamples_shader2, (GLint)g_numBlockerSearchSamples);
+					glUniform1i(uNumBlockerSearchSamples_shader2, (GLint)g_numActiveBlockerSearchSamples);
 				if (uNumPCFSamples_shader2 != -1)
-					glUniform1i(uNumPCFSamples_shader2, (GLint)g_numPCFSamples);
+					glUniform1i(uNumPCFSamples_shader2, (GLint)g_numActivePCFSamples);
+				if (uUseShadowLOD_shader2 != -1)
+					glUniform1i(uUseShadowLOD_shader2, (GLint)g_shadowLOD);
+				if (uShadowLODMidDistance_shader2 != -1)
+					glUniform1f(uShadowLODMidDistance_shader2, g_shadowLODMidDistance);
+				if (uShadowLODFarDistance_shader2 != -1)
+					glUniform1f(uShadowLODFarDistance_shader2, std::max(g_shadowLODFarDistance, g_shadowLODMidDistance));
+				if (uShadowLODTransition_shader2 != -1)
+					glUniform1f(uShadowLODTransition_shader2, g_shadowLODTransition);
+				if (uShadowLODMidSampleScale_shader2 != -1)
+					glUniform1f(uShadowLODMidSampleScale_shader2, glm::clamp(g_shadowLODMidSampleScale, 0.0f, 1.0f));
+				if (uUseShadowLODFilteredTap_shader2 != -1)
+					glUniform1i(uUseShadowLODFilteredTap_shader2, (GLint)g_shadowLODFilteredTap);
+				if (uUseShadowLODFootprint_shader2 != -1)
+					glUniform1i(uUseShadowLODFootprint_shader2, (GLint)g_shadowLODFootprint);
+				// NOTE: world size of a pixel at unit view distance
+				if (uPixelFootprint_shader2 != -1)
+					glUniform1f(uPixelFootprint_shader2, 2.0f / (g_camera.getProjection(g_aspectRatio)[1][1] * g_renderHeight));
 				if (uDisplayMode_shader2 != -1)
 					glUniform1i(uDisplayMode_shader2, (GLint)g_displayMode);
 				if (uSelectedLightSource_shader2 != -1)
 					glUniform1i(uSelectedLightSource_shader2, (GLint)g_selectedLightSource);
+				if (uCulledLights_shader2 != -1)
+					glUniform1i(uCulledLights_shader2, (multiPass) ? (1 << g_lightSources.size()) - 1 : culledLights);
+				if (uUseClusteredLighting_shader2 != -1)
+					glUniform1i(uUseClusteredLighting_shader2, (GLint)g_clusteredLighting);
+				// NOTE: texture buffers are always bound, so that they never share a texture unit with samplers of other types
+				if (uClusterData_shader2 != -1)
+				{
+					auto texUnit = 2 * g_shadowMaps.size() + 6;
+					glActiveTexture(GL_TEXTURE0 + texUnit);
+					glBindTexture(GL_TEXTURE_BUFFER, g_clusterDataTexture);
+					glUniform1i(uClusterData_shader2, (GLint)texUnit);
+				}
+				if (uClusteredLights_shader2 != -1)
+				{
+					auto texUnit = 2 * g_shadowMaps.size() + 7;
+					glActiveTexture(GL_TEXTURE0 + texUnit);
+					glBindTexture(GL_TEXTURE_BUFFER, g_clusteredLightsTexture);
+					glUniform1i(uClusteredLights_shader2, (GLint)texUnit);
+				}
+				if (uClusterGridSize_shader2 != -1)
+					glUniform3i(uClusterGridSize_shader2, CLUSTER_GRID_WIDTH, CLUSTER_GRID_HEIGHT, CLUSTER_GRID_DEPTH);
+				if (uScreenSize_shader2 != -1)
+					glUniform2f(uScreenSize_shader2, (float)g_renderWidth, (float)g_renderHeight);
+				if (uClusterNear_shader2 != -1)
+					glUniform1f(uClusterNear_shader2, g_camera.zn);
+				if (uClusterFar_shader2 != -1)
+					glUniform1f(uClusterFar_shader2, g_camera.zf);
+
+				auto drawScene = [&](GLint uModel, GLint uTex0, GLint uSpecularColor, GLint uSpecularity)
+				{
+					if (uTex0 != -1)
+					{
+						glActiveTexture(GL_TEXTURE0);
+						glBindTexture(GL_TEXTURE_2D, g_tex0[0]);
+						glUniform1i(uTex0, 0);
+					}
+					if (uSpecularColor != -1)
+						glUniform3fv(uSpecularColor, 1, glm::value_ptr(g_specularColor));
+					if (uSpecularity != -1)
+						glUniform1f(uSpecularity, g_specularity);
+
+					for (auto& caster : casters)
+					{
+						if (uModel != -1)
+							glUniformMatrix4fv(uModel, 1, GL_FALSE, glm::value_ptr(caster.model));
+						caster.mesh->draw();
+					}
+
+					if (uModel != -1)
+						glUniformMatrix4fv(uModel, 1, GL_FALSE, glm::value_ptr(planeModel));
+					if (uTex0 != -1)
+					{
+						glActiveTexture(GL_TEXTURE0);
+						glBindTexture(GL_TEXTURE_2D, g_tex0[1]);
+						glUniform1i(uTex0, 0);
+					}
+					if (uSpecularColor != -1)
+						glUniform3fv(uSpecularColor, 1, glm::value_ptr(glm::vec3(0, 0, 0)));
+					if (uSpecularity != -1)
+						glUniform1f(uSpecularity, 0);
+
+					planeMesh.draw();
+				};
 
-				objMesh.draw();
+				//////////////////////////////////////////////////////////////////////////
+				// Shadow mask pass
 
-				if (uModel_shader2 != -1)
-					glUniformMatrix4fv(uModel_shader2, 1, GL_FALSE, glm::value_ptr(planeModel));
-				if (uTex0_shader2 != -1)
+				if (useShadowMasks())
 				{
-					glActiveTexture(GL_TEXTURE0);
-					glBindTexture(GL_TEXTURE_2D, g_tex0[1]);
-					glUniform1i(uTex0_shader2, 0);
+					updateShadowMaskFramebuffer();
+					glBindFramebuffer(GL_FRAMEBUFFER, g_shadowMaskFramebuffer);
+					GLfloat unshadowed[] = { 1, 1, 1, 1 };
+					glClearBufferfv(GL_COLOR, 1, unshadowed);
+					glClearBufferfv(GL_COLOR, 2, unshadowed);
+					glClear(GL_DEPTH_BUFFER_BIT);
+
+					// NOTE: depth pre-pass, so that shadows are evaluated once per visible pixel (depth equal test below)
+					glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+					glUseProgram(shader9);
+					glUniformMatrix4fv(uView_shader9, 1, GL_FALSE, glm::value_ptr(view));
+					glUniformMatrix4fv(uProjection_shader9, 1, GL_FALSE, glm::value_ptr(projection));
+					for (auto& caster : casters)
+					{
+						glUniformMatrix4fv(uModel_shader9, 1, GL_FALSE, glm::value_ptr(caster.model));
+						caster.mesh->draw();
+					}
+					glUniformMatrix4fv(uModel_shader9, 1, GL_FALSE, glm::value_ptr(planeModel));
+					planeMesh.draw();
+					glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+					glDepthMask(GL_FALSE);
+					glDepthFunc(GL_EQUAL);
+					glUseProgram(forwardProgram);
+					drawScene(uModel_shader2, uTex0_shader2, uSpecularColor_shader2, uSpecularity_shader2);
+					glDepthFunc((g_camera.reversedDepth) ? GL_GEQUAL : GL_LEQUAL);
+					glDepthMask(GL_TRUE);
+					glBindFramebuffer(GL_FRAMEBUFFER, getSceneFramebuffer());
+
+					//////////////////////////////////////////////////////////////////////////
+					// Light pass
+
+					glUseProgram(shader10);
+
+					if (uEyePosition_shader10 != -1)
+						glUniform3fv(uEyePosition_shader10, 1, glm::value_ptr(eyePosition));
+					if (uView_shader10 != -1)
+						glUniformMatrix4fv(uView_shader10, 1, GL_FALSE, glm::value_ptr(view));
+					if (uProjection_shader10 != -1)
+						glUniformMatrix4fv(uProjection_shader10, 1, GL_FALSE, glm::value_ptr(projection));
+					if (uAmbientColor_shader10 != -1)
+						glUniform3fv(uAmbientColor_shader10, 1, glm::value_ptr(g_ambientColor));
+					if (uCulledLights_shader10 != -1)
+						glUniform1i(uCulledLights_shader10, culledLights);
+					if (uShadowMasks0_shader10 != -1)
+					{
+						auto texUnit = 2 * g_shadowMaps.size() + 8;
+						glActiveTexture(GL_TEXTURE0 + texUnit);
+						glBindTexture(GL_TEXTURE_2D, g_shadowMaskTextures[0]);
+						glUniform1i(uShadowMasks0_shader10, (GLint)texUnit);
+					}
+					if (uShadowMasks1_shader10 != -1)
+					{
+						auto texUnit = 2 * g_shadowMaps.size() + 9;
+						glActiveTexture(GL_TEXTURE0 + texUnit);
+						glBindTexture(GL_TEXTURE_2D, g_shadowMaskTextures[1]);
+						glUniform1i(uShadowMasks1_shader10, (GLint)texUnit);
+					}
+					if (uUseClusteredLighting_shader10 != -1)
+						glUniform1i(uUseClusteredLighting_shader10, (GLint)g_clusteredLighting);
+					if (uClusterData_shader10 != -1)
+						glUniform1i(uClusterData_shader10, (GLint)(2 * g_shadowMaps.size() + 6));
+					if (uClusteredLights_shader10 != -1)
+						glUniform1i(uClusteredLights_shader10, (GLint)(2 * g_shadowMaps.size() + 7));
+					if (uClusterGridSize_shader10 != -1)
+						glUniform3i(uClusterGridSize_shader10, CLUSTER_GRID_WIDTH, CLUSTER_GRID_HEIGHT, CLUSTER_GRID_DEPTH);
+					if (uScreenSize_shader10 != -1)
+						glUniform2f(uScreenSize_shader10, (float)g_renderWidth, (float)g_renderHeight);
+					if (uClusterNear_shader10 != -1)
+						glUniform1f(uClusterNear_shader10, g_camera.zn);
+					if (uClusterFar_shader10 != -1)
+						glUniform1f(uClusterFar_shader10, g_camera.zf);
+
+					drawScene(uModel_shader10, uTex0_shader10, uSpecularColor_shader10, uSpecularity_shader10);
 				}
-				if (uSpecularColor_shader2 != -1)
-					glUniform3fv(uSpecularColor_shader2, 1, glm::value_ptr(glm::vec3(0, 0, 0)));
-				if (uSpecularity_shader2 != -1)
-					glUniform1f(uSpecularity_shader2, 0);
+				else
+					drawScene(uModel_shader2, uTex0_shader2, uSpecularColor_shader2, uSpecularity_shader2);
 
-				planeMesh.draw();
+				// NOTE: the first pass lays down depth, ambient and clustered lights (shadowed lights are culled, but still normalize),
+				// then each light renders its shadow map into the shared tile and is added on top with the others culled
+				g_numLightPasses = 0;
+				if (multiPass)
+				{
+					auto allLights = (1 << g_lightSources.size()) - 1;
+					glEnable(GL_BLEND);
+					glBlendFunc(GL_ONE, GL_ONE);
+					for (auto i = 0; i < g_lightSources.size(); i++)
+					{
+						if (!g_lightSources[i]->isEnabled() || isCulled[i])
+							continue;
+						auto rendered = renderShadowPass(i);
+						g_shadowMaps[i].isValid = false;
+						if (!rendered)
+							continue;
+						glBindFramebuffer(GL_FRAMEBUFFER, g_accumulationFramebuffer);
+						glViewport(0, 0, g_renderWidth, g_renderHeight);
+						setDepthConvention(g_camera.reversedDepth);
+						glDepthMask(GL_FALSE);
+						glUseProgram(forwardProgram);
+						if (uCulledLights_shader2 != -1)
+							glUniform1i(uCulledLights_shader2, allLights & ~(1 << i));
+						if (uAmbientColor_shader2 != -1)
+							glUniform3fv(uAmbientColor_shader2, 1, glm::value_ptr(glm::vec3(0)));
+						if (uUseClusteredLighting_shader2 != -1)
+							glUniform1i(uUseClusteredLighting_shader2, 0);
+						drawScene(uModel_shader2, uTex0_shader2, uSpecularColor_shader2, uSpecularity_shader2);
+						glDepthMask(GL_TRUE);
+						g_numLightPasses++;
+					}
+					glDisable(GL_BLEND);
+					glBindFramebuffer(GL_READ_FRAMEBUFFER, g_accumulationFramebuffer);
+					glBindFramebuffer(GL_DRAW_FRAMEBUFFER, getSceneFramebuffer());
+					glBlitFramebuffer(0, 0, g_renderWidth, g_renderHeight, 0, 0, g_renderWidth, g_renderHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+					glBindFramebuffer(GL_FRAMEBUFFER, getSceneFramebuffer());
+				}
+
+				// NOTE: texture units are reassigned as shadow maps are added/removed
+				for (auto i = 0; i < g_shadowMaps.size(); i++)
+					glBindSampler(g_shadowMaps.size() + 3 + i, 0);
 
 				checkOpenGLError();
 			}
 
+			// NOTE: upscale to the window
+			if (useSceneFramebuffer())
+			{
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, g_sceneFramebuffer);
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+				glBlitFramebuffer(0, 0, g_renderWidth, g_renderHeight, 0, 0, g_screenWidth, g_screenHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+				glBindFramebuffer(GL_FRAMEBUFFER, 0);
+				glViewport(0, 0, g_screenWidth, g_screenHeight);
+			}
+
+			forwardPassTimer.end();
+			g_forwardPassTime = forwardPassTimer.getElapsedTime();
+			frameGPUTime += forwardPassTimer.getLastTime();
+
+			// NOTE: read back before the UI is drawn, GPU times are measured by queries so the stall doesn't affect them
+			if (g_tuningSession != nullptr)
+			{
+				std::vector<unsigned char> image;
+				if (g_tuningSession->isMeasuring())
+				{
+					image.resize(g_screenWidth * g_screenHeight * 3);
+					glPixelStorei(GL_PACK_ALIGNMENT, 1);
+					glReadPixels(0, 0, g_screenWidth, g_screenHeight, GL_RGB, GL_UNSIGNED_BYTE, &image[0]);
+					image = Tuner::Subsample(image, g_screenWidth, g_screenHeight, TUNING_IMAGE_SUBSAMPLING);
+				}
+				g_tuningSession->advance(frameGPUTime, image);
+				g_tuningProgress = g_tuningSession->getProgress() * 100;
+				if (g_tuningSession->isFinished())
+				{
+					auto front = Tuner::ParetoFront(g_tuningSession->getResults());
+					if (Tuner::Write(TUNING_CONFIG_FILENAME, front, { 2, 4, 8, 12, 16.7f, 33.3f }))
+						std::cout << "tuning config written to " << TUNING_CONFIG_FILENAME << " (" << front.size() << " Pareto-optimal settings)" << std::endl;
+					else
+						std::cout << "couldn't write tuning config " << TUNING_CONFIG_FILENAME << std::endl;
+					applyTuningSettings(g_untunedSettings);
+					g_dynamicResolution = g_untunedDynamicResolution;
+					g_tuningSession = nullptr;
+				}
+			}
+
+			// NOTE: the UI is drawn with the conventional clip space depth
+			setDepthConvention(false);
 			TwDraw();
 
 			glfwSwapBuffers(window);
@@ -914,6 +3556,22 @@ int main(int argc, char** argv)
 
 			auto spf = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start).count() / 1000.0f;
 
+			// NOTE: the new level applies from the next frame (shadow map resolutions through the budget, which reallocates the atlas)
+			g_frameTime = std::chrono::duration<float, std::milli>(std::chrono::system_clock::now() - start).count();
+			if (!g_dynamicResolution)
+				qualityController.setLevel(0);
+			else
+				qualityController.update(g_frameTime, g_shadowPassesTime + g_momentPassesTime + g_minMaxPassesTime + g_forwardPassTime, g_targetFrameTime);
+			auto& qualityLevel = qualityController.getLevel();
+			g_qualityLevel = (int)qualityController.getLevelIndex();
+			g_renderScale = qualityLevel.renderScale;
+			g_shadowMapScale = qualityLevel.shadowMapScale;
+			g_sampleScale = qualityLevel.sampleScale;
+
+			// NOTE: the scene holds still while tuning
+			if (g_tuningSession != nullptr)
+				spf = 0;
+
 			if (g_animateLights)
 				for (auto i = 0; i < g_lightSources.size(); i++)
 				{
@@ -923,6 +3581,12 @@ int main(int argc, char** argv)
 					g_lightSourceAnimations[i]->update(spf);
 				}
 
+			// NOTE: moving the casters invalidates every shadow map
+			if (g_animateObj)
+				objModel = glm::rotate(objModel, spf * glm::pi<float>() * 0.25f, glm::vec3(0, 1, 0));
+			if (g_numDynamicCasters > 0)
+				orbitAngle = glm::mod(orbitAngle + spf * glm::pi<float>() * 0.5f, 2.0f * glm::pi<float>());
+
 			if (g_navigatorAnimation != nullptr)
 			{
 				if (g_navigatorAnimation->isFinished())
@@ -936,7 +3600,11 @@ int main(int argc, char** argv)
 			else
 				g_navigator.update(spf);
 
-			std::string title = "PCSS @ " + std::to_string(1.0f / spf) + " fps";
+			if (g_recordCameraPath)
+				g_cameraPath.emplace_back(CameraPathKey{ g_navigator.getPosition(), g_navigator.getPhi(), g_navigator.getTheta() });
+			g_numCameraPathKeys = (int)g_cameraPath.size();
+
+			std::string title = "PCSS @ " + std::to_string(1000.0f / g_frameTime) + " fps";
 			glfwSetWindowTitle(window, title.c_str());
 
 			glfwPollEvents();
@@ -947,13 +3615,67 @@ int main(int argc, char** argv)
 
 		for (auto& shadowMap : g_shadowMaps)
 		{
-			if (shadowMap.hasTexture)
-				glDeleteTextures(1, &shadowMap.texture);
 			if (shadowMap.hasCubeMap)
 				glDeleteTextures(1, &shadowMap.cubeMap);
+			if (shadowMap.staticCubeMap != 0)
+				glDeleteTextures(1, &shadowMap.staticCubeMap);
+		}
+		if (g_shadowAtlas != 0)
+			glDeleteTextures(1, &g_shadowAtlas);
+		if (g_staticShadowAtlas != 0)
+			glDeleteTextures(1, &g_staticShadowAtlas);
+		if (g_hasPageTables)
+			glDeleteTextures(1, &g_pageTables);
+		if (g_feedbackFramebuffer != 0)
+		{
+			glDeleteFramebuffers(1, &g_feedbackFramebuffer);
+			glDeleteTextures(1, &g_feedbackTexture);
+			glDeleteRenderbuffers(1, &g_feedbackDepthBuffer);
+			glDeleteBuffers(VIRTUAL_SHADOW_MAP_FEEDBACK_LATENCY + 1, g_feedbackPixelBuffers);
+			for (auto fence : g_feedbackFences)
+				if (fence != 0)
+					glDeleteSync(fence);
+		}
+		if (g_accumulationFramebuffer != 0)
+		{
+			glDeleteFramebuffers(1, &g_accumulationFramebuffer);
+			glDeleteTextures(1, &g_accumulationTexture);
+			glDeleteRenderbuffers(1, &g_accumulationDepthBuffer);
+		}
+		if (g_shadowMaskFramebuffer != 0)
+		{
+			glDeleteFramebuffers(1, &g_shadowMaskFramebuffer);
+			glDeleteTextures(2, g_shadowMaskTextures);
+			glDeleteRenderbuffers(1, &g_shadowMaskDepthBuffer);
+		}
+
+		if (g_sceneFramebuffer != 0)
+		{
+			glDeleteFramebuffers(1, &g_sceneFramebuffer);
+			glDeleteTextures(1, &g_sceneTexture);
+			glDeleteRenderbuffers(1, &g_sceneDepthBuffer);
+		}
+
+		if (g_hasMomentMaps)
+		{
+			glDeleteTextures(1, &g_momentMaps);
+			glDeleteTextures(1, &g_summedAreaTables);
+		}
+		glDeleteFramebuffers(1, &g_momentFramebuffer);
+		glDeleteTextures(1, &g_momentBlurTexture);
+		if (g_hasMinMaxMaps)
+		{
+			glDeleteTextures(1, &g_minMaxMaps);
+			glDeleteFramebuffers(1, &g_minMaxFramebuffer);
 		}
 
-		glDeleteTextures(2, g_distributions);
+		glDeleteBuffers(1, &g_distributionsUniformBuffer);
+		glDeleteSamplers(1, &g_comparisonSampler);
+		glDeleteTextures(1, &g_blueNoise);
+		glDeleteTextures(1, &g_clusterDataTexture);
+		glDeleteBuffers(1, &g_clusterDataBuffer);
+		glDeleteTextures(1, &g_clusteredLightsTexture);
+		glDeleteBuffers(1, &g_clusteredLightsBuffer);
 		glDeleteTextures(1, &g_tex0[0]);
 	}
 